@@ -0,0 +1,403 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Writer throughput of every DataStream backend, with frames from the
+ * synthetic source. One tab separated line per case on stdout, progress
+ * and skipped cases on stderr.
+ */
+
+#include "configuration.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "textstream.h"
+#include "multifile.h"
+#include "yaml_binary.h"
+#include "binary.h"
+#include "mmapbinary.h"
+#include "codec.h"
+#include "outputfile.h"
+#include "frame.h"
+#include "synthsource.h"
+#include "runclock.h"
+#ifdef ROOT_FOUND
+ #include "rootoutput.h"
+#endif
+
+// distinct frames written round robin, generated before the clock starts
+#define FRAME_POOL_SIZE 16
+
+static Frame frame_pool[FRAME_POOL_SIZE];
+
+struct BenchFormat {
+    std::string name;
+    std::function<DataStream*()> make;
+    bool binary_output;
+    /// run once per compression level instead of uncompressed (level -1)
+    bool compressed;
+    /// block codec of BIN and YAML, the level is the one of the case
+    CodecSettings codec;
+};
+
+struct BenchResult {
+    bool supported;
+    uint64_t frames;
+    double seconds;
+    double cpu_seconds;
+    uint64_t bytes;
+};
+
+static std::vector<BenchFormat> bench_formats()
+{
+    std::vector<BenchFormat> formats;
+    formats.push_back({"MULTIFILE", []() -> DataStream* { return new MultiFileStream; }, false, false, CodecSettings()});
+    formats.push_back({"MULTIFILE_BIN", []() -> DataStream* { return new MultiFileStream; }, true, false, CodecSettings()});
+    formats.push_back({"TEXT", []() -> DataStream* { return new TextStream; }, false, false, CodecSettings()});
+    formats.push_back({"TEXT_GZ", []() -> DataStream* { return new TextStream; }, true, true, CodecSettings()});
+    formats.push_back({"BIN", []() -> DataStream* { return new BinaryStream; }, true, false, CodecSettings()});
+    formats.push_back({"BIN_MMAP", []() -> DataStream* { return new MappedBinaryStream; }, true, false, CodecSettings()});
+    formats.push_back({"YAML", []() -> DataStream* { return new YAMLBinaryStream; }, true, false, CodecSettings()});
+#ifdef ROOT_FOUND
+    formats.push_back({"ROOT", []() -> DataStream* { return new RootOutput; }, true, false, CodecSettings()});
+#endif
+    // BIN and YAML through every codec compiled in, as BIN_ZLIB, YAML_ZSTD_SHUFFLE etc.
+    std::vector<BenchFormat> binary_formats;
+    for(auto& format: formats) {
+        if(format.name == "BIN" || format.name == "YAML") {
+            binary_formats.push_back(format);
+        }
+    }
+    std::vector<codec_t> codecs = {CODEC_ZLIB, CODEC_LZ4, CODEC_ZSTD};
+    for(auto& format: binary_formats) {
+        for(codec_t codec: codecs) {
+            for(bool shuffle: {false, true}) {
+                CodecSettings settings;
+                settings.codec = codec;
+                settings.shuffle = shuffle;
+                std::string spec = format_codec_spec(settings);
+                if(!parse_codec_spec(spec, settings)) {
+                    continue;
+                }
+                std::string name = format.name + "_" + boost::to_upper_copy(boost::replace_all_copy(spec, ":", "_"));
+                formats.push_back({name, format.make, true, true, settings});
+            }
+        }
+    }
+    return formats;
+}
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double wall_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/// Size of a file, or of the files in a directory, 0 if it does not exist
+static uint64_t output_size(const std::string& path)
+{
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0) {
+        return 0;
+    }
+    if(!S_ISDIR(info.st_mode)) {
+        return info.st_size;
+    }
+    uint64_t size = 0;
+    DIR* dir = opendir(path.c_str());
+    if(dir) {
+        struct dirent* entry;
+        while((entry = readdir(dir)) != NULL) {
+            if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+                size += output_size(path + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    return size;
+}
+
+/// Delete a file, or a directory with the files in it
+static void remove_output(const std::string& path)
+{
+    DIR* dir = opendir(path.c_str());
+    if(dir) {
+        struct dirent* entry;
+        while((entry = readdir(dir)) != NULL) {
+            if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+                unlink((path + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+        rmdir(path.c_str());
+    } else {
+        unlink(path.c_str());
+    }
+}
+
+static bool parse_list(const char* text, std::vector<int>& list)
+{
+    std::vector<std::string> items;
+    boost::split(items, text, boost::is_any_of(","));
+    list.clear();
+    try {
+        for(auto& item: items) {
+            list.push_back(boost::lexical_cast<int>(item));
+        }
+    } catch(boost::bad_lexical_cast const& e) {
+        return false;
+    }
+    return !list.empty();
+}
+
+static bool fill_frame_pool(int channels, const std::array<int, 4>& ch_config)
+{
+    std::atomic<bool> abort(false);
+    SynthSource source(0.7, 100.0, ch_config, RegionOfInterest(), WaitStrategy(), abort);
+    std::map<std::string, std::string> options;
+    options["channels"] = boost::lexical_cast<std::string>(channels);
+    if(!source.configure(options)) {
+        return false;
+    }
+    for(auto& frame: frame_pool) {
+        frame.timestamps = FrameTimestamps();
+        if(!source.capture(frame)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool run_case(const BenchFormat& format, int level, int threads, const std::array<int, 4>& ch_config,
+                     const OutputSettings& output_settings, uint64_t num_frames, const std::string& directory,
+                     int argc, char** argv, BenchResult& result)
+{
+    std::unique_ptr<DataStream> stream(format.make());
+    stream->set_compression_threads(threads);
+    stream->set_output(output_settings);
+    if(format.codec.codec != CODEC_NONE) {
+        CodecSettings codec = format.codec;
+        codec.level = level;
+        stream->set_codec(codec);
+        level = -1;
+    }
+    // MULTIFILE writes into a directory of this name, the others into a file
+    std::string name = directory + "/bench_" + format.name;
+    std::string extension = stream->get_file_extension();
+    remove_output(name + extension);
+    remove_output(name);
+    stream->init(name, name, RegionOfInterest(), level, false, format.binary_output, 100.0, ch_config, argc, argv);
+    // compressed TEXT is .csv.gz, known after init()
+    extension = stream->get_file_extension();
+    double wall_start = wall_seconds();
+    double cpu_start = cpu_seconds();
+    bool ok = stream->write_header();
+    result.supported = true;
+    uint64_t i;
+    for(i=0; ok && i<num_frames; i++) {
+        Frame& frame = frame_pool[i % FRAME_POOL_SIZE];
+        frame.timestamps.written = RunClock::now();
+        try {
+            ok = stream->write(frame);
+        } catch(DataStream::not_suppported_write& e) {
+            std::cerr << format.name << ": " << e.what() << ", skipped" << std::endl;
+            result.supported = false;
+            break;
+        }
+    }
+    ok = stream->finalize() && ok;
+    result.seconds = wall_seconds() - wall_start;
+    result.cpu_seconds = cpu_seconds() - cpu_start;
+    result.frames = i;
+    stream.reset();
+    // the last blocks are only written by finalize(), count what is on the disk
+    result.bytes = output_size(name + extension) + output_size(name);
+    remove_output(name + extension);
+    remove_output(name);
+    return ok;
+}
+
+static void print_help(const char* name)
+{
+    std::cout << "Usage: " << name << " [OPTIONS]\n"
+              << "Write synthetic frames with every output format and measure the throughput.\n\n"
+              << " -d DIR           Directory for the output files, removed after every case (default .)\n"
+              << " -n LIST          Numbers of frames per case, comma separated (default 1000,10000)\n"
+              << " -c LIST          Numbers of channels, comma separated (default 1,2,3,4)\n"
+              << " -l LIST          Compression levels for TEXT_GZ and BIN_<codec>, comma separated (default 1,...,9)\n"
+              << " -j LIST          Compression threads for TEXT_GZ, comma separated (default 1)\n"
+              << " -I SPEC          How TEXT, BIN and YAML files are written, as get_data -I (default stdio)\n"
+              << " -f LIST          Formats, comma separated, of MULTIFILE, MULTIFILE_BIN, TEXT, TEXT_GZ,\n"
+              << "                  BIN, BIN_MMAP, YAML"
+#ifdef ROOT_FOUND
+              << ", ROOT"
+#endif
+              << ",\n                  BIN_ZLIB"
+#ifdef HAVE_LZ4
+              << ", BIN_LZ4"
+#endif
+#ifdef HAVE_ZSTD
+              << ", BIN_ZSTD"
+#endif
+              << ", the same with _SHUFFLE and for YAML (default all)\n"
+              << " -h               Show this help\n\n"
+              << "Prints one tab separated line per case: format, compression level (-1 = none),\n"
+              << "compression threads, channels, frames, seconds, frames/s, MB/s, CPU us per frame, bytes per frame\n"
+              << "and the compression ratio, the size of the time axis and channel values as floats per output size.\n"
+              << "Cases a format does not support are skipped with a note on stderr." << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string directory = ".";
+    std::vector<int> frame_counts = {1000, 10000};
+    std::vector<int> channel_counts = {1, 2, 3, 4};
+    std::vector<int> levels = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    std::vector<int> thread_counts = {1};
+    std::vector<std::string> selected;
+    OutputSettings output_settings;
+    int optchar;
+    while((optchar = getopt(argc, argv, "d:n:c:l:j:I:f:h")) != -1) {
+        if(optchar == 'd') {
+            directory = optarg;
+        } else if(optchar == 'n') {
+            if(!parse_list(optarg, frame_counts)) {
+                std::cerr << argv[0] << ": Cannot parse frame counts '" << optarg << "'" << std::endl;
+                return 1;
+            }
+        } else if(optchar == 'c') {
+            if(!parse_list(optarg, channel_counts)) {
+                std::cerr << argv[0] << ": Cannot parse channel counts '" << optarg << "'" << std::endl;
+                return 1;
+            }
+            for(int channels: channel_counts) {
+                if(channels < 1 || channels > 4) {
+                    std::cerr << argv[0] << ": Channel counts must be 1 to 4" << std::endl;
+                    return 1;
+                }
+            }
+        } else if(optchar == 'l') {
+            if(!parse_list(optarg, levels)) {
+                std::cerr << argv[0] << ": Cannot parse compression levels '" << optarg << "'" << std::endl;
+                return 1;
+            }
+        } else if(optchar == 'j') {
+            if(!parse_list(optarg, thread_counts)) {
+                std::cerr << argv[0] << ": Cannot parse thread counts '" << optarg << "'" << std::endl;
+                return 1;
+            }
+        } else if(optchar == 'I') {
+            if(!parse_output_spec(optarg, output_settings)) {
+                std::cerr << argv[0] << ": Cannot parse output setting '" << optarg << "'" << std::endl;
+                return 1;
+            }
+        } else if(optchar == 'f') {
+            boost::split(selected, optarg, boost::is_any_of(","));
+        } else {
+            print_help(argv[0]);
+            return optchar == 'h'? 0 : 1;
+        }
+    }
+
+    std::vector<BenchFormat> formats;
+    for(auto& format: bench_formats()) {
+        if(selected.empty() || std::find(selected.begin(), selected.end(), format.name) != selected.end()) {
+            formats.push_back(format);
+        }
+    }
+    if(formats.empty()) {
+        std::cerr << argv[0] << ": No known format selected" << std::endl;
+        return 1;
+    }
+
+    RunClock::init();
+    printf("format\tlevel\tthreads\tchannels\tframes\tseconds\tframes_per_s\tmb_per_s\tcpu_us_per_frame\tbytes_per_frame\tratio\n");
+    bool all_ok = true;
+    for(int channels: channel_counts) {
+        std::array<int, 4> ch_config = {{-1, -1, -1, -1}};
+        for(int i=0; i<channels; i++) {
+            ch_config[i] = i;
+        }
+        if(!fill_frame_pool(channels, ch_config)) {
+            std::cerr << argv[0] << ": Cannot generate frames" << std::endl;
+            return 1;
+        }
+        for(auto& format: formats) {
+            // (level, threads) of every case, compressed formats run all levels. Only TEXT_GZ
+            // compresses in threads, the codecs compress on the writing thread
+            std::vector<std::pair<int, int> > settings;
+            for(int level: format.compressed? levels : std::vector<int>(1, -1)) {
+                bool threaded = format.compressed && format.codec.codec == CODEC_NONE;
+                for(int threads: threaded? thread_counts : std::vector<int>(1, 1)) {
+                    settings.push_back(std::make_pair(level, threads));
+                }
+            }
+            for(auto& setting: settings) {
+                for(int num_frames: frame_counts) {
+                    int level = setting.first;
+                    int threads = setting.second;
+                    std::cerr << format.name << " level " << level << ", " << threads << " thread(s), "
+                              << channels << " channel(s), " << num_frames << " frames" << std::endl;
+                    BenchResult result;
+                    if(!run_case(format, level, threads, ch_config, output_settings, num_frames, directory,
+                                 argc, argv, result)) {
+                        std::cerr << format.name << ": writing failed" << std::endl;
+                        all_ok = false;
+                        continue;
+                    }
+                    if(!result.supported) {
+                        continue;
+                    }
+                    // what a frame is worth as floats, time axis plus channels
+                    double raw_bytes = static_cast<double>(result.frames) * (channels + 1) * FRAME_MAX_SAMPLES * sizeof(float);
+                    printf("%s\t%i\t%i\t%i\t%lu\t%.6f\t%.1f\t%.3f\t%.3f\t%.1f\t%.3f\n",
+                           format.name.c_str(), level, threads, channels, result.frames, result.seconds,
+                           result.frames / result.seconds, result.bytes / result.seconds / 1e6,
+                           result.cpu_seconds / result.frames * 1e6,
+                           static_cast<double>(result.bytes) / result.frames, raw_bytes / result.bytes);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    return all_ok? 0 : 1;
+}
@@ -21,48 +21,114 @@
 #ifndef _BINARY_H_
 #define _BINARY_H_
 
+#include "chunkfile.h"
 #include "datastream.h"
+#include "drscalibration.h"
+#include <algorithm>
+#include <iostream>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
 #include <sstream>
+#include <vector>
 
 using namespace std;
 
-#define DAT_COMPRESSED 1
+#define DAT_COMPRESSED 1  // frame data and summary are compressed, in codec blocks (version 1, see codec.h) or chunks
 #define DAT_FREE_TRIGGER 2
+#define DAT_SUMMARY 4  // "#SUM\n" and key=value lines follow the last frame
+#define DAT_RAW 8      // calibration follows the user header, frames are uint16 trigger cell and raw ADC values
+#define DAT_CELL_TIME 16  // cell widths follow the user header, frames are uint16 trigger cell and data
+#define DAT_TIMESTAMPS 32  // every frame starts with int64 ns armed, triggered, transferred and written
 
+/*
+ * Version 1: the frames follow the calibration back to back, num_frames is
+ * only written when the file is finalized.
+ * Version 2: the frames and the summary are in chunks with checksums and an
+ * index at the end, see chunkfile.h. The chunks count the frames, a file cut
+ * off by a crash can be read up to its last complete chunk.
+ */
 struct dat_header {
     /*20 byte -> 0x14*/
     char magic[5];
     uint8_t version;
     uint16_t frames_per_sample;
-    uint32_t num_frames;
+    uint32_t num_frames;  // up to 2^32-1 in version 2, the index has all
     uint8_t flags;
     char reserved1[3];
     uint16_t data_offset;
-    char reserved2[2];
+    uint16_t roi_start;  // readout position of the first sample, 0 in older files
+
 };
 static_assert(sizeof(dat_header) == 20, "dat_header struct has unexpected size on this platform!");
 
 class BinaryStream : public DataStream {
 protected:
     FILE* file;
-    unsigned int frame_counter;
+    /// the file after the header
+    OutputFile data_file;
+    /// frame data and summary in chunks, compressed with the codec
+    ChunkWriter output;
+    CodecSettings codec;
+    uint64_t frame_counter;
+    uint8_t version;
     dat_header header;
+    bool raw;
+    bool cell_time;
+    DRSCalibration calibration;
+    /// board channel of each recorded column
+    std::vector<int> raw_channels;
 
     virtual bool init_stream() {
         file = fopen64(filename.c_str(), "wb");
         return true;
     }
 
+    void write_timestamps(const FrameTimestamps& timestamps) {
+        int64_t frame_timestamps[4] = {timestamps.armed, timestamps.triggered,
+                                       timestamps.transferred, timestamps.written};
+        output.write(frame_timestamps, sizeof(frame_timestamps), 1);
+    }
+
 public:
-    BinaryStream() : frame_counter(0), header() {
+    BinaryStream() : frame_counter(0), version(2), header(), raw(false), cell_time(false) {
     }
     virtual ~BinaryStream() {
+        data_file.close();
         if(file) fclose(file);
     }
-    virtual bool write_header() {
+    virtual bool set_calibration(const DRSCalibration& p_calibration) {
+        calibration = p_calibration;
+        raw = true;
+        return true;
+    }
+    virtual bool set_cell_widths(const float* dt) {
+        memcpy(calibration.dt, dt, sizeof(calibration.dt));
+        cell_time = true;
+        return true;
+    }
+    virtual bool set_codec(const CodecSettings& p_codec) {
+        codec = p_codec;
+        return true;
+    }
+    virtual bool set_output(const OutputSettings& settings) {
+        output_settings = settings;
+        return true;
+    }
+    virtual bool set_compression_level(int level) {
+        if(codec.codec == CODEC_NONE) return false;
+        codec.level = level;
+        output.set_level(level);
+        return true;
+    }
+    virtual void set_metrics(LaneMetrics* p_metrics) {
+        DataStream::set_metrics(p_metrics);
+        output.set_metrics(p_metrics);
+    }
+
+protected:
+    /// Header, user header and calibration through file, the frames follow
+    bool write_file_header() {
 	memset(&header, 0, sizeof(header));
 	header.magic[0] = '#';
 	header.magic[1] = 'D';
@@ -70,11 +136,36 @@ public:
 	header.magic[3] = 'A';
 	header.magic[4] = '\n';
 	header.frames_per_sample = frames_per_sample;
+	header.roi_start = roi_start;
 	header.num_frames = 0;
-	header.version = 1;
-	header.flags = 0;
+	header.version = version;
+	header.flags = DAT_TIMESTAMPS;
 	if(free_trigger)
             header.flags |= DAT_FREE_TRIGGER;
+        if(raw) {
+            header.flags |= DAT_RAW;
+            raw_channels.clear();
+            for(size_t i=0; i<ch_config.size() && ch_config[i] != -1; i++) {
+                raw_channels.push_back(ch_config[i]);
+            }
+            DRSCalibration recorded(calibration);
+            recorded.channels.clear();
+            for(int ch: raw_channels) {
+                if(!calibration.channel(ch)) {
+                    std::cerr << "No calibration for channel " << ch+1 << std::endl;
+                    return false;
+                }
+                recorded.channels.push_back(*calibration.channel(ch));
+            }
+            calibration = recorded;
+        } else if(cell_time) {
+            header.flags |= DAT_CELL_TIME;
+            calibration.channels.clear();
+        }
+        if(codec.codec != CODEC_NONE) {
+            header.flags |= DAT_COMPRESSED;
+            user_header["codec"] = format_codec_spec(codec);
+        }
         string user_header_string = "";
 	for(map<string, string>::iterator it = user_header.begin();
 	    it != user_header.end(); it++) {
@@ -86,27 +177,67 @@ public:
 	header.data_offset = user_header_string.length();
 	fwrite(&header, sizeof(header), 1, file);
 	fwrite(user_header_string.c_str(), user_header_string.length(), 1, file);
-	fflush(file);
-	return true;
+        if((raw || cell_time) && !calibration.write(file)) {
+            return false;
+        }
+        return true;
     }
 
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data) {
-        if(frame_counter == 4294967295UL)
+public:
+    virtual bool write_header() {
+        if(!write_file_header()) {
             return false;
+        }
+        if(!data_file.open(file, filename, output_settings)) {
+            return false;
+        }
+        // raw ADC values are 2 byte, shuffled as such
+        output.open(&data_file, codec, raw? sizeof(uint16_t) : sizeof(float));
+	return data_file.flush();
+    }
+
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) {
         frame_counter++;
-        fwrite(time, sizeof(float), frames_per_sample, file);
-        fwrite(data, sizeof(float), frames_per_sample, file);
-	fflush(file);
-        return true;
+        write_timestamps(timestamps);
+        output.write(time, sizeof(float), frames_per_sample);
+        output.write(data, sizeof(float), frames_per_sample);
+        return output.end_frame(timestamps.triggered);
     }
 
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data)
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data)
     {
         throw not_suppported_write("Binary format with multi channel recording.");
     }
 
+    virtual bool write(const Frame& frame) {
+        if(!raw && (!cell_time || ch_config[1] != -1)) {
+            return DataStream::write(frame);
+        }
+        frame_counter++;
+        write_timestamps(frame.timestamps);
+        uint16_t trigger_cell = frame.trigger_cell;
+        output.write(&trigger_cell, sizeof(trigger_cell), 1);
+        if(raw) {
+            for(size_t col=0; col<raw_channels.size(); col++) {
+                output.write(frame.raw[raw_channels[col]], sizeof(uint16_t), frames_per_sample);
+            }
+        } else {
+            output.write(frame.data[ch_config[0]], sizeof(float), frames_per_sample);
+        }
+        return output.end_frame(frame.timestamps.triggered);
+    }
+
     virtual bool finalize() {
-        header.num_frames = frame_counter;
+        if(!summary.empty()) {
+            if(!output.write_summary("#SUM\n" + format_summary("", "="))) {
+                return false;
+            }
+            header.flags |= DAT_SUMMARY;
+        }
+        if(!output.finish() || !data_file.close()) {
+            return false;
+        }
+        header.num_frames = std::min<uint64_t>(frame_counter, UINT32_MAX);
 	rewind(file);
 	fwrite(&header, sizeof(header), 1, file);
 	fflush(file);
@@ -116,6 +247,9 @@ public:
     virtual std::string get_file_extension() const {
         return std::string(".cdt");
     }
+    virtual uint64_t bytes_written() const {
+        return output.bytes_written();
+    }
 };
 
 #endif
@@ -0,0 +1,255 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "cellcalibration.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CALIBRATION_X86 1
+#endif
+
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+
+bool parse_calibration_kernel(const std::string& name, calibration_kernel_t& kernel)
+{
+    if(name == "auto") kernel = CK_AUTO;
+    else if(name == "scalar") kernel = CK_SCALAR;
+    else if(name == "sse") kernel = CK_SSE;
+    else if(name == "avx2") kernel = CK_AVX2;
+    else return false;
+    return true;
+}
+
+std::string calibration_kernel_name(calibration_kernel_t kernel)
+{
+    switch(kernel) {
+        case CK_AUTO: return "auto";
+        case CK_SCALAR: return "scalar";
+        case CK_SSE: return "sse";
+        case CK_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+static bool kernel_supported(calibration_kernel_t kernel)
+{
+#ifdef CALIBRATION_X86
+    if(kernel == CK_AVX2) return __builtin_cpu_supports("avx2");
+    if(kernel == CK_SSE) return __builtin_cpu_supports("sse2");
+#endif
+    return kernel == CK_SCALAR;
+}
+
+/*
+ * The kernels, n cells from the first readout position of the ROI on. offset
+ * and gain point to its cell in the doubled tables, offset2 to its readout
+ * position, so none of the tables is aligned.
+ * Same operations as DRSCalibration::calibrate_voltage(), also for the tails.
+ */
+
+static void calibrate_scalar(const float* offset, const float* gain, const float* offset2,
+                             const uint16_t* raw, float* data, int n, float range_mv)
+{
+    for(int j=0; j<n; j++) {
+        float value = static_cast<float>(raw[j]) - offset[j];
+        value = value / gain[j];
+        value -= offset2[j];
+        data[j] = value / 65536.0f * 1000.0f + range_mv;
+    }
+}
+
+#ifdef CALIBRATION_X86
+__attribute__((target("sse2")))
+static void calibrate_sse(const float* offset, const float* gain, const float* offset2,
+                          const uint16_t* raw, float* data, int n, float range_mv)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(65536.0f);
+    const __m128 mv = _mm_set1_ps(1000.0f);
+    const __m128 range = _mm_set1_ps(range_mv);
+    int j = 0;
+    for(; j+4<=n; j+=4) {
+        __m128i counts = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(raw + j)), zero);
+        __m128 value = _mm_sub_ps(_mm_cvtepi32_ps(counts), _mm_loadu_ps(offset + j));
+        value = _mm_div_ps(value, _mm_loadu_ps(gain + j));
+        value = _mm_sub_ps(value, _mm_loadu_ps(offset2 + j));
+        value = _mm_add_ps(_mm_mul_ps(_mm_div_ps(value, scale), mv), range);
+        _mm_storeu_ps(data + j, value);
+    }
+    calibrate_scalar(offset + j, gain + j, offset2 + j, raw + j, data + j, n - j, range_mv);
+}
+
+// no "fma": a fused multiply-add would round differently than the scalar code
+__attribute__((target("avx2")))
+static void calibrate_avx2(const float* offset, const float* gain, const float* offset2,
+                           const uint16_t* raw, float* data, int n, float range_mv)
+{
+    const __m256 scale = _mm256_set1_ps(65536.0f);
+    const __m256 mv = _mm256_set1_ps(1000.0f);
+    const __m256 range = _mm256_set1_ps(range_mv);
+    int j = 0;
+    for(; j+8<=n; j+=8) {
+        __m256i counts = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(raw + j)));
+        __m256 value = _mm256_sub_ps(_mm256_cvtepi32_ps(counts), _mm256_loadu_ps(offset + j));
+        value = _mm256_div_ps(value, _mm256_loadu_ps(gain + j));
+        value = _mm256_sub_ps(value, _mm256_loadu_ps(offset2 + j));
+        value = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(value, scale), mv), range);
+        _mm256_storeu_ps(data + j, value);
+    }
+    calibrate_scalar(offset + j, gain + j, offset2 + j, raw + j, data + j, n - j, range_mv);
+}
+#endif
+
+CellCalibration::CellCalibration(const DRSCalibration& calibration, const std::array<int, 4>& ch_config,
+                                 const RegionOfInterest& roi, calibration_kernel_t kernel, bool verify)
+: m_kernel(kernel), m_verify(verify), m_valid(true), m_range_mv(calibration.range * 1000.0f), m_roi(roi),
+m_num_columns(0), m_tables(0), m_time_axes(0),
+m_metrics(NULL), m_frames(0), m_busy_ns(0), m_frames_differing(0), m_max_data_difference(0.0), m_max_time_difference(0.0)
+{
+    if(m_kernel == CK_AUTO) {
+        m_kernel = kernel_supported(CK_AVX2)? CK_AVX2 : (kernel_supported(CK_SSE)? CK_SSE : CK_SCALAR);
+    } else if(!kernel_supported(m_kernel)) {
+        std::cerr << "This CPU does not support the " << calibration_kernel_name(m_kernel)
+                  << " calibration kernel, using the scalar one" << std::endl;
+        m_kernel = CK_SCALAR;
+    }
+
+    for(size_t i=0; i<ch_config.size() && ch_config[i] != -1; i++) {
+        m_columns[m_num_columns++] = ch_config[i];
+    }
+
+    size_t column_floats = 5*DRS_NUM_CELLS;
+    size_t num_floats = DRS_NUM_CELLS*DRS_NUM_CELLS + m_num_columns*column_floats;
+    void* mem = 0;
+    if(posix_memalign(&mem, CACHE_LINE_SIZE, num_floats*sizeof(float)) != 0) {
+        throw std::bad_alloc();
+    }
+    m_tables = static_cast<float*>(mem);
+
+    m_time_axes = m_tables;
+    for(int tc=0; tc<DRS_NUM_CELLS; tc++) {
+        calibration.calibrate_time(tc, m_time_axes + tc*DRS_NUM_CELLS, DRS_NUM_CELLS);
+    }
+
+    for(int col=0; col<m_num_columns; col++) {
+        m_offset[col] = m_tables + DRS_NUM_CELLS*DRS_NUM_CELLS + col*column_floats;
+        m_gain[col] = m_offset[col] + 2*DRS_NUM_CELLS;
+        m_offset2[col] = m_gain[col] + 2*DRS_NUM_CELLS;
+        const DRSChannelCalibration* channel = calibration.channel(m_columns[col]);
+        if(!channel) {
+            std::cerr << "No calibration for channel " << m_columns[col]+1 << std::endl;
+            m_valid = false;
+            continue;
+        }
+        for(int cell=0; cell<DRS_NUM_CELLS; cell++) {
+            m_offset[col][cell] = m_offset[col][cell+DRS_NUM_CELLS] = channel->offset[cell];
+            m_gain[col][cell] = m_gain[col][cell+DRS_NUM_CELLS] = channel->gain[cell];
+            m_offset2[col][cell] = channel->offset2[cell];
+        }
+    }
+}
+
+CellCalibration::~CellCalibration()
+{
+    free(m_tables);
+}
+
+void CellCalibration::calibrate(int column, int trigger_cell, const uint16_t* raw, float* data) const
+{
+    // trigger_cell + m_roi.start < 2048, still within the doubled tables
+    const float* offset = m_offset[column] + trigger_cell + m_roi.start;
+    const float* gain = m_gain[column] + trigger_cell + m_roi.start;
+    const float* offset2 = m_offset2[column] + m_roi.start;
+    switch(m_kernel) {
+#ifdef CALIBRATION_X86
+        case CK_AVX2:
+            calibrate_avx2(offset, gain, offset2, raw, data, m_roi.length, m_range_mv);
+            break;
+        case CK_SSE:
+            calibrate_sse(offset, gain, offset2, raw, data, m_roi.length, m_range_mv);
+            break;
+#endif
+        default:
+            calibrate_scalar(offset, gain, offset2, raw, data, m_roi.length, m_range_mv);
+    }
+}
+
+void CellCalibration::apply(Frame& frame)
+{
+    TraceSpan span("calibrate");
+    auto start = steady_clock::now();
+    int trigger_cell = frame.trigger_cell % DRS_NUM_CELLS;
+    const float* time = m_time_axes + trigger_cell*DRS_NUM_CELLS + m_roi.start;
+    if(!m_verify) {
+        memcpy(frame.time, time, m_roi.length*sizeof(float));
+        for(int col=0; col<m_num_columns; col++) {
+            calibrate(col, trigger_cell, frame.raw[m_columns[col]], frame.data[m_columns[col]]);
+        }
+    } else {
+        bool differs = memcmp(frame.time, time, m_roi.length*sizeof(float)) != 0;
+        for(int j=0; j<m_roi.length; j++) {
+            m_max_time_difference = std::max(m_max_time_difference, fabsf(frame.time[j] - time[j]));
+        }
+        alignas(CACHE_LINE_SIZE) float data[DRS_NUM_CELLS];
+        for(int col=0; col<m_num_columns; col++) {
+            const float* reference = frame.data[m_columns[col]];
+            calibrate(col, trigger_cell, frame.raw[m_columns[col]], data);
+            differs |= memcmp(reference, data, m_roi.length*sizeof(float)) != 0;
+            for(int j=0; j<m_roi.length; j++) {
+                m_max_data_difference = std::max(m_max_data_difference, fabsf(reference[j] - data[j]));
+            }
+        }
+        if(differs) {
+            m_frames_differing++;
+        }
+    }
+    m_frames++;
+    auto end = steady_clock::now();
+    m_busy_ns += duration_cast<std::chrono::nanoseconds>(end - start).count();
+    if(m_metrics) {
+        m_metrics->record(MS_CALIBRATE, end - start);
+    }
+}
+
+void print_calibration_stats(const CellCalibration& calibration)
+{
+    std::cout << "  calibration (" << calibration_kernel_name(calibration.kernel()) << "): "
+              << calibration.frames() << " frames, "
+              << (calibration.frames()? calibration.busy().count() / 1000.0 / calibration.frames() : 0.0)
+              << " us/frame" << std::endl;
+    if(calibration.verify()) {
+        std::cout << "  verified against GetWave()/GetTime(): " << calibration.frames_differing()
+                  << " of " << calibration.frames() << " frames differ, max. difference "
+                  << calibration.max_data_difference() << " mV, "
+                  << calibration.max_time_difference() << " ns" << std::endl;
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef CELLCALIBRATION_H
+#define CELLCALIBRATION_H
+
+#include "drscalibration.h"
+#include "frame.h"
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+class LaneMetrics;
+
+/**
+ * Implementation of the calibration loop, CK_AUTO picks the fastest one the CPU supports
+ */
+enum calibration_kernel_t {
+    CK_AUTO,
+    CK_SCALAR,
+    CK_SSE,
+    CK_AVX2
+};
+
+bool parse_calibration_kernel(const std::string& name, calibration_kernel_t& kernel);
+std::string calibration_kernel_name(calibration_kernel_t kernel);
+
+/**
+ * In-process replacement for GetWave() and GetTime(): turns Frame::raw of
+ * all recorded channels into Frame::time and Frame::data.
+ *
+ * The tables of DRSCalibration are converted once into cache line aligned
+ * float arrays, offset and gain stored twice in a row so the cells
+ * tc..tc+1023 of any trigger cell are contiguous and can be processed with
+ * SSE or AVX2 without wrap around. All time axes are precomputed. Every
+ * kernel computes with the same single precision operations in the same
+ * order as DRSCalibration::calibrate_voltage(), so they agree bit by bit.
+ *
+ * Only the region of interest is calibrated.
+ *
+ * With verify set, frames are expected to carry GetWave() and GetTime()
+ * results as well, which are compared with the own calibration instead of
+ * being replaced.
+ *
+ * One instance per board, not thread safe.
+ */
+class CellCalibration {
+public:
+    CellCalibration(const DRSCalibration& calibration, const std::array<int, 4>& ch_config,
+                    const RegionOfInterest& roi, calibration_kernel_t kernel, bool verify);
+    ~CellCalibration();
+
+    /// False if a recorded channel has no calibration tables
+    bool valid() const { return m_valid; }
+    calibration_kernel_t kernel() const { return m_kernel; }
+    bool verify() const { return m_verify; }
+
+    void apply(Frame& frame);
+    /// Record the duration of apply() into metrics
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+
+    uint64_t frames() const { return m_frames; }
+    std::chrono::nanoseconds busy() const { return std::chrono::nanoseconds(m_busy_ns); }
+    uint64_t frames_differing() const { return m_frames_differing; }
+    /// Largest difference to GetWave() in mV and to GetTime() in ns
+    float max_data_difference() const { return m_max_data_difference; }
+    float max_time_difference() const { return m_max_time_difference; }
+
+private:
+    CellCalibration(const CellCalibration&);
+    CellCalibration& operator=(const CellCalibration&);
+
+    void calibrate(int column, int trigger_cell, const uint16_t* raw, float* data) const;
+
+    calibration_kernel_t m_kernel;
+    bool m_verify;
+    bool m_valid;
+    float m_range_mv;
+    RegionOfInterest m_roi;
+    /// Frame::raw/data index of each calibrated column
+    std::array<int, 4> m_columns;
+    int m_num_columns;
+    /// one block: time axes, then per column offset[2*1024], gain[2*1024], offset2[1024]
+    float* m_tables;
+    float* m_time_axes;
+    std::array<float*, 4> m_offset;
+    std::array<float*, 4> m_gain;
+    std::array<float*, 4> m_offset2;
+
+    LaneMetrics* m_metrics;
+    uint64_t m_frames;
+    int64_t m_busy_ns;
+    uint64_t m_frames_differing;
+    float m_max_data_difference;
+    float m_max_time_difference;
+};
+
+void print_calibration_stats(const CellCalibration& calibration);
+
+#endif // CELLCALIBRATION_H
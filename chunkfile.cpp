@@ -0,0 +1,344 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "chunkfile.h"
+#include "metrics.h"
+#include "outputfile.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+/// Raw frame data per chunk, like the codec blocks
+#define CDT_CHUNK_SIZE (256*1024)
+/// A chunk is written after this time even if it is not full, for slow trigger rates
+#define CDT_CHUNK_MAX_AGE std::chrono::seconds(1)
+
+/// Reflected Castagnoli polynomial
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+static std::array<uint32_t, 256> make_crc32c_table()
+{
+    std::array<uint32_t, 256> table;
+    for(uint32_t i=0; i<256; i++) {
+        uint32_t crc = i;
+        for(int k=0; k<8; k++) {
+            crc = (crc >> 1) ^ ((crc & 1)? CRC32C_POLYNOMIAL : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const unsigned char* data, size_t length)
+{
+    static const std::array<uint32_t, 256> table = make_crc32c_table();
+    crc = ~crc;
+    for(size_t i=0; i<length; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t length)
+{
+    uint64_t crc64 = ~crc;
+    size_t i = 0;
+    for(; i+8<=length; i+=8) {
+        uint64_t value;
+        memcpy(&value, data + i, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    uint32_t crc32 = crc64;
+    for(; i<length; i++) {
+        crc32 = _mm_crc32_u8(crc32, data[i]);
+    }
+    return ~crc32;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+#ifdef CRC32C_X86
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if(hardware) {
+        return crc32c_sse42(crc, bytes, length);
+    }
+#endif
+    return crc32c_scalar(crc, bytes, length);
+}
+
+ChunkWriter::ChunkWriter()
+: m_output(NULL), m_metrics(NULL), m_frames(0), m_chunk_frames(0), m_first_time(0), m_last_time(0),
+m_bytes_written(0)
+{
+}
+
+void ChunkWriter::open(OutputFile* output, const CodecSettings& settings, int element_size)
+{
+    m_output = output;
+    m_compressor.set_settings(settings, element_size);
+    m_bytes_written = output->offset();
+    m_chunk.reserve(2*CDT_CHUNK_SIZE);
+}
+
+bool ChunkWriter::write(const void* data, size_t size, size_t count)
+{
+    const char* in = static_cast<const char*>(data);
+    m_chunk.insert(m_chunk.end(), in, in + size*count);
+    return true;
+}
+
+bool ChunkWriter::end_frame(int64_t record_time)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(m_chunk_frames == 0) {
+        m_first_time = record_time;
+        m_chunk_start = now;
+    }
+    m_last_time = record_time;
+    m_chunk_frames++;
+    m_frames++;
+    if(m_chunk.size() >= CDT_CHUNK_SIZE || now - m_chunk_start >= CDT_CHUNK_MAX_AGE) {
+        return write_chunk(CDT_CHUNK_FRAMES);
+    }
+    return true;
+}
+
+bool ChunkWriter::write_summary(const std::string& summary)
+{
+    if(m_chunk_frames > 0 && !write_chunk(CDT_CHUNK_FRAMES)) {
+        return false;
+    }
+    m_chunk.assign(summary.begin(), summary.end());
+    return write_chunk(CDT_CHUNK_SUMMARY);
+}
+
+bool ChunkWriter::finish()
+{
+    if(m_chunk_frames > 0 && !write_chunk(CDT_CHUNK_FRAMES)) {
+        return false;
+    }
+    cdt_footer footer;
+    memcpy(footer.magic, "IDX\n", 4);
+    footer.crc = 0;
+    footer.chunks = m_index.size();
+    footer.frames = m_frames;
+    footer.index_offset = m_output->offset();
+    size_t index_size = m_index.size()*sizeof(cdt_index_entry);
+    footer.crc = crc32c(crc32c(0, m_index.data(), index_size), &footer, sizeof(footer));
+    if(!m_output->write(m_index.data(), index_size) || !m_output->write(&footer, sizeof(footer))) {
+        return false;
+    }
+    m_bytes_written += index_size + sizeof(footer);
+    return true;
+}
+
+bool ChunkWriter::write_chunk(uint8_t type)
+{
+    TraceSpan span("write_chunk");
+    auto start = std::chrono::steady_clock::now();
+    cdt_chunk_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CHK\n", 4);
+    header.type = type;
+    header.raw_size = m_chunk.size();
+    if(type == CDT_CHUNK_FRAMES) {
+        header.frames = m_chunk_frames;
+        header.first_time = m_first_time;
+        header.last_time = m_last_time;
+    }
+    header.first_frame = m_frames - header.frames;
+    size_t stored_size;
+    const char* stored = m_compressor.compress(m_chunk.data(), m_chunk.size(), stored_size, header.codec, header.shuffle);
+    header.stored_size = stored_size;
+    header.crc = crc32c(crc32c(0, &header, sizeof(header)), stored, stored_size);
+    if(m_metrics) {
+        m_metrics->record(MS_COMPRESS, std::chrono::steady_clock::now() - start);
+    }
+    if(type == CDT_CHUNK_FRAMES) {
+        cdt_index_entry entry = {m_output->offset(), header.first_frame, header.first_time};
+        m_index.push_back(entry);
+    }
+    bool written = m_output->write(&header, sizeof(header)) && m_output->write(stored, stored_size);
+    // stored may be the chunk itself
+    m_chunk.clear();
+    m_chunk_frames = 0;
+    if(!written) {
+        return false;
+    }
+    m_bytes_written += sizeof(header) + stored_size;
+    // complete chunks reach the file, whatever happens to the process later
+    return m_output->flush();
+}
+
+ChunkReader::ChunkReader()
+: m_file(0), m_frames(0), m_recovered(false), m_next_chunk(0), m_position(0)
+{
+}
+
+bool ChunkReader::open(FILE* file, int64_t data_start)
+{
+    m_file = file;
+    m_recovered = !read_index(data_start);
+    if(m_recovered && !scan(data_start)) {
+        return false;
+    }
+    m_next_chunk = 0;
+    m_data.clear();
+    m_position = 0;
+    return true;
+}
+
+bool ChunkReader::read_index(int64_t data_start)
+{
+    cdt_footer footer;
+    if(fseeko64(m_file, 0, SEEK_END) != 0) {
+        return false;
+    }
+    int64_t size = ftello64(m_file);
+    if(size < data_start + static_cast<int64_t>(sizeof(footer))
+       || fseeko64(m_file, size - sizeof(footer), SEEK_SET) != 0
+       || fread(&footer, sizeof(footer), 1, m_file) != 1
+       || memcmp(footer.magic, "IDX\n", 4) != 0
+       || footer.chunks > static_cast<uint64_t>(size)/sizeof(cdt_index_entry)
+       || footer.index_offset < static_cast<uint64_t>(data_start)
+       || footer.index_offset + footer.chunks*sizeof(cdt_index_entry) + sizeof(footer) != static_cast<uint64_t>(size)) {
+        return false;
+    }
+    m_index.resize(footer.chunks);
+    if(fseeko64(m_file, footer.index_offset, SEEK_SET) != 0
+       || fread(m_index.data(), sizeof(cdt_index_entry), m_index.size(), m_file) != m_index.size()) {
+        return false;
+    }
+    uint32_t crc = footer.crc;
+    footer.crc = 0;
+    if(crc32c(crc32c(0, m_index.data(), m_index.size()*sizeof(cdt_index_entry)), &footer, sizeof(footer)) != crc) {
+        std::cerr << "Damaged chunk index" << std::endl;
+        return false;
+    }
+    m_frames = footer.frames;
+    return true;
+}
+
+bool ChunkReader::scan(int64_t data_start)
+{
+    TraceSpan span("scan_chunks");
+    m_index.clear();
+    m_frames = 0;
+    int64_t offset = data_start;
+    cdt_chunk_header header;
+    while(read_chunk(offset, header)) {
+        if(header.type == CDT_CHUNK_FRAMES) {
+            if(header.first_frame != m_frames) {
+                break;
+            }
+            cdt_index_entry entry = {static_cast<uint64_t>(offset), header.first_frame, header.first_time};
+            m_index.push_back(entry);
+            m_frames += header.frames;
+        }
+        offset += sizeof(header) + header.stored_size;
+    }
+    return true;
+}
+
+bool ChunkReader::read_chunk(int64_t offset, cdt_chunk_header& header)
+{
+    if(fseeko64(m_file, offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, m_file) != 1
+       || memcmp(header.magic, "CHK\n", 4) != 0 || header.raw_size > (1u << 30) || header.stored_size > (1u << 30)) {
+        return false;
+    }
+    m_stored.resize(header.stored_size);
+    if(fread(m_stored.data(), 1, header.stored_size, m_file) != header.stored_size) {
+        return false;
+    }
+    uint32_t crc = header.crc;
+    header.crc = 0;
+    bool valid = crc32c(crc32c(0, &header, sizeof(header)), m_stored.data(), m_stored.size()) == crc;
+    header.crc = crc;
+    return valid;
+}
+
+bool ChunkReader::load_chunk(size_t index)
+{
+    cdt_chunk_header header;
+    if(!read_chunk(m_index[index].offset, header)) {
+        std::cerr << "Damaged chunk at offset " << m_index[index].offset << std::endl;
+        return false;
+    }
+    m_data.resize(header.raw_size);
+    if(!m_decompressor.decompress(header.codec, header.shuffle, m_stored.data(), header.stored_size,
+                                  m_data.data(), header.raw_size)) {
+        return false;
+    }
+    m_position = 0;
+    m_next_chunk = index + 1;
+    return true;
+}
+
+bool ChunkReader::seek(uint64_t frame, size_t frame_size)
+{
+    m_data.clear();
+    m_position = 0;
+    m_next_chunk = 0;
+    if(frame > m_frames) {
+        return false;
+    }
+    if(m_index.empty()) {
+        return true;
+    }
+    // the last chunk starting at or before frame
+    auto it = std::upper_bound(m_index.begin(), m_index.end(), frame,
+        [](uint64_t value, const cdt_index_entry& entry) { return value < entry.first_frame; });
+    size_t index = std::max<size_t>(it - m_index.begin(), 1) - 1;
+    if(!load_chunk(index)) {
+        return false;
+    }
+    m_position = (frame - m_index[index].first_frame)*frame_size;
+    return m_position <= m_data.size();
+}
+
+size_t ChunkReader::read(void* data, size_t size, size_t count)
+{
+    char* out = static_cast<char*>(data);
+    size_t length = size*count;
+    size_t done = 0;
+    while(done < length) {
+        if(m_position == m_data.size() && (m_next_chunk >= m_index.size() || !load_chunk(m_next_chunk))) {
+            break;
+        }
+        size_t chunk = std::min(length - done, m_data.size() - m_position);
+        memcpy(out + done, &m_data[m_position], chunk);
+        m_position += chunk;
+        done += chunk;
+    }
+    return size? done / size : 0;
+}
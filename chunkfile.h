@@ -0,0 +1,166 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CHUNKFILE_H
+#define CHUNKFILE_H
+
+#include "codec.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+class LaneMetrics;
+class OutputFile;
+
+/// CRC32C (Castagnoli) of data, continuing crc. SSE 4.2 if the CPU has it
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+#define CDT_CHUNK_FRAMES 0   // complete frames
+#define CDT_CHUNK_SUMMARY 1  // "#SUM\n" and key=value lines
+
+/**
+ * Version 2 .cdt files are a sequence of chunks after the calibration.
+ * Every chunk starts with this header and can be checked and decoded on
+ * its own, so a file cut off by a crash can be read up to its last
+ * complete chunk.
+ */
+struct cdt_chunk_header {
+    char magic[4];         // "CHK\n"
+    uint8_t codec;         // codec_t the payload is stored with
+    uint8_t shuffle;       // element size the bytes were shuffled with, 0 = not shuffled
+    uint8_t type;          // CDT_CHUNK_FRAMES or CDT_CHUNK_SUMMARY
+    uint8_t reserved;
+    uint32_t frames;       // frames in the payload
+    uint32_t raw_size;
+    uint32_t stored_size;  // bytes following the header
+    uint32_t crc;          // CRC32C of the header with crc 0 and the stored payload
+    uint64_t first_frame;  // number of the first frame in the file
+    int64_t first_time;    // record time of the first frame, ns
+    int64_t last_time;     // record time of the last frame, ns
+};
+static_assert(sizeof(cdt_chunk_header) == 48, "cdt_chunk_header struct has unexpected size on this platform!");
+
+/// One per frame chunk in the index at the end of a finished file
+struct cdt_index_entry {
+    uint64_t offset;       // of the chunk header in the file
+    uint64_t first_frame;
+    int64_t first_time;
+};
+static_assert(sizeof(cdt_index_entry) == 24, "cdt_index_entry struct has unexpected size on this platform!");
+
+/// The last bytes of a finished file, after the index
+struct cdt_footer {
+    char magic[4];         // "IDX\n"
+    uint32_t crc;          // CRC32C of the index and the footer with crc 0
+    uint64_t chunks;       // index entries
+    uint64_t frames;       // frames in the file
+    uint64_t index_offset;
+};
+static_assert(sizeof(cdt_footer) == 32, "cdt_footer struct has unexpected size on this platform!");
+
+/**
+ * Writes frames to an OutputFile in chunks of whole frames, compressed if
+ * a codec is set. A chunk is written once it holds CDT_CHUNK_SIZE bytes or
+ * its first frame is CDT_CHUNK_MAX_AGE old, so a crash loses at most that.
+ * finish() appends the index of the chunks and the footer.
+ */
+class ChunkWriter {
+public:
+    ChunkWriter();
+
+    /// element_size: size of the values shuffled, 4 for floats, 2 for raw ADC values
+    void open(OutputFile* output, const CodecSettings& settings, int element_size);
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+    /// From the next chunk on
+    void set_level(int level) { m_compressor.set_level(level); }
+
+    /// Like fwrite(), into the frame in progress
+    bool write(const void* data, size_t size, size_t count);
+    /// The frame is complete, record_time: its triggered timestamp
+    bool end_frame(int64_t record_time);
+    /// Write the chunk in progress and a summary chunk after it
+    bool write_summary(const std::string& summary);
+    /// Write the last chunk, the index and the footer. The OutputFile is closed by the owner
+    bool finish();
+    uint64_t frames() const { return m_frames; }
+    /// Bytes in the file, compressed
+    uint64_t bytes_written() const { return m_bytes_written; }
+
+private:
+    bool write_chunk(uint8_t type);
+
+    OutputFile* m_output;
+    BlockCompressor m_compressor;
+    LaneMetrics* m_metrics;
+    std::vector<char> m_chunk;
+    std::vector<cdt_index_entry> m_index;
+    uint64_t m_frames;
+    uint32_t m_chunk_frames;
+    int64_t m_first_time;
+    int64_t m_last_time;
+    std::chrono::steady_clock::time_point m_chunk_start;
+    uint64_t m_bytes_written;
+};
+
+/**
+ * Reads the frames of a version 2 .cdt file, chunk by chunk. Frames are
+ * found through the index at the end of the file, or, if the file was not
+ * finished, by checking the chunks from the start up to the first
+ * incomplete or damaged one.
+ */
+class ChunkReader {
+public:
+    ChunkReader();
+
+    /// data_start: offset of the first chunk
+    bool open(FILE* file, int64_t data_start);
+    /// Frames in the file, those in complete chunks if it was not finished
+    uint64_t frames() const { return m_frames; }
+    /// The file had no index, the frames are what could be recovered
+    bool recovered() const { return m_recovered; }
+    /// Continue with frame number frame, frame_size: bytes per frame
+    bool seek(uint64_t frame, size_t frame_size);
+    /// Like fread(), the number of complete elements read
+    size_t read(void* data, size_t size, size_t count);
+
+private:
+    bool read_index(int64_t data_start);
+    bool scan(int64_t data_start);
+    /// Header and stored payload of the chunk at offset, false if incomplete or damaged
+    bool read_chunk(int64_t offset, cdt_chunk_header& header);
+    bool load_chunk(size_t index);
+
+    FILE* m_file;
+    std::vector<cdt_index_entry> m_index;
+    uint64_t m_frames;
+    bool m_recovered;
+    /// next chunk in the index to load
+    size_t m_next_chunk;
+    std::vector<char> m_stored;
+    std::vector<char> m_data;
+    size_t m_position;
+    BlockDecompressor m_decompressor;
+};
+
+#endif // CHUNKFILE_H
@@ -0,0 +1,420 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "configuration.h"
+#include "codec.h"
+#include "metrics.h"
+#include "outputfile.h"
+#include "trace.h"
+
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <errno.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+ #include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+ #include <lz4.h>
+ #include <lz4hc.h>
+#endif
+
+/// 32 frames of 1024 samples with time axis, large enough for the codecs to find their patterns
+#define CODEC_BLOCK_SIZE (256*1024)
+
+const char* codec_name(codec_t codec)
+{
+    switch(codec) {
+        case CODEC_NONE: return "none";
+        case CODEC_ZLIB: return "zlib";
+        case CODEC_LZ4: return "lz4";
+        case CODEC_ZSTD: return "zstd";
+    }
+    return "unknown";
+}
+
+bool parse_codec_spec(const std::string& spec, CodecSettings& settings)
+{
+    std::vector<std::string> parts;
+    boost::split(parts, spec, boost::is_any_of(":"));
+    if(parts.size() > 2 || (parts.size() == 2 && parts[1] != "shuffle")) {
+        return false;
+    }
+    settings.shuffle = parts.size() == 2;
+    if(parts[0] == "zlib") settings.codec = CODEC_ZLIB;
+#ifdef HAVE_LZ4
+    else if(parts[0] == "lz4") settings.codec = CODEC_LZ4;
+#endif
+#ifdef HAVE_ZSTD
+    else if(parts[0] == "zstd") settings.codec = CODEC_ZSTD;
+#endif
+    else return false;
+    return true;
+}
+
+std::string format_codec_spec(const CodecSettings& settings)
+{
+    return std::string(codec_name(settings.codec)) + (settings.shuffle? ":shuffle" : "");
+}
+
+int codec_max_level(codec_t codec)
+{
+    switch(codec) {
+#ifdef HAVE_LZ4
+        case CODEC_LZ4: return LZ4HC_CLEVEL_MAX;
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD: return ZSTD_maxCLevel();
+#endif
+        default: return Z_BEST_COMPRESSION;
+    }
+}
+
+/// Byte k of element i goes to k*count + i
+static void shuffle(const char* in, char* out, size_t length, int element_size)
+{
+    size_t count = length / element_size;
+    for(int k=0; k<element_size; k++) {
+        for(size_t i=0; i<count; i++) {
+            out[k*count + i] = in[i*element_size + k];
+        }
+    }
+    // a partial element at the end stays as it is
+    memcpy(out + count*element_size, in + count*element_size, length - count*element_size);
+}
+
+static void unshuffle(const char* in, char* out, size_t length, int element_size)
+{
+    size_t count = length / element_size;
+    for(int k=0; k<element_size; k++) {
+        for(size_t i=0; i<count; i++) {
+            out[i*element_size + k] = in[k*count + i];
+        }
+    }
+    memcpy(out + count*element_size, in + count*element_size, length - count*element_size);
+}
+
+/// Compressed size, 0 if the data does not fit into out
+static size_t compress_block(const CodecSettings& settings, void* zstd, const char* in, size_t length,
+                             char* out, size_t capacity)
+{
+    switch(settings.codec) {
+        case CODEC_ZLIB: {
+            uLongf out_length = capacity;
+            int level = settings.level == -1? Z_DEFAULT_COMPRESSION : settings.level;
+            if(compress2(reinterpret_cast<Bytef*>(out), &out_length, reinterpret_cast<const Bytef*>(in),
+                         length, level) != Z_OK) {
+                return 0;
+            }
+            return out_length;
+        }
+#ifdef HAVE_LZ4
+        case CODEC_LZ4: {
+            // levels above 2 select the slower high compression mode
+            int out_length;
+            if(settings.level > 2) {
+                out_length = LZ4_compress_HC(in, out, length, capacity, settings.level);
+            } else {
+                out_length = LZ4_compress_default(in, out, length, capacity);
+            }
+            return out_length > 0? out_length : 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD: {
+            int level = settings.level == -1? ZSTD_CLEVEL_DEFAULT : settings.level;
+            size_t out_length = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(zstd), out, capacity, in, length, level);
+            return ZSTD_isError(out_length)? 0 : out_length;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+/// False if the block is damaged or of a codec not compiled in
+static bool decompress_block(codec_t codec, void* zstd, const char* in, size_t length, char* out, size_t raw_length)
+{
+    switch(codec) {
+        case CODEC_NONE:
+            if(length != raw_length) {
+                return false;
+            }
+            memcpy(out, in, length);
+            return true;
+        case CODEC_ZLIB: {
+            uLongf out_length = raw_length;
+            return uncompress(reinterpret_cast<Bytef*>(out), &out_length, reinterpret_cast<const Bytef*>(in),
+                              length) == Z_OK && out_length == raw_length;
+        }
+#ifdef HAVE_LZ4
+        case CODEC_LZ4:
+            return LZ4_decompress_safe(in, out, length, raw_length) == static_cast<int>(raw_length);
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD: {
+            size_t out_length = ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(zstd), out, raw_length, in, length);
+            return !ZSTD_isError(out_length) && out_length == raw_length;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+BlockCompressor::BlockCompressor()
+: m_element_size(4), m_zstd(NULL)
+{
+}
+
+BlockCompressor::~BlockCompressor()
+{
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(m_zstd));
+#endif
+}
+
+void BlockCompressor::set_settings(const CodecSettings& settings, int element_size)
+{
+    m_settings = settings;
+    m_element_size = element_size;
+#ifdef HAVE_ZSTD
+    if(settings.codec == CODEC_ZSTD && !m_zstd) {
+        m_zstd = ZSTD_createCCtx();
+    }
+#endif
+}
+
+const char* BlockCompressor::compress(const char* in, size_t length, size_t& stored_size, uint8_t& codec,
+                                      uint8_t& shuffle_size)
+{
+    const char* raw = in;
+    shuffle_size = 0;
+    if(m_settings.shuffle) {
+        m_shuffled.resize(length);
+        shuffle(in, &m_shuffled[0], length, m_element_size);
+        in = m_shuffled.data();
+        shuffle_size = m_element_size;
+    }
+    // compressed blocks larger than the input are stored instead
+    m_stored.resize(length);
+    stored_size = compress_block(m_settings, m_zstd, in, length, &m_stored[0], m_stored.size());
+    codec = m_settings.codec;
+    if(stored_size == 0 || stored_size >= length) {
+        // incompressible, kept as it is
+        codec = CODEC_NONE;
+        shuffle_size = 0;
+        stored_size = length;
+        return raw;
+    }
+    return m_stored.data();
+}
+
+BlockDecompressor::BlockDecompressor()
+: m_zstd(NULL)
+{
+}
+
+BlockDecompressor::~BlockDecompressor()
+{
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(m_zstd));
+#endif
+}
+
+bool BlockDecompressor::decompress(uint8_t codec, uint8_t shuffle_size, const char* in, size_t length,
+                                   char* out, size_t raw_size)
+{
+#ifdef HAVE_ZSTD
+    if(codec == CODEC_ZSTD && !m_zstd) {
+        m_zstd = ZSTD_createDCtx();
+    }
+#endif
+    char* decompressed = out;
+    if(shuffle_size) {
+        m_shuffled.resize(raw_size);
+        decompressed = m_shuffled.data();
+    }
+    if(!decompress_block(static_cast<codec_t>(codec), m_zstd, in, length, decompressed, raw_size)) {
+        std::cerr << "Cannot decompress " << codec_name(static_cast<codec_t>(codec)) << " block" << std::endl;
+        return false;
+    }
+    if(shuffle_size) {
+        unshuffle(m_shuffled.data(), out, raw_size, shuffle_size);
+    }
+    return true;
+}
+
+CodecWriter::CodecWriter()
+: m_output(NULL), m_metrics(NULL), m_bytes_written(0)
+{
+}
+
+CodecWriter::~CodecWriter()
+{
+}
+
+void CodecWriter::open(OutputFile* output, const CodecSettings& settings, int element_size)
+{
+    m_output = output;
+    m_compressor.set_settings(settings, element_size);
+    m_bytes_written = output->offset();
+    if(compressed()) {
+        m_block.reserve(CODEC_BLOCK_SIZE);
+    }
+}
+
+bool CodecWriter::write(const void* data, size_t size, size_t count)
+{
+    if(!compressed()) {
+        return m_output->write(data, size*count);
+    }
+    const char* in = static_cast<const char*>(data);
+    size_t length = size*count;
+    while(length > 0) {
+        size_t chunk = std::min(length, CODEC_BLOCK_SIZE - m_block.size());
+        m_block.insert(m_block.end(), in, in + chunk);
+        in += chunk;
+        length -= chunk;
+        if(m_block.size() == CODEC_BLOCK_SIZE && !write_block()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CodecWriter::flush()
+{
+    return m_output->flush();
+}
+
+bool CodecWriter::finish()
+{
+    if(compressed() && !m_block.empty() && !write_block()) {
+        return false;
+    }
+    return true;
+}
+
+uint64_t CodecWriter::bytes_written() const
+{
+    if(!compressed()) {
+        return m_output? m_output->offset() : 0;
+    }
+    return m_bytes_written;
+}
+
+bool CodecWriter::write_block()
+{
+    TraceSpan span("compress");
+    auto start = std::chrono::steady_clock::now();
+    codec_block_header header;
+    memcpy(header.magic, "BLK\n", 4);
+    header.reserved = 0;
+    header.raw_size = m_block.size();
+    header.crc = crc32(0L, reinterpret_cast<const Bytef*>(m_block.data()), m_block.size());
+    size_t stored_size;
+    const char* stored = m_compressor.compress(m_block.data(), m_block.size(), stored_size, header.codec, header.shuffle);
+    header.stored_size = stored_size;
+    if(m_metrics) {
+        m_metrics->record(MS_COMPRESS, std::chrono::steady_clock::now() - start);
+    }
+    bool written = m_output->write(&header, sizeof(header)) && m_output->write(stored, stored_size);
+    // stored may be the block itself
+    m_block.clear();
+    if(!written) {
+        return false;
+    }
+    m_bytes_written += sizeof(header) + stored_size;
+    return true;
+}
+
+CodecReader::CodecReader()
+: m_file(0), m_compressed(false), m_position(0)
+{
+}
+
+CodecReader::~CodecReader()
+{
+}
+
+void CodecReader::open(FILE* file, bool compressed)
+{
+    m_file = file;
+    m_compressed = compressed;
+}
+
+bool CodecReader::seek(int64_t offset)
+{
+    m_block.clear();
+    m_position = 0;
+    return fseeko64(m_file, offset, SEEK_SET) == 0;
+}
+
+size_t CodecReader::read(void* data, size_t size, size_t count)
+{
+    if(!m_compressed) {
+        return fread(data, size, count, m_file);
+    }
+    char* out = static_cast<char*>(data);
+    size_t length = size*count;
+    size_t done = 0;
+    while(done < length) {
+        if(m_position == m_block.size() && !read_block()) {
+            break;
+        }
+        size_t chunk = std::min(length - done, m_block.size() - m_position);
+        memcpy(out + done, &m_block[m_position], chunk);
+        m_position += chunk;
+        done += chunk;
+    }
+    return size? done / size : 0;
+}
+
+bool CodecReader::read_block()
+{
+    codec_block_header header;
+    if(fread(&header, sizeof(header), 1, m_file) != 1) {
+        return false;
+    }
+    if(memcmp(header.magic, "BLK\n", 4) != 0 || header.raw_size > (1u << 30) || header.stored_size > (1u << 30)) {
+        std::cerr << "Damaged compressed block" << std::endl;
+        return false;
+    }
+    m_stored.resize(header.stored_size);
+    if(fread(m_stored.data(), 1, header.stored_size, m_file) != header.stored_size) {
+        return false;
+    }
+    m_block.resize(header.raw_size);
+    if(!m_decompressor.decompress(header.codec, header.shuffle, m_stored.data(), header.stored_size,
+                                  m_block.data(), header.raw_size)) {
+        return false;
+    }
+    if(crc32(0L, reinterpret_cast<const Bytef*>(m_block.data()), m_block.size()) != header.crc) {
+        std::cerr << "Compressed block with wrong checksum" << std::endl;
+        return false;
+    }
+    m_position = 0;
+    return true;
+}
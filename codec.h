@@ -0,0 +1,185 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+class LaneMetrics;
+class OutputFile;
+
+enum codec_t {
+    CODEC_NONE,
+    CODEC_ZLIB,
+    CODEC_LZ4,
+    CODEC_ZSTD
+};
+
+/**
+ * Compression of the binary formats, from "-z CODEC[:shuffle]" and -l.
+ *
+ * With shuffle, the bytes of the 4 byte floats (2 byte raw ADC values) are
+ * grouped by significance before compression: sign and exponent bytes of
+ * neighbouring samples are nearly equal and compress much better together.
+ */
+struct CodecSettings {
+    codec_t codec;
+    /// -1: the default of the codec
+    int level;
+    bool shuffle;
+
+    CodecSettings() : codec(CODEC_NONE), level(-1), shuffle(false) {}
+};
+
+const char* codec_name(codec_t codec);
+/// "zstd[:shuffle]" etc, false for unknown codecs or codecs not compiled in
+bool parse_codec_spec(const std::string& spec, CodecSettings& settings);
+/// The spec again, for file headers
+std::string format_codec_spec(const CodecSettings& settings);
+/// Highest level of the codec, zlib (and gzip) for CODEC_NONE
+int codec_max_level(codec_t codec);
+
+/**
+ * Every block starts with this header, so blocks can be decoded on their
+ * own, with the codec they were written with. Blocks that would not get
+ * smaller are stored with CODEC_NONE.
+ */
+struct codec_block_header {
+    char magic[4];        // "BLK\n"
+    uint8_t codec;        // codec_t
+    uint8_t shuffle;      // element size the bytes were shuffled with, 0 = not shuffled
+    uint16_t reserved;
+    uint32_t raw_size;
+    uint32_t stored_size; // bytes following the header
+    uint32_t crc;         // crc32 of the raw data
+};
+static_assert(sizeof(codec_block_header) == 20, "codec_block_header struct has unexpected size on this platform!");
+
+/**
+ * Compresses one block at a time, the way CodecWriter does, for containers
+ * with blocks of their own
+ */
+class BlockCompressor {
+public:
+    BlockCompressor();
+    ~BlockCompressor();
+
+    /// element_size: size of the values shuffled, as for CodecWriter::open()
+    void set_settings(const CodecSettings& settings, int element_size);
+    const CodecSettings& settings() const { return m_settings; }
+    void set_level(int level) { m_settings.level = level; }
+
+    /**
+     * Compress length bytes of in. Returns the stored_size bytes to store
+     * and sets codec and shuffle to how they are stored: in itself and
+     * CODEC_NONE if the block would not get smaller.
+     */
+    const char* compress(const char* in, size_t length, size_t& stored_size, uint8_t& codec, uint8_t& shuffle);
+
+private:
+    CodecSettings m_settings;
+    int m_element_size;
+    std::vector<char> m_shuffled;
+    std::vector<char> m_stored;
+    void* m_zstd;
+};
+
+/**
+ * Decompresses blocks written with a BlockCompressor
+ */
+class BlockDecompressor {
+public:
+    BlockDecompressor();
+    ~BlockDecompressor();
+
+    /// raw_size bytes into out, false if damaged or of a codec not compiled in
+    bool decompress(uint8_t codec, uint8_t shuffle, const char* in, size_t length, char* out, size_t raw_size);
+
+private:
+    std::vector<char> m_shuffled;
+    void* m_zstd;
+};
+
+/**
+ * Writes data to an OutputFile, either as it is or compressed in blocks of
+ * CODEC_BLOCK_SIZE bytes.
+ */
+class CodecWriter {
+public:
+    CodecWriter();
+    ~CodecWriter();
+
+    /// element_size: size of the values shuffled, 4 for floats, 2 for raw ADC values
+    void open(OutputFile* output, const CodecSettings& settings, int element_size);
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+    bool compressed() const { return m_compressor.settings().codec != CODEC_NONE; }
+    /// From the next block on
+    void set_level(int level) { m_compressor.set_level(level); }
+
+    /// Like fwrite(), false on errors
+    bool write(const void* data, size_t size, size_t count);
+    /// After a frame: OutputFile::flush(), compressed data waits for a full block
+    bool flush();
+    /// Write the last block, false on errors. The OutputFile is closed by the owner
+    bool finish();
+    /// Bytes in the file, compressed
+    uint64_t bytes_written() const;
+
+private:
+    bool write_block();
+
+    OutputFile* m_output;
+    BlockCompressor m_compressor;
+    LaneMetrics* m_metrics;
+    std::vector<char> m_block;
+    uint64_t m_bytes_written;
+};
+
+/**
+ * Reads data written by a CodecWriter, decompressing block by block
+ */
+class CodecReader {
+public:
+    CodecReader();
+    ~CodecReader();
+
+    void open(FILE* file, bool compressed);
+    /// Continue at offset in the file, the start of a block if compressed
+    bool seek(int64_t offset);
+    /// Like fread(), the number of complete elements read
+    size_t read(void* data, size_t size, size_t count);
+
+private:
+    bool read_block();
+
+    FILE* m_file;
+    bool m_compressed;
+    std::vector<char> m_block;
+    size_t m_position;
+    std::vector<char> m_stored;
+    BlockDecompressor m_decompressor;
+};
+
+#endif // CODEC_H
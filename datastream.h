@@ -27,25 +27,50 @@
 #include <sstream>
 #include <chrono>
 #include <boost/algorithm/string.hpp>
+#include "frame.h"
+#include "codec.h"
+#include "outputfile.h"
+
+class LaneMetrics;
 
 using std::chrono::nanoseconds;
 
+struct DRSCalibration;
+
 class DataStream {
 protected:
     int frames_per_sample;
+    /// readout position of the first sample, frames_per_sample is the ROI length
+    int roi_start;
     bool compress_data;
     int compression_level;
+    /// threads compressing in parallel, for formats that compress
+    int compression_threads;
+    /// how the data reaches the disk, for formats writing through an OutputFile
+    OutputSettings output_settings;
     bool free_trigger;
     bool binary_output;
     float trigger_delay_percent;
     std::map<std::string, std::string> user_header;
+    std::map<std::string, std::string> summary;
     std::string filename;
     std::string directory;
     std::array<int, 4> ch_config;
     std::string command_line;
+    /// compression time goes here if set
+    LaneMetrics* metrics;
 
     virtual bool init_stream() = 0;
 
+    /// Summary entries as "<prefix>key<separator>value" lines
+    std::string format_summary(const std::string& prefix, const std::string& separator) const {
+        std::ostringstream ss;
+        for(auto it: summary) {
+            ss << prefix << it.first << separator << it.second << "\n";
+        }
+        return ss.str();
+    }
+
 public:
 
     class not_suppported_write : std::exception
@@ -66,14 +91,17 @@ public:
 
     DataStream()
     : frames_per_sample(1024),
+    roi_start(0),
     compress_data(false),
     compression_level(-1),
+    compression_threads(1),
     free_trigger(false),
     binary_output(false),
     trigger_delay_percent(100.0),
     user_header(),
     filename(""),
-    directory("")
+    directory(""),
+    metrics(NULL)
     {
     }
     virtual ~DataStream() {
@@ -81,11 +109,18 @@ public:
     
     /**
     compression_level == -1: No compression
+    p_roi: recorded window, frames carry p_roi.length samples
     */
-    virtual bool init(std::string p_directory, std::string p_filename, int p_frames_per_sample,
+    virtual bool init(std::string p_directory, std::string p_filename, const RegionOfInterest& p_roi,
                       int p_compression_level, bool p_free_trigger, bool p_binary_output, float p_trigger_delay_percent,
                       std::array<int, 4> p_ch_config, int argc, char** argv
                      ) {
+        directory = p_directory;
+        frames_per_sample = p_roi.length;
+        roi_start = p_roi.start;
+        compression_level = p_compression_level;
+        compress_data = p_compression_level != -1;
+        // the extension may depend on the settings, .csv.gz for compressed text
         filename = p_filename;
         if(filename.length() == 0) {
             char default_filename[50];
@@ -96,10 +131,6 @@ public:
         } else if(!boost::algorithm::ends_with(filename, get_file_extension())) {
             filename += get_file_extension();
         }
-        directory = p_directory;
-        frames_per_sample = p_frames_per_sample;
-        compression_level = p_compression_level;
-        compress_data = p_compression_level != -1;
         free_trigger = p_free_trigger;
         binary_output = p_binary_output;
         trigger_delay_percent = p_trigger_delay_percent;
@@ -130,11 +161,98 @@ public:
         oss << value;
         add_user_entry(key, oss.str());
     }
+    /**
+    Run summary, only known at the end of the run. Written by finalize()
+    */
+    virtual void add_summary_entry(std::string key, std::string value) {
+        summary[key] = value;
+    }
+    virtual void add_summary_entry(std::string key, uint64_t value) {
+        std::ostringstream oss;
+        oss << value;
+        add_summary_entry(key, oss.str());
+    }
+    virtual void add_summary_entry(std::string key, double value) {
+        std::ostringstream oss;
+        oss << value;
+        add_summary_entry(key, oss.str());
+    }
+    /**
+    Record raw ADC values (Frame::raw) with this calibration instead of
+    calibrated waveforms. False if the format cannot store raw frames.
+    */
+    virtual bool set_calibration(const DRSCalibration& calibration) {
+        return false;
+    }
+    /**
+    Write the trigger cell instead of the time axis with every frame, the
+    time axes are stored once as cell widths. False if the format always
+    writes full time axes.
+    */
+    virtual bool set_cell_widths(const float* dt) {
+        return false;
+    }
+    /**
+    Compress the frames in blocks with this codec. False if the format
+    cannot do that.
+    */
+    virtual bool set_codec(const CodecSettings& codec) {
+        return false;
+    }
+    /**
+    Change the compression level during the run, from the next compressed
+    block on. False if the output is not compressed.
+    */
+    virtual bool set_compression_level(int level) {
+        return false;
+    }
+    /**
+    Write the data through an OutputFile with these settings, before
+    write_header(). False if the format writes its files differently.
+    */
+    virtual bool set_output(const OutputSettings& settings) {
+        return false;
+    }
     virtual bool write_header() = 0;
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data) = 0;
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data) = 0;
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) = 0;
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data) = 0;
+    /**
+    Write a captured frame, single or multi channel depending on the channel config
+    */
+    virtual bool write(const Frame& frame) {
+        if(ch_config[1] != -1) {
+            return write_frame(frame.timestamps, frame.time, frame.data);
+        }
+        return write_frame(frame.timestamps, frame.time, frame.data[ch_config[0]]);
+    }
+    /**
+    True if place() can put frames directly into the output
+    */
+    virtual bool can_place() const {
+        return false;
+    }
+    /**
+    Point the time axis and the recorded waveforms of frame at the storage
+    of the next frame in the output, so capturing into it writes the file
+    without a copy. The frame is then written with write() as usual.
+    False if the output cannot take it.
+    */
+    virtual bool place(Frame& frame) {
+        return false;
+    }
     virtual bool finalize() = 0;
     virtual std::string get_file_extension() const = 0;
+    /// Bytes written to the output so far, 0 if the format does not know
+    virtual uint64_t bytes_written() const {
+        return 0;
+    }
+    virtual void set_metrics(LaneMetrics* p_metrics) {
+        metrics = p_metrics;
+    }
+    /// Before init(), ignored by formats without compression
+    void set_compression_threads(int p_threads) {
+        compression_threads = p_threads;
+    }
 };
 
 #endif
@@ -0,0 +1,218 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Stand-in for the detector control server, for running get_data -s
+ * without the cooling setup. Speaks the same line protocol on a UNIX domain
+ * socket:
+ *
+ *  T_soll=T     set the target temperature in K, no answer
+ *  T_detector   answers the current temperature in K
+ *  stable       answers True or False
+ *  interrupt, continue, hold
+ *               accepted and counted, no answer
+ *
+ * The temperature approaches T_soll exponentially, it is stable within the
+ * tolerance. Clients are served one line at a time from a single thread.
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <chrono>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+volatile sig_atomic_t stop_server = 0;
+
+void terminate(int signum) {
+    stop_server = 1;
+}
+
+class DummyDetector {
+public:
+    DummyDetector(double temperature, double tau, double tolerance)
+    : m_T_start(temperature), m_T_soll(temperature), m_tau(tau), m_tolerance(tolerance),
+    m_since(steady_clock::now()) {}
+
+    double temperature() const {
+        double t = duration<double>(steady_clock::now() - m_since).count();
+        return m_T_soll + (m_T_start - m_T_soll) * exp(-t / m_tau);
+    }
+    bool stable() const { return fabs(temperature() - m_T_soll) < m_tolerance; }
+    void set_T_soll(double T_soll) {
+        m_T_start = temperature();
+        m_T_soll = T_soll;
+        m_since = steady_clock::now();
+    }
+
+private:
+    double m_T_start;
+    double m_T_soll;
+    double m_tau;
+    double m_tolerance;
+    steady_clock::time_point m_since;
+};
+
+int main(int argc, char** argv)
+{
+    std::string socket_file("/tmp/detector_control.unix");
+    double temperature = 293.15;
+    double tau = 5.0;
+    double tolerance = 0.1;
+    int delay_ms = 0;
+    bool verbose = false;
+    int optchar;
+    while((optchar = getopt(argc, argv, "hU:T:t:e:l:v")) != -1) {
+        try {
+            if(optchar == '?') return 1;
+            else if(optchar == 'h') {
+                std::cout << "detector_control_dummy - stand-in for the detector control server\n\n"
+                          << "Usage: " << argv[0] << " [OPTIONS]\n\n"
+                          << " -U socket   UNIX domain socket, default /tmp/detector_control.unix\n"
+                          << " -T KELVIN   initial detector temperature, default 293.15\n"
+                          << " -t SECONDS  time constant of the temperature control, default 5\n"
+                          << " -e KELVIN   stable if this close to T_soll, default 0.1\n"
+                          << " -l MS       delay every answer, to mimic a slow server\n"
+                          << " -v          log every command\n"
+                          << std::endl;
+                return 1;
+            }
+            else if(optchar == 'U') socket_file = optarg;
+            else if(optchar == 'T') temperature = boost::lexical_cast<double>(optarg);
+            else if(optchar == 't') tau = boost::lexical_cast<double>(optarg);
+            else if(optchar == 'e') tolerance = boost::lexical_cast<double>(optarg);
+            else if(optchar == 'l') delay_ms = boost::lexical_cast<int>(optarg);
+            else if(optchar == 'v') verbose = true;
+        } catch(boost::bad_lexical_cast const& e) {
+            std::cerr << argv[0] << ": Cannot parse value '" << optarg << "' of option -"
+                      << static_cast<char>(optchar) << std::endl;
+            return 1;
+        }
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_file.c_str(), sizeof(addr.sun_path)-1);
+    unlink(socket_file.c_str());
+    if(server == -1 || bind(server, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 4) != 0) {
+        std::cerr << argv[0] << ": Cannot listen on '" << socket_file << "': " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = terminate;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    DummyDetector detector(temperature, tau, tolerance);
+    std::map<std::string, unsigned long> counts;
+    std::vector<struct pollfd> fds(1);
+    std::vector<std::string> buffers(1);
+    fds[0].fd = server;
+    fds[0].events = POLLIN;
+    while(!stop_server) {
+        if(poll(&fds[0], fds.size(), 1000) < 0) {
+            continue;
+        }
+        if(fds[0].revents & POLLIN) {
+            struct pollfd client;
+            client.fd = accept(server, NULL, NULL);
+            client.events = POLLIN;
+            client.revents = 0;
+            if(client.fd >= 0) {
+                fds.push_back(client);
+                buffers.push_back("");
+                if(verbose) std::cout << "client " << client.fd << " connected" << std::endl;
+            }
+        }
+        for(size_t i=1; i<fds.size(); i++) {
+            if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            char buf[4096];
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if(n <= 0) {
+                if(verbose) std::cout << "client " << fds[i].fd << " disconnected" << std::endl;
+                close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+                buffers.erase(buffers.begin() + i);
+                i--;
+                continue;
+            }
+            buffers[i].append(buf, n);
+            size_t eol;
+            while((eol = buffers[i].find('\n')) != std::string::npos) {
+                std::string line = buffers[i].substr(0, eol);
+                buffers[i].erase(0, eol + 1);
+                std::string answer;
+                if(line.compare(0, 7, "T_soll=") == 0) {
+                    detector.set_T_soll(atof(line.c_str() + 7));
+                    line = "T_soll";
+                } else if(line == "T_detector") {
+                    char value[32];
+                    snprintf(value, sizeof(value), "%f\n", detector.temperature());
+                    answer = value;
+                } else if(line == "stable") {
+                    answer = detector.stable()? "True\n" : "False\n";
+                } else if(line != "interrupt" && line != "continue" && line != "hold") {
+                    std::cerr << "Unknown command '" << line << "'" << std::endl;
+                    continue;
+                }
+                counts[line]++;
+                if(verbose) std::cout << "client " << fds[i].fd << ": " << line << std::endl;
+                if(!answer.empty()) {
+                    if(delay_ms > 0) usleep(delay_ms * 1000);
+                    if(write(fds[i].fd, answer.c_str(), answer.length()) < 0) {
+                        std::cerr << "Cannot answer client " << fds[i].fd << ": " << strerror(errno) << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    for(size_t i=1; i<fds.size(); i++) {
+        close(fds[i].fd);
+    }
+    close(server);
+    unlink(socket_file.c_str());
+    for(auto it: counts) {
+        std::cout << it.first << ": " << it.second << std::endl;
+    }
+    return 0;
+}
@@ -19,86 +19,355 @@
  */
 
 #include "detectorcontrol.h"
+#include "runclock.h"
+#include "trace.h"
 
 #include <iostream>
-#include <sys/errno.h>
+#include <algorithm>
+#include <sstream>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <errno.h>
 #include <unistd.h>
 
-bool DetectorControl::send_msg(std::string message)
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+// an unanswered request closes the connection after this long
+#define CONTROL_REQUEST_TIMEOUT_MS 1000
+// polls sent without answer yet, at most
+#define CONTROL_MAX_PIPELINE 4
+#define CONTROL_BACKOFF_MIN_MS 100
+#define CONTROL_BACKOFF_MAX_MS 5000
+
+DetectorControl::DetectorControl(std::string sfile)
+: socket_file(sfile), m_T_soll(300), m_T_soll_set(false), m_sock(-1),
+m_epoll(epoll_create1(EPOLL_CLOEXEC)), m_wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+m_stop(false), m_holding(false), m_hold_sent(false), m_polling(false), m_want_write(false),
+m_interval(1000), m_backoff(CONTROL_BACKOFF_MIN_MS), m_answer_T(0.0),
+m_timeouts(0), m_reconnects(0)
 {
-    clearerr(stream);
-    size_t written = fwrite(message.c_str(), 1, message.length(), stream);
-    if(written == 0) {
-        if(ferror(stream)) {
-            std::cerr << "Detector control: cannot send command" << std::endl;
-            return false;
-        }
+    DetectorState state = { 0.0, 0, 0, 0 };
+    m_state.store(state);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeup;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &event);
+}
+
+DetectorControl::~DetectorControl()
+{
+    disconnect_control();
+    close(m_wakeup);
+    close(m_epoll);
+}
+
+bool DetectorControl::open_socket()
+{
+    m_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_sock == -1) {
+        std::cerr << "Detector control: cannot create socket: " << strerror(errno) << std::endl;
+        return false;
     }
-    fflush(stream);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_file.c_str(), sizeof(addr.sun_path)-1);
+    // connecting a UNIX domain socket does not block, it fails or succeeds right away
+    if(connect(m_sock, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Detector control: cannot connect to UNIX domain socket: " << strerror(errno) << std::endl;
+        close(m_sock);
+        m_sock = -1;
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_sock;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_sock, &event);
+    m_want_write = false;
     return true;
 }
 
-std::string DetectorControl::recv_line()
+void DetectorControl::close_socket()
 {
-    std::string line("");
-    char* lineptr = NULL;
-    size_t n = 0;
-    errno = 0;
-    if(getline(&lineptr, &n, stream) == -1) {
-        if(errno) {
-            std::cerr << "Detector control: cannot receive response: " << strerror(errno) << std::endl;
+    if(m_sock == -1) {
+        return;
+    }
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_sock, NULL);
+    close(m_sock);
+    m_sock = -1;
+    // whatever was in flight is lost, a partly sent line included
+    m_out.clear();
+    m_in.clear();
+    m_pending.clear();
+    m_hold_sent = false;
+    m_reconnect_at = steady_clock::now() + m_backoff;
+    m_backoff = std::min(m_backoff * 2, milliseconds(CONTROL_BACKOFF_MAX_MS));
+    publish_invalid();
+    m_answered.notify_all();
+}
+
+void DetectorControl::publish_invalid()
+{
+    DetectorState state = m_state.load(std::memory_order_relaxed);
+    state.valid = 0;
+    state.stable = 0;
+    m_state.store(state, std::memory_order_release);
+}
+
+void DetectorControl::wake()
+{
+    uint64_t one = 1;
+    if(write(m_wakeup, &one, sizeof(one)) < 0) {
+        // the counter is already non-zero, the engine wakes up anyway
+    }
+}
+
+void DetectorControl::queue(const std::string& message)
+{
+    if(m_sock == -1) {
+        return;
+    }
+    m_out += message;
+    flush();
+}
+
+void DetectorControl::flush()
+{
+    while(!m_out.empty()) {
+        ssize_t n = send(m_sock, m_out.data(), m_out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n > 0) {
+            m_out.erase(0, n);
+        } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            std::cerr << "Detector control: cannot send command: " << strerror(errno) << std::endl;
+            close_socket();
+            wake();
+            return;
         }
     }
-    else {
-        line = lineptr;
+    // let the engine send the rest once the socket is writable
+    bool want_write = !m_out.empty();
+    if(want_write != m_want_write) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        if(want_write) event.events |= EPOLLOUT;
+        event.data.fd = m_sock;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_sock, &event);
+        m_want_write = want_write;
     }
-    if(lineptr) free(lineptr);
-    return line;
 }
 
-DetectorControl::DetectorControl(std::string sfile)
-: sock(0), stream(0), socket_file(sfile), m_T_soll(300)
+bool DetectorControl::poll_due(steady_clock::time_point now) const
 {
+    return m_polling && m_sock != -1 && !m_holding
+        && m_pending.size() < 2*CONTROL_MAX_PIPELINE
+        && now - m_last_poll >= m_interval;
 }
-DetectorControl::~DetectorControl()
+
+std::string DetectorControl::poll_requests(steady_clock::time_point now)
 {
-    disconnect_control();
+    Request request;
+    request.sent = now;
+    request.deadline = now + milliseconds(CONTROL_REQUEST_TIMEOUT_MS);
+    request.type = RQ_T_DETECTOR;
+    m_pending.push_back(request);
+    request.type = RQ_STABLE;
+    m_pending.push_back(request);
+    m_last_poll = now;
+    return "T_detector\nstable\n";
 }
 
-bool DetectorControl::connect_control()
+bool DetectorControl::answer(const std::string& line, steady_clock::time_point now)
 {
-    sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if(sock == -1) {
-        std::cerr << "Detector control: cannot create socket: " << strerror(errno) << std::endl;
+    if(m_pending.empty()) {
+        std::cerr << "Detector control: unexpected answer '" << line << "'" << std::endl;
         return false;
     }
-    struct sockaddr_un addr;
-    addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, socket_file.c_str());
-    int len = strlen(addr.sun_path) + sizeof(addr.sun_family);
-    if(connect(sock, (const sockaddr*)&addr, len) != 0) {
-        std::cerr << "Detector control: cannot connect to UNIX domain socket: " << strerror(errno) << std::endl;
+    Request request = m_pending.front();
+    m_pending.pop_front();
+    int64_t round_trip_ns = duration_cast<std::chrono::nanoseconds>(now - request.sent).count();
+    m_round_trip.add(round_trip_ns);
+    if(Trace::enabled()) {
+        int64_t received = RunClock::now() - duration_cast<std::chrono::nanoseconds>(steady_clock::now() - now).count();
+        Trace::record(request.type == RQ_T_DETECTOR? "request T_detector" : "request stable",
+                      received - round_trip_ns, received);
+    }
+    if(request.type == RQ_T_DETECTOR) {
+        char* end = NULL;
+        m_answer_T = strtof(line.c_str(), &end);
+        // anything but a number means the answers are out of step
+        return end != line.c_str();
+    }
+    if(line != "True" && line != "False") {
+        return false;
+    }
+    DetectorState state = m_state.load(std::memory_order_relaxed);
+    state.T_detector = m_answer_T;
+    state.stable = line == "True";
+    state.valid = 1;
+    state.polls++;
+    m_state.store(state, std::memory_order_release);
+    m_backoff = milliseconds(CONTROL_BACKOFF_MIN_MS);
+    m_answered.notify_all();
+    return true;
+}
+
+void DetectorControl::receive()
+{
+    char buf[4096];
+    for(;;) {
+        ssize_t n = recv(m_sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if(n > 0) {
+            m_in.append(buf, n);
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if(n == 0) {
+            std::cerr << "Detector control: server closed the connection" << std::endl;
+        } else {
+            std::cerr << "Detector control: cannot receive response: " << strerror(errno) << std::endl;
+        }
+        close_socket();
+        return;
+    }
+    auto now = steady_clock::now();
+    size_t eol;
+    while((eol = m_in.find('\n')) != std::string::npos) {
+        std::string line = m_in.substr(0, eol);
+        m_in.erase(0, eol + 1);
+        if(!line.empty() && line[line.length()-1] == '\r') {
+            line.erase(line.length()-1);
+        }
+        if(!answer(line, now)) {
+            close_socket();
+            return;
+        }
+    }
+}
+
+void DetectorControl::run()
+{
+    Trace::set_thread_name("detector control");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_stop) {
+        auto now = steady_clock::now();
+        if(m_sock == -1 && now >= m_reconnect_at) {
+            if(open_socket()) {
+                m_reconnects++;
+                // a restarted server has lost the set point
+                if(m_T_soll_set) {
+                    queue(T_soll_command());
+                }
+            } else {
+                m_reconnect_at = now + m_backoff;
+                m_backoff = std::min(m_backoff * 2, milliseconds(CONTROL_BACKOFF_MAX_MS));
+            }
+        }
+        if(m_sock != -1 && !m_pending.empty() && now >= m_pending.front().deadline) {
+            std::cerr << "Detector control: no answer within " << CONTROL_REQUEST_TIMEOUT_MS << " ms" << std::endl;
+            m_timeouts++;
+            close_socket();
+            continue;
+        }
+        if(poll_due(now)) {
+            queue(poll_requests(now));
+        }
+
+        steady_clock::time_point next = now + milliseconds(CONTROL_BACKOFF_MAX_MS);
+        if(m_sock == -1) {
+            next = std::min(next, m_reconnect_at);
+        } else {
+            if(m_polling) {
+                // while holding, hold_end() usually polls, look again after an interval anyway
+                next = std::min(next, m_holding? now + m_interval : m_last_poll + m_interval);
+            }
+            if(!m_pending.empty()) {
+                next = std::min(next, m_pending.front().deadline);
+            }
+        }
+        int timeout_ms = std::max<int64_t>(0, duration_cast<milliseconds>(next - now).count() + 1);
+
+        lock.unlock();
+        struct epoll_event events[4];
+        int num_events = epoll_wait(m_epoll, events, 4, timeout_ms);
+        lock.lock();
+        for(int i=0; i<num_events; i++) {
+            if(events[i].data.fd == m_wakeup) {
+                uint64_t count;
+                if(read(m_wakeup, &count, sizeof(count)) < 0) {
+                    // nothing to reset
+                }
+            } else if(events[i].data.fd == m_sock) {
+                // the socket may have been replaced meanwhile, both are non-blocking anyway
+                if(events[i].events & EPOLLOUT) {
+                    flush();
+                }
+                if(m_sock != -1 && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive();
+                }
+            }
+        }
+    }
+}
+
+bool DetectorControl::connect_control()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_sock == -1 && !open_socket()) {
         return false;
     }
-    stream = fdopen(sock, "r+");
+    if(!m_thread.joinable()) {
+        m_stop = false;
+        m_thread = std::thread(&DetectorControl::run, this);
+    }
     return true;
 }
 
 void DetectorControl::disconnect_control()
 {
-    close(sock);
-    sock = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        wake();
+    }
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_sock != -1) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_sock, NULL);
+        close(m_sock);
+        m_sock = -1;
+    }
+    m_pending.clear();
+    m_out.clear();
+    publish_invalid();
+}
+
+std::string DetectorControl::T_soll_command() const
+{
+    std::stringstream line;
+    line << "T_soll=" << m_T_soll << "\n";
+    return line.str();
 }
 
 void DetectorControl::setTsoll(float T_soll)
 {
+    TraceSpan span("setTsoll");
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_T_soll = T_soll;
-    std::stringstream line;
-    line << "T_soll=" << T_soll << "\n";
-    send_msg(line.str());
+    m_T_soll_set = true;
+    queue(T_soll_command());
 }
 
 float DetectorControl::getTsoll()
@@ -106,38 +375,96 @@ float DetectorControl::getTsoll()
     return m_T_soll;
 }
 
+bool DetectorControl::poll_and_wait(std::unique_lock<std::mutex>& lock)
+{
+    if(m_sock == -1) {
+        return false;
+    }
+    uint16_t polls = m_state.load().polls;
+    queue(poll_requests(steady_clock::now()));
+    return m_answered.wait_for(lock, milliseconds(CONTROL_REQUEST_TIMEOUT_MS),
+                               [this, polls]() { return m_sock == -1 || m_state.load().polls != polls; })
+        && m_sock != -1;
+}
+
 float DetectorControl::getTist()
 {
-    send_msg("T_detector\n");
-    std::istringstream is(recv_line());
-    float temperature;
-    is >> temperature;
-    return temperature;
+    TraceSpan span("getTist");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return poll_and_wait(lock)? m_state.load().T_detector : NAN;
 }
 
 bool DetectorControl::temperatureStable()
 {
-    send_msg("stable\n");
-    std::string line = recv_line();
-    return line.find("True") != std::string::npos;
+    TraceSpan span("temperatureStable");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return poll_and_wait(lock) && m_state.load().stable;
 }
 
 void DetectorControl::interruptMeasurement()
 {
-    send_msg("interrupt\n");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queue("interrupt\n");
 }
 
 void DetectorControl::contineMeasurement()
 {
-    send_msg("continue\n");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queue("continue\n");
 }
 
 void DetectorControl::hold_start()
 {
-    send_msg("hol");
+    TraceSpan span("hold_start");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_holding = true;
+    m_hold_sent = m_sock != -1;
+    queue("hol");
 }
 
 void DetectorControl::hold_end()
 {
-    send_msg("d\n");
+    TraceSpan span("hold_end");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_holding = false;
+    // a "d" on a connection opened during the hold would be a command of its own
+    std::string message = m_hold_sent? "d\n" : "";
+    m_hold_sent = false;
+    // the batches leave little time in between, so the next poll goes out
+    // with the end of the hold, in the same send()
+    auto now = steady_clock::now();
+    if(poll_due(now)) {
+        message += poll_requests(now);
+    }
+    queue(message);
+}
+
+bool DetectorControl::start_polling(milliseconds interval)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_interval = interval;
+        m_polling = true;
+        m_last_poll = steady_clock::time_point();
+        wake();
+    }
+    return connect_control();
+}
+
+void DetectorControl::stop_polling()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_polling = false;
+}
+
+void print_detector_control_stats(const DetectorControl& control)
+{
+    const LatencyHistogram& round_trip = control.round_trip();
+    std::cout << "Detector control: " << round_trip.count() << " answers, round trip mean "
+              << round_trip.mean()/1000.0 << "us"
+              << ", p50 " << round_trip.quantile(0.5)/1000.0 << "us"
+              << ", p99 " << round_trip.quantile(0.99)/1000.0 << "us"
+              << ", max " << round_trip.max()/1000.0 << "us, "
+              << control.timeouts() << " timeouts, "
+              << control.reconnects() << " reconnects" << std::endl;
 }
@@ -21,34 +21,140 @@
 #ifndef DETECTORCONTROL_H
 #define DETECTORCONTROL_H
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string>
-#include <sstream>
+#include "histogram.h"
 
-class DetectorControl {
-private:
-    int sock;
-    FILE* stream;
-    std::string socket_file;
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 
-    bool send_msg(std::string message);
-    std::string recv_line();
-    float m_T_soll;
+/**
+ * Latest detector state as seen by the protocol engine
+ */
+struct DetectorState {
+    float T_detector;  ///< detector temperature in K
+    uint8_t valid;     ///< a poll was answered since the last (re)connect
+    uint8_t stable;
+    uint16_t polls;    ///< answered polls, wraps around
+};
 
+/**
+ * Client of the detector control server on a UNIX domain socket.
+ *
+ * A protocol engine thread owns the non-blocking connection and waits on it
+ * with epoll. Commands are appended to an output buffer and sent right away
+ * by the calling thread if the socket takes them, which it normally does;
+ * the rest is sent by the engine once the socket is writable. No caller
+ * ever waits for the server, except for the explicitly blocking getTist()
+ * and temperatureStable().
+ *
+ * Requests with an answer (T_detector, stable) are pipelined, answers are
+ * matched to them in order. Every request has a deadline. A missed deadline,
+ * an answer out of step or a lost connection closes the socket, and the
+ * engine reconnects with exponential backoff and sends T_soll again. The
+ * DetectorState is invalid until the next answer.
+ *
+ * With start_polling() the engine asks for T_detector and stable at the
+ * given interval and publishes the answers as an atomic DetectorState, so
+ * the capture loop never touches the socket.
+ *
+ * Between hold_start() and hold_end() the half sent "hold" command occupies
+ * the line, nothing is polled then. hold_end() sends the next poll in the
+ * same write, so back to back batches still get one poll per batch and the
+ * state is at most one batch old.
+ */
+class DetectorControl {
 public:
     DetectorControl(std::string sfile);
     ~DetectorControl();
+    /// Connect and start the protocol engine, false if the server cannot be reached
     bool connect_control();
+    /// Stop the engine and close the connection
     void disconnect_control();
     void setTsoll(float T_soll);
     float getTsoll();
+    /// Poll and wait for the answer, NAN resp. false if there is none in time
     float getTist();
     bool temperatureStable();
     void interruptMeasurement();
     void contineMeasurement();
     void hold_start();
     void hold_end();
+
+    /// Poll the detector state in the background, connects if necessary
+    bool start_polling(std::chrono::milliseconds interval);
+    void stop_polling();
+    DetectorState state() const { return m_state.load(std::memory_order_acquire); }
+
+    /// Round trip times of the answered requests, complete after disconnect_control()
+    const LatencyHistogram& round_trip() const { return m_round_trip; }
+    uint64_t timeouts() const { return m_timeouts; }
+    uint64_t reconnects() const { return m_reconnects; }
+
+private:
+    DetectorControl(const DetectorControl&);
+    DetectorControl& operator=(const DetectorControl&);
+
+    enum request_t {
+        RQ_T_DETECTOR,
+        RQ_STABLE
+    };
+    struct Request {
+        request_t type;
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void run();
+    /// The helpers below expect m_mutex to be held
+    bool open_socket();
+    void close_socket();
+    void queue(const std::string& message);
+    void flush();
+    bool poll_due(std::chrono::steady_clock::time_point now) const;
+    std::string poll_requests(std::chrono::steady_clock::time_point now);
+    void receive();
+    bool answer(const std::string& line, std::chrono::steady_clock::time_point now);
+    void wake();
+    void publish_invalid();
+    std::string T_soll_command() const;
+    /// Poll and wait for the answer, the lock is released while waiting
+    bool poll_and_wait(std::unique_lock<std::mutex>& lock);
+
+    std::string socket_file;
+    float m_T_soll;
+    bool m_T_soll_set;
+    int m_sock;
+    int m_epoll;
+    int m_wakeup;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_answered;
+    bool m_stop;
+    bool m_holding;
+    bool m_hold_sent;  ///< "hol" went out on the current connection
+    bool m_polling;
+    bool m_want_write;
+    std::chrono::milliseconds m_interval;
+    std::chrono::milliseconds m_backoff;
+    std::chrono::steady_clock::time_point m_last_poll;
+    std::chrono::steady_clock::time_point m_reconnect_at;
+    std::string m_out;
+    std::string m_in;
+    std::deque<Request> m_pending;
+    float m_answer_T;
+    std::atomic<DetectorState> m_state;
+
+    LatencyHistogram m_round_trip;
+    uint64_t m_timeouts;
+    uint64_t m_reconnects;
 };
 
+void print_detector_control_stats(const DetectorControl& control);
+
 #endif // DETECTORCONTROL_H
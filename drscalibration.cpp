@@ -0,0 +1,115 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "drscalibration.h"
+
+#include <iostream>
+#include <string.h>
+
+#define CALIBRATION_MAGIC "#CAL"
+#define CALIBRATION_VERSION 1
+
+/*
+ * Stored layout, little endian like the rest of the .cdt file:
+ *
+ *   char magic[4] = "#CAL", uint16 version, uint16 num_channels, float range,
+ *   float dt[1024], and per channel:
+ *   uint16 board_channel, uint16 offset[1024], float gain[1024], uint16 offset2[1024]
+ */
+
+const DRSChannelCalibration* DRSCalibration::channel(int board_channel) const
+{
+    for(size_t i=0; i<channels.size(); i++) {
+        if(channels[i].board_channel == board_channel) {
+            return &channels[i];
+        }
+    }
+    return NULL;
+}
+
+void DRSCalibration::calibrate_time(int trigger_cell, float* time, int num_samples) const
+{
+    time[0] = 0.0;
+    for(int j=1; j<num_samples; j++) {
+        time[j] = time[j-1] + dt[(j-1+trigger_cell) % DRS_NUM_CELLS];
+    }
+}
+
+void DRSCalibration::calibrate_voltage(const DRSChannelCalibration& channel, int trigger_cell, int first,
+                                       const uint16_t* raw, float* data, int num_samples) const
+{
+    for(int i=0; i<num_samples; i++) {
+        int j = first + i;
+        int cell = (j + trigger_cell) % DRS_NUM_CELLS;
+        float value = static_cast<float>(raw[i]) - channel.offset[cell];
+        value = value / channel.gain[cell];
+        value -= channel.offset2[j];
+        data[i] = value / 65536.0f * 1000.0f + range * 1000.0f;
+    }
+}
+
+bool DRSCalibration::write(FILE* file) const
+{
+    uint16_t version = CALIBRATION_VERSION;
+    uint16_t num_channels = channels.size();
+    bool ok = fwrite(CALIBRATION_MAGIC, 4, 1, file) == 1
+           && fwrite(&version, sizeof(version), 1, file) == 1
+           && fwrite(&num_channels, sizeof(num_channels), 1, file) == 1
+           && fwrite(&range, sizeof(range), 1, file) == 1
+           && fwrite(dt, sizeof(dt), 1, file) == 1;
+    for(size_t i=0; ok && i<channels.size(); i++) {
+        uint16_t board_channel = channels[i].board_channel;
+        ok = fwrite(&board_channel, sizeof(board_channel), 1, file) == 1
+          && fwrite(channels[i].offset, sizeof(channels[i].offset), 1, file) == 1
+          && fwrite(channels[i].gain, sizeof(channels[i].gain), 1, file) == 1
+          && fwrite(channels[i].offset2, sizeof(channels[i].offset2), 1, file) == 1;
+    }
+    return ok;
+}
+
+bool DRSCalibration::read(FILE* file)
+{
+    char magic[4];
+    uint16_t version = 0;
+    uint16_t num_channels = 0;
+    if(fread(magic, 4, 1, file) != 1 || memcmp(magic, CALIBRATION_MAGIC, 4) != 0
+       || fread(&version, sizeof(version), 1, file) != 1 || version != CALIBRATION_VERSION
+       || fread(&num_channels, sizeof(num_channels), 1, file) != 1 || num_channels > 4
+       || fread(&range, sizeof(range), 1, file) != 1
+       || fread(dt, sizeof(dt), 1, file) != 1) {
+        std::cerr << "Invalid or unsupported calibration block" << std::endl;
+        return false;
+    }
+    channels.resize(num_channels);
+    for(size_t i=0; i<channels.size(); i++) {
+        uint16_t board_channel = 0;
+        if(fread(&board_channel, sizeof(board_channel), 1, file) != 1
+           || fread(channels[i].offset, sizeof(channels[i].offset), 1, file) != 1
+           || fread(channels[i].gain, sizeof(channels[i].gain), 1, file) != 1
+           || fread(channels[i].offset2, sizeof(channels[i].offset2), 1, file) != 1) {
+            std::cerr << "Truncated calibration block" << std::endl;
+            return false;
+        }
+        channels[i].board_channel = board_channel;
+    }
+    return true;
+}
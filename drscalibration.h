@@ -0,0 +1,110 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef DRSCALIBRATION_H
+#define DRSCALIBRATION_H
+
+#include "frame.h"
+
+#include <array>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DRS_NUM_CELLS 1024
+
+/**
+ * Voltage calibration tables of one DRS4 Eval board channel
+ */
+struct DRSChannelCalibration {
+    int board_channel;                ///< 0..3 for CH1..CH4
+    uint16_t offset[DRS_NUM_CELLS];   ///< per cell offset in ADC counts
+    float gain[DRS_NUM_CELLS];        ///< per cell gain
+    uint16_t offset2[DRS_NUM_CELLS];  ///< residual offset per readout position
+};
+
+/**
+ * Calibration of a DRS4 Eval board as used by libdrs' GetWave() and GetTime(),
+ * so raw ADC values can be calibrated after the run.
+ *
+ * For readout position j of a frame with trigger cell tc, cell c = (j+tc) % 1024:
+ *
+ *   data[j] = ((raw[j] - offset[c]) / gain[c] - offset2[j]) / 65.536 + 1000*range  (mV)
+ *   time[j] = sum of dt[(k+tc) % 1024] for k < j  (ns)
+ *
+ * Spike removal is not part of GetWave() either and thus not done here.
+ */
+struct DRSCalibration {
+    float range;  ///< center of the input range in V
+    float dt[DRS_NUM_CELLS];
+    std::vector<DRSChannelCalibration> channels;
+
+    DRSCalibration() : range(0.0) {}
+
+    /// Tables of a board channel, NULL if not calibrated
+    const DRSChannelCalibration* channel(int board_channel) const;
+
+    void calibrate_time(int trigger_cell, float* time, int num_samples) const;
+    /// raw and data start at readout position first, see RegionOfInterest
+    void calibrate_voltage(const DRSChannelCalibration& channel, int trigger_cell, int first,
+                           const uint16_t* raw, float* data, int num_samples) const;
+
+    /// Binary representation, as stored in the .cdt header of raw recordings
+    bool write(FILE* file) const;
+    bool read(FILE* file);
+};
+
+/**
+ * Time axes by trigger cell.
+ *
+ * The time axis of a frame only depends on its trigger cell, so there are
+ * at most 1024 different ones. Each is computed once, the first time its
+ * trigger cell shows up, and copied from here afterwards.
+ */
+class TimeAxisCache {
+public:
+    TimeAxisCache() : m_axes(DRS_NUM_CELLS*DRS_NUM_CELLS), m_valid(DRS_NUM_CELLS, false) {}
+
+    /// Axis of trigger_cell, compute(float* time) fills it if not cached yet
+    template<typename Compute>
+    const float* get(int trigger_cell, Compute compute) {
+        float* axis = &m_axes[trigger_cell*DRS_NUM_CELLS];
+        if(!m_valid[trigger_cell]) {
+            compute(axis);
+            m_valid[trigger_cell] = true;
+        }
+        return axis;
+    }
+
+    /// Axis of trigger_cell from the cell widths
+    const float* get(int trigger_cell, const DRSCalibration& calibration) {
+        return get(trigger_cell, [&calibration, trigger_cell](float* time) {
+            calibration.calibrate_time(trigger_cell, time, DRS_NUM_CELLS);
+        });
+    }
+
+private:
+    std::vector<float> m_axes;
+    std::vector<bool> m_valid;
+};
+
+#endif // DRSCALIBRATION_H
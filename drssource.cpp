@@ -0,0 +1,202 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "drssource.h"
+#include "metrics.h"
+#include "runclock.h"
+#include "trace.h"
+
+#include <drs.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+
+DRSSource::DRSSource(DRSBoard* board, const DRSSettings& settings, const std::atomic<bool>& abort)
+: m_board(board), m_settings(settings), m_abort(abort),
+m_wait(settings.wait_strategy),
+m_frames(0), m_transfer_ns(0), m_decode_ns(0)
+{
+    for(size_t i=0; i<settings.ch_config.size() && settings.ch_config[i] != -1; i++) {
+        m_channels.push_back(settings.ch_config[i]);
+    }
+    // CH1..CH4 are the even channels 0, 2, 4, 6 of the chip
+    m_first_transfer_channel = 2 * *std::min_element(m_channels.begin(), m_channels.end());
+    m_last_transfer_channel = 2 * *std::max_element(m_channels.begin(), m_channels.end());
+}
+
+bool DRSSource::init()
+{
+    if(m_board->GetBoardType() != 8) {
+        std::cerr << "DRS4 Eval Board required!" << std::endl;
+        return false;
+    }
+    // basic DRS setup
+    m_board->Init();
+    m_board->SetFrequency(m_settings.sample_rate, true); // sampling freq in GHz
+    m_board->SetInputRange(0);
+
+    if(!m_settings.auto_trigger) {
+        // trigger settings
+        m_board->SetTranspMode(1);
+        m_board->EnableTrigger(1, 0);
+        m_board->SetTriggerSource(1<<m_settings.trigger_ch_num); // CH1
+    //     m_board->SetTriggerDelayNs(int(1024/0.69));
+        m_board->SetTriggerDelayPercent(m_settings.trigger_delay_percent);
+        m_board->SetTriggerLevel(m_settings.trigger_threshold, m_settings.trigger_edge_negative); // (V), pos. edge == false
+    }
+    return true;
+}
+
+bool DRSSource::capture(Frame& frame)
+{
+    m_board->StartDomino();
+    frame.timestamps.armed = RunClock::now();
+    if(m_settings.auto_trigger)
+        m_board->SoftTrigger();
+    DRSBoard* board = m_board;
+    auto wait_start = steady_clock::now();
+    if(!m_wait.wait([board]() { return board->IsBusy(); }, m_abort))
+        return false;
+    frame.timestamps.triggered = RunClock::now();
+    auto transfer_start = steady_clock::now();
+    m_board->TransferWaves(m_first_transfer_channel, m_last_transfer_channel);
+    auto decode_start = steady_clock::now();
+    int64_t trace_decode_start = Trace::enabled()? RunClock::now() : 0;
+    frame.trigger_cell = m_board->GetTriggerCell(0);
+    const RegionOfInterest& roi = m_settings.roi;
+    if(m_settings.read_raw) {
+        for(int ch: m_channels) {
+            m_board->GetRawWave(0, 2*ch, frame.raw[ch]);
+            if(roi.start > 0) {
+                memmove(frame.raw[ch], frame.raw[ch] + roi.start, roi.length*sizeof(uint16_t));
+            }
+        }
+    }
+    if(m_settings.read_calibrated) {
+        int trigger_cell = frame.trigger_cell;
+        const float* time = m_time_axes.get(trigger_cell, [board, trigger_cell](float* axis) {
+            board->GetTime(0, trigger_cell, axis);
+        });
+        memcpy(frame.time, time + roi.start, roi.length*sizeof(float));
+        for(int ch: m_channels) {
+            m_board->GetWave(0, 2*ch, frame.data[ch]);
+            if(roi.start > 0) {
+                memmove(frame.data[ch], frame.data[ch] + roi.start, roi.length*sizeof(float));
+            }
+        }
+    }
+    auto decode_end = steady_clock::now();
+    frame.timestamps.transferred = RunClock::now();
+    m_transfer_ns += duration_cast<nanoseconds>(decode_start - transfer_start).count();
+    m_decode_ns += duration_cast<nanoseconds>(decode_end - decode_start).count();
+    m_frames++;
+    if(m_metrics) {
+        m_metrics->record(MS_TRIGGER_WAIT, transfer_start - wait_start);
+        m_metrics->record(MS_TRANSFER, decode_start - transfer_start);
+        m_metrics->record(MS_DECODE, decode_end - decode_start);
+    }
+    if(Trace::enabled()) {
+        Trace::record("wait_trigger", frame.timestamps.armed, frame.timestamps.triggered);
+        Trace::record("TransferWaves", frame.timestamps.triggered, trace_decode_start);
+        Trace::record("decode", trace_decode_start, frame.timestamps.transferred);
+    }
+    return true;
+}
+
+/**
+ * The voltage calibration tables are protected members of DRSBoard without
+ * getters. Pointers to them may be formed in a derived class, and used on
+ * any board.
+ */
+class DRSCalibrationTables : public DRSBoard {
+public:
+    static void read(DRSBoard* board, int chip_channel, DRSChannelCalibration& channel)
+    {
+        auto cell_offset = &DRSCalibrationTables::fCellOffset;
+        auto cell_gain = &DRSCalibrationTables::fCellGain;
+        auto cell_offset2 = &DRSCalibrationTables::fCellOffset2;
+        for(int cell=0; cell<DRS_NUM_CELLS; cell++) {
+            channel.offset[cell] = (board->*cell_offset)[chip_channel][cell];
+            channel.gain[cell] = (board->*cell_gain)[chip_channel][cell];
+            channel.offset2[cell] = (board->*cell_offset2)[chip_channel][cell];
+        }
+    }
+};
+
+bool DRSSource::cell_widths(float* dt)
+{
+    // the time axis starts at 0 in the trigger cell, so its second entry is
+    // exactly the width of the trigger cell; differences of later entries
+    // would carry the rounding of the sum
+    DRSBoard* board = m_board;
+    for(int cell=0; cell<DRS_NUM_CELLS; cell++) {
+        dt[cell] = m_time_axes.get(cell, [board, cell](float* axis) {
+            board->GetTime(0, cell, axis);
+        })[1];
+    }
+    return true;
+}
+
+bool DRSSource::read_calibration(DRSCalibration& calibration)
+{
+    if(!m_board->IsVoltageCalibrationValid()) {
+        std::cerr << "Board " << m_board->GetBoardSerialNumber() << " has no valid voltage calibration" << std::endl;
+        return false;
+    }
+    calibration.range = m_board->GetInputRange();
+    cell_widths(calibration.dt);
+    calibration.channels.resize(4);
+    for(int ch=0; ch<4; ch++) {
+        calibration.channels[ch].board_channel = ch;
+        // CH1..CH4 are the even channels of chip 0
+        DRSCalibrationTables::read(m_board, 2*ch, calibration.channels[ch]);
+    }
+    return true;
+}
+
+double DRSSource::frequency() const
+{
+    return m_board->GetFrequency();
+}
+
+void DRSSource::print_stats() const
+{
+    if(m_frames == 0) {
+        return;
+    }
+    std::cout << "  readout: " << m_channels.size() << " channel(s), samples " << m_settings.roi.start << ".."
+              << m_settings.roi.start + m_settings.roi.length - 1 << ", transfer of chip channels "
+              << m_first_transfer_channel << ".." << m_last_transfer_channel << " "
+              << m_transfer_ns / 1000.0 / m_frames << " us/frame, decoding "
+              << m_decode_ns / 1000.0 / m_frames << " us/frame" << std::endl;
+}
+
+std::string DRSSource::description() const
+{
+    std::ostringstream ss;
+    ss << "DRS4 Eval board, type " << m_board->GetBoardType()
+       << ", DRS type " << m_board->GetDRSType();
+    return ss.str();
+}
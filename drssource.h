@@ -0,0 +1,94 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef DRSSOURCE_H
+#define DRSSOURCE_H
+
+#include "drscalibration.h"
+#include "framesource.h"
+#include "waitstrategy.h"
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+class DRSBoard;
+
+struct DRSSettings {
+    float sample_rate;
+    bool auto_trigger;
+    int trigger_ch_num;
+    float trigger_delay_percent;
+    float trigger_threshold;
+    bool trigger_edge_negative;
+    std::array<int, 4> ch_config;
+    RegionOfInterest roi;
+    WaitStrategy wait_strategy;
+    bool read_raw;         ///< transfer the uncalibrated ADC values into Frame::raw
+    bool read_calibrated;  ///< fill Frame::time and Frame::data with GetTime() and GetWave()
+};
+
+/**
+ * Frames read out from a DRS4 Evaluation board.
+ *
+ * Only the recorded channels are transferred and decoded. The transfer
+ * covers a contiguous range of chip channels, so e.g. CH1 and CH4 still
+ * transfer CH2 and CH3 as well. The hardware trigger does not need the
+ * trigger channel to be transferred.
+ *
+ * libdrs always transfers and decodes the full domino ring, the region of
+ * interest is moved to the start of the frame arrays afterwards.
+ */
+class DRSSource : public FrameSource {
+public:
+    DRSSource(DRSBoard* board, const DRSSettings& settings, const std::atomic<bool>& abort);
+
+    /// Basic board, sampling and trigger setup
+    bool init();
+    /// Time calibration and voltage calibration of CH1..CH4 as applied by GetTime() and GetWave()
+    bool read_calibration(DRSCalibration& calibration);
+
+    virtual bool capture(Frame& frame);
+    virtual double frequency() const;
+    virtual std::string description() const;
+    virtual bool cell_widths(float* dt);
+    virtual const TriggerWait* trigger_wait() const { return &m_wait; }
+    virtual void print_stats() const;
+
+    DRSBoard* board() const { return m_board; }
+
+private:
+    DRSBoard* m_board;
+    DRSSettings m_settings;
+    const std::atomic<bool>& m_abort;
+    /// recorded board channels, 0..3
+    std::vector<int> m_channels;
+    int m_first_transfer_channel;
+    int m_last_transfer_channel;
+    TriggerWait m_wait;
+    TimeAxisCache m_time_axes;
+    uint64_t m_frames;
+    int64_t m_transfer_ns;
+    int64_t m_decode_ns;
+};
+
+#endif // DRSSOURCE_H
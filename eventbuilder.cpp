@@ -0,0 +1,203 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "eventbuilder.h"
+#include "cellcalibration.h"
+#include "runclock.h"
+#include "trace.h"
+
+#include <iostream>
+#include <limits>
+
+// how long a frame waits for the other boards beyond the coincidence window
+#define EVENT_LATENCY_NS 50000000LL
+
+EventBuilder::EventBuilder(const Settings& settings,
+                           const std::vector<FrameRing*>& inputs,
+                           const std::vector<FrameRing*>& outputs,
+                           const std::atomic<bool>& abort)
+: m_settings(settings), m_inputs(inputs), m_outputs(outputs),
+m_calibrations(inputs.size(), NULL), m_abort(abort), m_max_pending(0),
+m_latest(inputs.size(), std::numeric_limits<int64_t>::min()),
+m_events_accepted(0), m_events_rejected(0), m_frames_accepted(0), m_frames_rejected(0)
+{
+    // keep at least one slot of every input free for its capture loop
+    for(auto input: m_inputs) {
+        m_max_pending += input->capacity() - 1;
+    }
+}
+
+EventBuilder::~EventBuilder()
+{
+    finish();
+}
+
+void EventBuilder::start()
+{
+    m_thread = std::thread(&EventBuilder::run, this);
+}
+
+void EventBuilder::finish()
+{
+    for(auto input: m_inputs) {
+        input->close();
+    }
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+int EventBuilder::count_hits(const Frame& frame) const
+{
+    int hits = 0;
+    bool negative = m_settings.threshold_mv < 0.0;
+    for(size_t col=0; col<4 && m_settings.ch_config[col] != -1; col++) {
+        const float* data = frame.data[m_settings.ch_config[col]];
+        for(int i=0; i<m_settings.frames_per_sample; i++) {
+            if(negative? data[i] < m_settings.threshold_mv : data[i] > m_settings.threshold_mv) {
+                hits++;
+                break;
+            }
+        }
+    }
+    return hits;
+}
+
+bool EventBuilder::collect()
+{
+    bool got_frames = false;
+    for(size_t lane=0; lane<m_inputs.size() && m_pending.size() < m_max_pending; lane++) {
+        Frame* frame;
+        while(m_pending.size() < m_max_pending && (frame = m_inputs[lane]->pop()) != NULL) {
+            if(m_calibrations[lane]) {
+                m_calibrations[lane]->apply(*frame);
+            }
+            Pending pending;
+            pending.frame = frame;
+            pending.lane = lane;
+            pending.hits = count_hits(*frame);
+            int64_t t = frame->timestamps.triggered;
+            m_pending.insert(std::make_pair(t, pending));
+            if(t > m_latest[lane]) {
+                m_latest[lane] = t;
+            }
+            got_frames = true;
+        }
+    }
+    return got_frames;
+}
+
+bool EventBuilder::oldest_event_complete(bool draining) const
+{
+    if(m_pending.empty()) {
+        return false;
+    }
+    if(draining || m_pending.size() >= m_max_pending) {
+        return true;
+    }
+    int64_t window_end = m_pending.begin()->first + m_settings.window_ns;
+    bool all_later = true;
+    for(auto latest: m_latest) {
+        if(latest <= window_end) {
+            all_later = false;
+        }
+    }
+    if(all_later) {
+        return true;
+    }
+    return RunClock::now() > window_end + EVENT_LATENCY_NS;
+}
+
+void EventBuilder::build_event()
+{
+    TraceSpan span("build_event");
+    int64_t window_end = m_pending.begin()->first + m_settings.window_ns;
+    auto end = m_pending.upper_bound(window_end);
+    int hits = 0;
+    uint64_t frames = 0;
+    for(auto it=m_pending.begin(); it!=end; ++it) {
+        hits += it->second.hits;
+        frames++;
+    }
+    bool accept = hits >= m_settings.multiplicity;
+    for(auto it=m_pending.begin(); it!=end; ++it) {
+        Pending& pending = it->second;
+        if(accept) {
+            FrameRing* output = m_outputs[pending.lane];
+            Frame* copy;
+            while(!(copy = output->claim(std::chrono::milliseconds(100))) && !m_abort);
+            if(copy) {
+                copy->assign(*pending.frame);
+                output->publish(copy);
+            }
+        }
+        m_inputs[pending.lane]->release(pending.frame);
+    }
+    m_pending.erase(m_pending.begin(), end);
+    if(accept) {
+        m_events_accepted++;
+        m_frames_accepted += frames;
+    } else {
+        m_events_rejected++;
+        m_frames_rejected += frames;
+    }
+}
+
+void EventBuilder::run()
+{
+    Trace::set_thread_name("event builder");
+    Backoff backoff;
+    for(;;) {
+        bool all_closed = true;
+        for(auto input: m_inputs) {
+            if(!input->closed()) all_closed = false;
+        }
+        bool got_frames = collect();
+        // after all inputs are closed, one more collect() picks up the last frames
+        bool draining = all_closed && !got_frames;
+        bool built = false;
+        while(oldest_event_complete(draining)) {
+            build_event();
+            built = true;
+        }
+        if(draining && m_pending.empty()) {
+            break;
+        }
+        if(got_frames || built) {
+            backoff.reset();
+        } else {
+            backoff.pause();
+        }
+    }
+    for(auto output: m_outputs) {
+        output->close();
+    }
+}
+
+void print_event_builder_stats(const EventBuilder& builder, const nanoseconds& total_time)
+{
+    double seconds = static_cast<double>(total_time.count()) * 1e-9;
+    uint64_t events = builder.events_accepted() + builder.events_rejected();
+    std::cout << "Event builder: " << events << " events, "
+              << builder.events_accepted() << " accepted (" << builder.events_accepted()/seconds << " Hz), "
+              << builder.events_rejected() << " rejected (" << builder.events_rejected()/seconds << " Hz), "
+              << builder.frames_rejected() << " frames discarded" << std::endl;
+}
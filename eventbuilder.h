@@ -0,0 +1,112 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef EVENTBUILDER_H
+#define EVENTBUILDER_H
+
+#include "framering.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+class CellCalibration;
+
+/**
+ * Merges the frames of all boards into events by record time and keeps only
+ * coincident ones.
+ *
+ * A frame contributes one hit per recorded channel crossing the threshold.
+ * Frames within window_ns after the oldest pending frame form one event,
+ * which is accepted if it has at least multiplicity hits. Accepted frames
+ * are copied into the output ring of their board, rejected ones never reach
+ * a DataStream.
+ *
+ * Frames wait in a reorder buffer until every board has delivered a later
+ * frame, or until they are older than window_ns plus a fixed latency, so
+ * quiet boards cannot hold up the others. The buffer is bounded; frames
+ * stay in the slots of the capture rings while they wait.
+ */
+class EventBuilder {
+public:
+    struct Settings {
+        int64_t window_ns;
+        int multiplicity;
+        float threshold_mv;
+        std::array<int, 4> ch_config;
+        int frames_per_sample;  ///< samples per channel, the length of the ROI
+    };
+
+    EventBuilder(const Settings& settings,
+                 const std::vector<FrameRing*>& inputs,
+                 const std::vector<FrameRing*>& outputs,
+                 const std::atomic<bool>& abort);
+    ~EventBuilder();
+
+    /// Calibrate the raw frames of an input before looking at them
+    void set_calibration(size_t lane, CellCalibration* calibration) { m_calibrations[lane] = calibration; }
+
+    void start();
+    /// Close the inputs, build events from all pending frames and close the outputs
+    void finish();
+
+    uint64_t events_accepted() const { return m_events_accepted; }
+    uint64_t events_rejected() const { return m_events_rejected; }
+    uint64_t frames_accepted() const { return m_frames_accepted; }
+    uint64_t frames_rejected() const { return m_frames_rejected; }
+
+private:
+    struct Pending {
+        Frame* frame;
+        size_t lane;
+        int hits;
+    };
+    typedef std::multimap<int64_t, Pending> ReorderBuffer;
+
+    void run();
+    int count_hits(const Frame& frame) const;
+    /// Pop new frames from all inputs, false if there were none
+    bool collect();
+    /// Whether the event starting with the oldest pending frame is complete
+    bool oldest_event_complete(bool draining) const;
+    void build_event();
+
+    Settings m_settings;
+    std::vector<FrameRing*> m_inputs;
+    std::vector<FrameRing*> m_outputs;
+    std::vector<CellCalibration*> m_calibrations;
+    const std::atomic<bool>& m_abort;
+    std::thread m_thread;
+    ReorderBuffer m_pending;
+    size_t m_max_pending;
+    std::vector<int64_t> m_latest;
+    std::atomic<uint64_t> m_events_accepted;
+    std::atomic<uint64_t> m_events_rejected;
+    std::atomic<uint64_t> m_frames_accepted;
+    std::atomic<uint64_t> m_frames_rejected;
+};
+
+void print_event_builder_stats(const EventBuilder& builder, const nanoseconds& total_time);
+
+#endif // EVENTBUILDER_H
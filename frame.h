@@ -0,0 +1,127 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <array>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+
+using std::chrono::nanoseconds;
+
+#define FRAME_MAX_SAMPLES 1024
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Recorded window of the domino ring, in readout positions counted from the
+ * trigger cell. The time axis keeps its origin at the trigger cell, so the
+ * first sample of a window starting later has a time above 0.
+ */
+struct RegionOfInterest {
+    int start;
+    int length;
+
+    RegionOfInterest() : start(0), length(FRAME_MAX_SAMPLES) {}
+    RegionOfInterest(int p_start, int p_length) : start(p_start), length(p_length) {}
+
+    bool full() const { return start == 0 && length == FRAME_MAX_SAMPLES; }
+    bool valid() const { return start >= 0 && length > 0 && start + length <= FRAME_MAX_SAMPLES; }
+};
+
+/// Readout position of the trigger for a trigger delay in percent (-D)
+inline int trigger_position(float trigger_delay_percent)
+{
+    return static_cast<int>(FRAME_MAX_SAMPLES * (100.0 - trigger_delay_percent) / 100.0);
+}
+
+/**
+ * When a frame passed the steps of the acquisition, in ns on the RunClock
+ * since the start of the run. 0 if unknown, e.g. in replayed files written
+ * without timestamps.
+ */
+struct FrameTimestamps {
+    int64_t armed;        ///< the board started sampling and waits for a trigger
+    int64_t triggered;    ///< the capture loop noticed the trigger, the record time
+    int64_t transferred;  ///< waveforms transferred and decoded
+    int64_t written;      ///< handed to the DataStream, kept if a replayed frame has it
+
+    FrameTimestamps() : armed(0), triggered(0), transferred(0), written(0) {}
+    nanoseconds record_time() const { return nanoseconds(triggered); }
+};
+
+/**
+ * One recorded sample of the DRS4 domino ring.
+ *
+ * time and data point into storage owned by the frame. data[i] holds the
+ * waveform of board channel i (CH1..CH4), the way DataStream::write_frame
+ * expects it for multi channel recording; single channel recording uses
+ * data[ch_config[0]]. In raw readout mode raw[i] holds
+ * the uncalibrated ADC values of board channel i instead, and time and data
+ * are not filled.
+ *
+ * All of them hold the region of interest only, its first readout position
+ * at index 0.
+ *
+ * Frames are cache line aligned, so neighbouring slots of a FrameRing never
+ * share a line between the capture and the writer thread.
+ */
+class alignas(CACHE_LINE_SIZE) Frame {
+public:
+    FrameTimestamps timestamps;
+    int board;
+    int trigger_cell;
+    float* time;
+    std::array<float*, 4> data;
+    std::array<uint16_t*, 4> raw;
+
+    Frame()
+    : timestamps(),
+    board(0),
+    trigger_cell(0),
+    time(m_time),
+    data{ {m_data[0], m_data[1], m_data[2], m_data[3]} },
+    raw{ {m_raw[0], m_raw[1], m_raw[2], m_raw[3]} }
+    {
+    }
+
+    /// Copy timestamps, board, trigger cell and waveforms of another frame
+    void assign(const Frame& other) {
+        timestamps = other.timestamps;
+        board = other.board;
+        trigger_cell = other.trigger_cell;
+        memcpy(time, other.time, sizeof(m_time));
+        for(size_t i=0; i<data.size(); i++) {
+            memcpy(data[i], other.data[i], sizeof(m_data[i]));
+            memcpy(raw[i], other.raw[i], sizeof(m_raw[i]));
+        }
+    }
+
+private:
+    Frame(const Frame&);
+    Frame& operator=(const Frame&);
+
+    alignas(CACHE_LINE_SIZE) float m_time[FRAME_MAX_SAMPLES];
+    alignas(CACHE_LINE_SIZE) float m_data[4][FRAME_MAX_SAMPLES];
+    alignas(CACHE_LINE_SIZE) uint16_t m_raw[4][FRAME_MAX_SAMPLES];
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "framering.h"
+
+#include <new>
+#include <thread>
+#include <stdlib.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+
+bool parse_ring_policy(const std::string& name, ring_policy_t& policy)
+{
+    if(name == "block") policy = RP_BLOCK;
+    else if(name == "drop-newest") policy = RP_DROP_NEWEST;
+    else if(name == "drop-oldest") policy = RP_DROP_OLDEST;
+    else return false;
+    return true;
+}
+
+std::string ring_policy_name(ring_policy_t policy)
+{
+    switch(policy) {
+        case RP_BLOCK: return "block";
+        case RP_DROP_NEWEST: return "drop-newest";
+        case RP_DROP_OLDEST: return "drop-oldest";
+    }
+    return "unknown";
+}
+
+void Backoff::pause()
+{
+    if(m_count < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if(m_count < 128) {
+        std::this_thread::yield();
+    } else {
+        usleep(m_count < 256? 50 : 500);
+    }
+    if(m_count < 256) {
+        m_count++;
+    }
+}
+
+template<typename T>
+static T* aligned_array(size_t n)
+{
+    void* mem = 0;
+    if(posix_memalign(&mem, CACHE_LINE_SIZE, n*sizeof(T)) != 0) {
+        throw std::bad_alloc();
+    }
+    T* array = static_cast<T*>(mem);
+    for(size_t i=0; i<n; i++) {
+        new(array + i) T;
+    }
+    return array;
+}
+
+template<typename T>
+static void free_aligned_array(T* array, size_t n)
+{
+    for(size_t i=0; i<n; i++) {
+        array[i].~T();
+    }
+    free(array);
+}
+
+FrameRing::FrameRing(size_t capacity, ring_policy_t policy)
+: m_capacity(1), m_policy(policy), m_frames(0), m_slots(0), m_scratch(0),
+m_write_pos(0), m_dropped_newest(0), m_max_fill(0), m_closed(false),
+m_read_pos(0), m_dropped_oldest(0)
+{
+    while(m_capacity < capacity) {
+        m_capacity <<= 1;
+    }
+    m_mask = m_capacity - 1;
+    m_frames = aligned_array<Frame>(m_capacity);
+    m_slots = aligned_array<Slot>(m_capacity);
+    m_scratch = aligned_array<Frame>(1);
+    for(size_t i=0; i<m_capacity; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_slots[i].position = i;
+    }
+}
+
+FrameRing::~FrameRing()
+{
+    free_aligned_array(m_frames, m_capacity);
+    free_aligned_array(m_slots, m_capacity);
+    free_aligned_array(m_scratch, 1);
+}
+
+size_t FrameRing::fill() const
+{
+    uint64_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+    uint64_t read_pos = m_read_pos.load(std::memory_order_relaxed);
+    return write_pos > read_pos? write_pos - read_pos : 0;
+}
+
+Frame* FrameRing::claim(const std::chrono::milliseconds& timeout)
+{
+    uint64_t pos = m_write_pos.load(std::memory_order_relaxed);
+    Slot& slot = m_slots[pos & m_mask];
+    if(slot.sequence.load(std::memory_order_acquire) == pos) {
+        return &m_frames[pos & m_mask];
+    }
+    if(m_policy == RP_DROP_OLDEST) {
+        // The slot we need is the oldest one, unless the consumer is still reading it.
+        // Then the new frame is dropped instead, the oldest one is kept
+        if(drop_oldest(pos)) {
+            return &m_frames[pos & m_mask];
+        }
+        return m_scratch;
+    }
+    else if(m_policy == RP_DROP_NEWEST) {
+        return m_scratch;
+    }
+    auto deadline = steady_clock::now() + timeout;
+    Backoff backoff;
+    while(slot.sequence.load(std::memory_order_acquire) != pos) {
+        if(closed() || steady_clock::now() > deadline) {
+            return NULL;
+        }
+        backoff.pause();
+    }
+    return &m_frames[pos & m_mask];
+}
+
+void FrameRing::publish(Frame* frame)
+{
+    if(frame == m_scratch) {
+        m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t pos = m_write_pos.load(std::memory_order_relaxed);
+    m_slots[pos & m_mask].sequence.store(pos + 1, std::memory_order_release);
+    m_write_pos.store(pos + 1, std::memory_order_relaxed);
+    size_t current_fill = fill();
+    if(current_fill > m_max_fill.load(std::memory_order_relaxed)) {
+        m_max_fill.store(current_fill, std::memory_order_relaxed);
+    }
+}
+
+void FrameRing::close()
+{
+    m_closed.store(true, std::memory_order_release);
+}
+
+bool FrameRing::drop_oldest(uint64_t write_pos)
+{
+    uint64_t pos = m_read_pos.load(std::memory_order_acquire);
+    Slot& slot = m_slots[pos & m_mask];
+    // only the frame in the slot of write_pos, an older one is still held by the consumer
+    if(pos + m_capacity != write_pos || slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    if(!m_read_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_acq_rel)) {
+        return false;
+    }
+    slot.sequence.store(pos + m_capacity, std::memory_order_release);
+    m_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+Frame* FrameRing::pop()
+{
+    uint64_t pos = m_read_pos.load(std::memory_order_relaxed);
+    for(;;) {
+        Slot& slot = m_slots[pos & m_mask];
+        int64_t diff = static_cast<int64_t>(slot.sequence.load(std::memory_order_acquire) - (pos + 1));
+        if(diff == 0) {
+            if(m_read_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+                slot.position = pos;
+                return &m_frames[pos & m_mask];
+            }
+        } else if(diff < 0) {
+            return NULL;
+        } else {
+            pos = m_read_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void FrameRing::release(Frame* frame)
+{
+    Slot& slot = m_slots[frame - m_frames];
+    slot.sequence.store(slot.position + m_capacity, std::memory_order_release);
+}
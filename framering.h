@@ -0,0 +1,128 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include "frame.h"
+
+#include <atomic>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * What FrameRing::claim() does if all slots are filled
+ */
+enum ring_policy_t {
+    RP_BLOCK,        ///< wait for the consumer to release a slot
+    RP_DROP_NEWEST,  ///< capture into a scratch frame which is discarded on publish
+    RP_DROP_OLDEST   ///< discard the oldest frame not yet taken by the consumer
+};
+
+bool parse_ring_policy(const std::string& name, ring_policy_t& policy);
+std::string ring_policy_name(ring_policy_t policy);
+
+/**
+ * Spin, then yield, then sleep. Used by the ring ends while waiting for each other.
+ */
+class Backoff {
+public:
+    Backoff() : m_count(0) {}
+    void pause();
+    void reset() { m_count = 0; }
+private:
+    unsigned int m_count;
+};
+
+/**
+ * Fixed capacity, lock-free ring of preallocated frames between one producer
+ * (the capture loop) and one consumer (a writer).
+ *
+ * Every slot carries a sequence number telling whether it is free for the
+ * producer or filled for the consumer, so both ends work on the frames in
+ * place without copying and without locks. With RP_DROP_OLDEST the producer
+ * may also take the oldest filled slot away from the consumer, which is
+ * arbitrated by the CAS on the read position.
+ */
+class FrameRing {
+public:
+    /// capacity is rounded up to the next power of two
+    FrameRing(size_t capacity, ring_policy_t policy);
+    ~FrameRing();
+
+    /// Producer: slot for the next frame. NULL only with RP_BLOCK after the
+    /// timeout or if the ring was closed.
+    Frame* claim(const std::chrono::milliseconds& timeout);
+    /// Producer: hand the claimed frame to the consumer
+    void publish(Frame* frame);
+    /// Producer: no more frames will be published
+    void close();
+
+    /// Consumer: oldest filled frame, NULL if the ring is empty
+    Frame* pop();
+    /// Consumer: give a popped frame back to the producer
+    void release(Frame* frame);
+    bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+    size_t capacity() const { return m_capacity; }
+    size_t fill() const;
+    size_t max_fill() const { return m_max_fill.load(std::memory_order_relaxed); }
+    ring_policy_t policy() const { return m_policy; }
+    uint64_t dropped_newest() const { return m_dropped_newest.load(std::memory_order_relaxed); }
+    uint64_t dropped_oldest() const { return m_dropped_oldest.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_newest() + dropped_oldest(); }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<uint64_t> sequence;
+        uint64_t position;
+    };
+
+    FrameRing(const FrameRing&);
+    FrameRing& operator=(const FrameRing&);
+
+    /// Free the slot of write_pos by dropping its filled frame, false if it is not filled
+    bool drop_oldest(uint64_t write_pos);
+
+    size_t m_capacity;
+    size_t m_mask;
+    ring_policy_t m_policy;
+    Frame* m_frames;
+    Slot* m_slots;
+    Frame* m_scratch;
+
+    // producer side, padded so it does not share a cache line with the consumer side
+    char m_pad_producer[CACHE_LINE_SIZE];
+    std::atomic<uint64_t> m_write_pos;
+    // atomic as the counters are read by the metrics exporter while the producer runs
+    std::atomic<uint64_t> m_dropped_newest;
+    std::atomic<size_t> m_max_fill;
+    std::atomic<bool> m_closed;
+
+    // consumer side, also moved by the producer with RP_DROP_OLDEST
+    char m_pad_consumer[CACHE_LINE_SIZE];
+    std::atomic<uint64_t> m_read_pos;
+    std::atomic<uint64_t> m_dropped_oldest;
+    char m_pad_end[CACHE_LINE_SIZE];
+};
+
+#endif // FRAMERING_H
@@ -0,0 +1,44 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "framesource.h"
+
+#include <sstream>
+
+void parse_source_spec(const std::string& spec, std::string& name, std::map<std::string, std::string>& options)
+{
+    size_t colon = spec.find(':');
+    name = spec.substr(0, colon);
+    options.clear();
+    if(colon == std::string::npos) {
+        return;
+    }
+    std::istringstream ss(spec.substr(colon + 1));
+    std::string token;
+    while(std::getline(ss, token, ',')) {
+        size_t eq = token.find('=');
+        if(eq == std::string::npos) {
+            options[token] = "";
+        } else {
+            options[token.substr(0, eq)] = token.substr(eq + 1);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include "frame.h"
+
+#include <map>
+#include <string>
+
+class LaneMetrics;
+class TriggerWait;
+
+/**
+ * Something frames can be captured from: a DRS4 board, a generator, ...
+ *
+ * Like the board readout, a source fills frame.data[i] with board channel i.
+ * Only the recorded channels of the -c setting are filled.
+ */
+class FrameSource {
+public:
+    FrameSource() : m_metrics(NULL) {}
+    virtual ~FrameSource() {}
+
+    /// Wait for the next trigger and fill frame. False if aborted or exhausted
+    virtual bool capture(Frame& frame) = 0;
+    /// Sampling frequency in GSp/s
+    virtual double frequency() const = 0;
+    virtual std::string description() const = 0;
+    /// Width of each domino cell in ns, false if the time axis of a frame
+    /// does not only depend on its trigger cell
+    virtual bool cell_widths(float* dt) { return false; }
+    /// Statistics of waiting for triggers, NULL if the source does not wait
+    virtual const TriggerWait* trigger_wait() const { return NULL; }
+    /// Source specific statistics after the run
+    virtual void print_stats() const {}
+
+    /// Record the durations of waiting, transfer and decoding into metrics
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+
+protected:
+    LaneMetrics* m_metrics;
+};
+
+/**
+ * Split a source specification "name[:key=value,...]" from the command line
+ */
+void parse_source_spec(const std::string& spec, std::string& name, std::map<std::string, std::string>& options);
+
+#endif // FRAMESOURCE_H
@@ -0,0 +1,132 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <limits>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 4
+#define LATENCY_HISTOGRAM_BUCKETS 160
+
+/**
+ * Histogram of durations in nanoseconds with logarithmic buckets.
+ *
+ * Every power of two is split into four buckets, so any recorded value is
+ * off by less than 25% from the upper edge of its bucket, from single
+ * nanoseconds up to about half an hour. Count, sum, minimum and maximum are
+ * exact. Not thread safe, every thread records into its own histogram.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        std::fill(m_buckets, m_buckets + LATENCY_HISTOGRAM_BUCKETS, 0);
+        m_count = 0;
+        m_sum = 0;
+        m_min = std::numeric_limits<uint64_t>::max();
+        m_max = 0;
+    }
+
+    void add(uint64_t value_ns)
+    {
+        m_buckets[bucket_index(value_ns)]++;
+        m_count++;
+        m_sum += value_ns;
+        if(value_ns < m_min) m_min = value_ns;
+        if(value_ns > m_max) m_max = value_ns;
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for(size_t i=0; i<LATENCY_HISTOGRAM_BUCKETS; i++) {
+            m_buckets[i] += other.m_buckets[i];
+        }
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t sum() const { return m_sum; }
+    uint64_t min() const { return m_count? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count? static_cast<double>(m_sum)/m_count : 0.0; }
+
+    /// Upper estimate of the q-quantile (0 <= q <= 1), never above max()
+    uint64_t quantile(double q) const
+    {
+        if(m_count == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * m_count + 0.5);
+        if(rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for(size_t i=0; i<LATENCY_HISTOGRAM_BUCKETS; i++) {
+            seen += m_buckets[i];
+            if(seen >= rank) {
+                return std::min(bucket_upper(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    /// Number of values in bucket i
+    uint64_t bucket(size_t i) const { return m_buckets[i]; }
+
+    /// Largest value counted in bucket i
+    static uint64_t bucket_upper(size_t i)
+    {
+        if(i < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+            return i;
+        }
+        int shift = i/LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+        uint64_t lower = static_cast<uint64_t>(LATENCY_HISTOGRAM_SUB_BUCKETS + i%LATENCY_HISTOGRAM_SUB_BUCKETS) << shift;
+        return lower + (static_cast<uint64_t>(1) << shift) - 1;
+    }
+
+    static size_t bucket_index(uint64_t value)
+    {
+        if(value < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        size_t index = (msb - 1) * LATENCY_HISTOGRAM_SUB_BUCKETS
+                     + ((value >> (msb - 2)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+        return std::min(index, static_cast<size_t>(LATENCY_HISTOGRAM_BUCKETS - 1));
+    }
+
+private:
+    uint64_t m_buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
+
+#endif // HISTOGRAM_H
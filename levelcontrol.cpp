@@ -0,0 +1,123 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "levelcontrol.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+/// Load is judged over this period, a few compressed blocks at usual rates
+#define LC_INTERVAL_MS 250
+/// Ring fill (fraction of the capacity) beyond which the level drops to the minimum
+#define LC_BURST_FILL 0.75
+/// Ring fill or busy fraction of the writer beyond which the level drops by one
+#define LC_HIGH_FILL 0.25
+#define LC_HIGH_BUSY 0.8
+/// Below both the level may go up, after LC_QUIET_INTERVALS intervals in a row
+#define LC_LOW_FILL 0.05
+#define LC_LOW_BUSY 0.4
+#define LC_QUIET_INTERVALS 4
+/// Going beyond the level that was too much the last time needs this many times as long
+#define LC_PROBE_FACTOR 10
+
+LevelController::LevelController(int min_level, int max_level, int initial_level)
+: m_min_level(min_level),
+m_max_level(max_level),
+m_level(std::min(std::max(initial_level, min_level), max_level)),
+m_ceiling(max_level),
+m_frames(0),
+m_level_sum(0.0),
+m_window_start(),
+m_busy(0),
+m_max_fill(0.0),
+m_quiet(0)
+{
+    m_history.push_back({0, m_level});
+}
+
+bool LevelController::update(size_t fill, size_t capacity, nanoseconds write_time, steady_clock::time_point now)
+{
+    m_frames++;
+    m_level_sum += m_level;
+    m_busy += write_time;
+    if(capacity > 0) {
+        m_max_fill = std::max(m_max_fill, static_cast<double>(fill) / capacity);
+    }
+    if(m_window_start == steady_clock::time_point()) {
+        m_window_start = now - write_time;
+    }
+    nanoseconds window = duration_cast<nanoseconds>(now - m_window_start);
+    if(window < std::chrono::milliseconds(LC_INTERVAL_MS)) {
+        return false;
+    }
+    double busy = static_cast<double>(m_busy.count()) / window.count();
+    int level = m_level;
+    if(m_max_fill > LC_HIGH_FILL || busy > LC_HIGH_BUSY) {
+        m_ceiling = std::max(m_level - 1, m_min_level);
+        level = m_max_fill >= LC_BURST_FILL? m_min_level : m_ceiling;
+        m_quiet = 0;
+    } else if(m_max_fill <= LC_LOW_FILL && busy < LC_LOW_BUSY) {
+        int needed = m_level < m_ceiling? LC_QUIET_INTERVALS : LC_QUIET_INTERVALS * LC_PROBE_FACTOR;
+        if(++m_quiet >= needed && m_level < m_max_level) {
+            level = m_level + 1;
+            m_ceiling = std::max(m_ceiling, level);
+            m_quiet = 0;
+        }
+    } else {
+        m_quiet = 0;
+    }
+    m_window_start = now;
+    m_busy = nanoseconds(0);
+    m_max_fill = 0.0;
+    if(level == m_level) {
+        return false;
+    }
+    m_level = level;
+    m_history.push_back({m_frames, m_level});
+    return true;
+}
+
+double LevelController::mean_level() const
+{
+    return m_frames > 0? m_level_sum / m_frames : m_level;
+}
+
+std::string LevelController::history() const
+{
+    std::ostringstream ss;
+    for(size_t i=0; i<m_history.size(); i++) {
+        ss << (i > 0? "," : "") << m_history[i].level << "@" << m_history[i].frame;
+    }
+    return ss.str();
+}
+
+void print_level_control_stats(const LevelController& level_control)
+{
+    std::cout << "  compression level (" << level_control.min_level() << ".." << level_control.max_level() << "): mean "
+              << level_control.mean_level() << ", " << level_control.changes() << " changes, last "
+              << level_control.level() << std::endl;
+}
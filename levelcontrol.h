@@ -0,0 +1,83 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef LEVELCONTROL_H
+#define LEVELCONTROL_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Adapts the compression level to the load of a writer, from "-A MIN,MAX".
+ *
+ * The writer reports every frame with the fill of its input ring and the
+ * time it took to write it. Once per interval the controller looks at the
+ * highest fill and at the fraction of the interval spent writing: under
+ * pressure the level drops by one, on a filling ring straight to the
+ * minimum. Only after several quiet intervals in a row it goes up by one
+ * again. Between the thresholds the level stays, so it does not flip back
+ * and forth at a steady load. A level that was too much is remembered and
+ * only tried again after a much longer quiet period. The new level takes effect with the next
+ * compressed block of the stream.
+ */
+class LevelController {
+public:
+    LevelController(int min_level, int max_level, int initial_level);
+
+    /// After every frame written, true if the level changed
+    bool update(size_t fill, size_t capacity, std::chrono::nanoseconds write_time,
+                std::chrono::steady_clock::time_point now);
+
+    int level() const { return m_level; }
+    int min_level() const { return m_min_level; }
+    int max_level() const { return m_max_level; }
+    uint64_t changes() const { return m_history.size() - 1; }
+    /// Average level over the frames written so far
+    double mean_level() const;
+    /// "LEVEL@FRAME,..." with the first frame written at every level, for the run summary
+    std::string history() const;
+
+private:
+    struct Change {
+        uint64_t frame;
+        int level;
+    };
+
+    int m_min_level;
+    int m_max_level;
+    int m_level;
+    /// highest level the writer kept up with since the last pressure
+    int m_ceiling;
+    uint64_t m_frames;
+    double m_level_sum;
+    std::chrono::steady_clock::time_point m_window_start;
+    std::chrono::nanoseconds m_busy;
+    double m_max_fill;
+    int m_quiet;
+    std::vector<Change> m_history;
+};
+
+void print_level_control_stats(const LevelController& level_control);
+
+#endif // LEVELCONTROL_H
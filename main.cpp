@@ -33,57 +33,83 @@
 #include <vector>
 #include <cassert>
 #include <chrono>
+#include <atomic>
+#include <map>
 #include "textstream.h"
 #include "multifile.h"
 #include "yaml_binary.h"
 #include "binary.h"
+#include "mmapbinary.h"
 #include "detectorcontrol.h"
+#include "frame.h"
+#include "framering.h"
+#include "pipeline.h"
+#include "eventbuilder.h"
+#include "framesource.h"
+#include "drssource.h"
+#include "cellcalibration.h"
+#include "synthsource.h"
+#include "replaysource.h"
+#include "metrics.h"
+#include "runclock.h"
+#include "trace.h"
+#include "levelcontrol.h"
 #ifdef ROOT_FOUND
  #include "rootoutput.h"
 #endif
 
-using std::chrono::high_resolution_clock;
+using std::chrono::steady_clock;
 using std::chrono::duration_cast;
 using std::chrono::time_point;
 using std::chrono::nanoseconds;
 
+// how often the detector control engine asks for the temperature
+#define DETECTOR_POLL_INTERVAL_MS 250
+// how long the run waits for a lost detector control connection to come back,
+// covers the longest reconnect backoff and a request timeout with room to spare
+#define DETECTOR_RECONNECT_GRACE_MS 15000
+
 enum output_format_t {
     OF_MULTIFILE,
     OF_MULTIFILE_BIN,
     OF_TEXTSTREAM,
     OF_BINARY,
+    OF_BINARY_MMAP,
     OF_YAML_BINARY,
     OF_ROOT
 };
 
-DRSBoard* board;
-
 bool verbose = true;
-bool abort_measurement = false;
+std::atomic<bool> abort_measurement(false);
 bool auto_trigger = false;
 
-struct sample
-{
-    float time[1024];
-    float data[8][1024];
-};
-
-void captureSample() {
-    board->StartDomino();
-    if(auto_trigger)
-        board->SoftTrigger();
-    while(board->IsBusy() && !abort_measurement);
-    board->TransferWaves();
-}
-
-void getSample(sample& s) {
-    board->StartDomino();
-    while(board->IsBusy());
-    board->TransferWaves();
-    board->GetTime(0, board->GetTriggerCell(0), s.time);
-    for(int i=0; i<8; i++) {
-        board->GetWave(0, i, s.data[i]);
+DataStream* make_datastream(output_format_t output_format, bool compress_data, bool& binary_output) {
+    if(output_format == OF_MULTIFILE) {
+        binary_output = false;
+        return new MultiFileStream;
+    } else if(output_format == OF_MULTIFILE_BIN) {
+        binary_output = true;
+        return new MultiFileStream;
+    } else if(output_format == OF_BINARY) {
+        binary_output = true;
+        return new BinaryStream;
+    } else if(output_format == OF_BINARY_MMAP) {
+        binary_output = true;
+        return new MappedBinaryStream;
+    } else if(output_format == OF_YAML_BINARY) {
+        binary_output = true;
+        return new YAMLBinaryStream;
+    } else if(output_format == OF_TEXTSTREAM) {
+        binary_output = compress_data;
+        return new TextStream;
+#ifdef ROOT_FOUND
+    } else if(output_format == OF_ROOT) {
+        return new RootOutput;
+//     } else if(output_format == OF_ROOT_TREE) {
+//         return new RootTree;
+#endif
     }
+    return NULL;
 }
 
 void terminate(int signum) {
@@ -101,9 +127,16 @@ int main(int argc, char **argv) {
 //     bool auto_trigger = false;
     bool compress_data = false;
     int compression_level = 9;
+    int compression_threads = 1;
+    bool compression_level_set = false;
+    CodecSettings codec;
+    bool adaptive_level = false;
+    int adaptive_min_level = 1;
+    int adaptive_max_level = 9;
+    bool output_set = false;
+    OutputSettings output_settings;
     float trigger_delay_percent = 100;
     vector<string> user_header;
-    bool do_multichannel_recording = false;
     std::array<int, 4> ch_num{ { 0, -1, -1, -1} };
     int trigger_ch_num = 0;
     float T_soll = 0;
@@ -112,7 +145,30 @@ int main(int argc, char **argv) {
     bool trigger_edge_negative = true;
     bool use_control = false;
     string unix_socket("/tmp/detector_control.unix");
-    while((optchar = getopt(argc, argv, "bBd:p:n:ho:f:F:PCH:l:aT:D:Us:t:c:v")) != -1) {
+    unsigned int pipeline_depth = 0;
+    ring_policy_t ring_policy = RP_BLOCK;
+    std::string source_spec("drs");
+    std::vector<int> board_indices(1, 0);
+    bool all_boards = false;
+    bool use_event_builder = false;
+    EventBuilder::Settings event_settings;
+    event_settings.window_ns = 0;
+    event_settings.multiplicity = 1;
+    event_settings.threshold_mv = 0.0;
+    bool event_threshold_set = false;
+    WaitStrategy wait_strategy;
+    bool raw_readout = false;
+    bool cell_time_axis = false;
+    bool host_calibration = false;
+    calibration_kernel_t calibration_kernel = CK_AUTO;
+    bool verify_calibration = false;
+    bool roi_set = false;
+    int roi_offset = 0;
+    int roi_length = FRAME_MAX_SAMPLES;
+    bool use_metrics = false;
+    MetricsSettings metrics_settings;
+    std::string trace_file;
+    while((optchar = getopt(argc, argv, "bB:d:p:n:ho:f:F:PCH:l:j:z:A:I:aT:D:U:s:t:c:vQ:S:E:i:rxG:R:M:X:")) != -1) {
         if(optchar == '?') return 1;
         else if(optchar == 'h') {
             std::cout << "get_data - DRS4 acquisition " << VERSION_STRING << "\n\n"
@@ -125,23 +181,99 @@ int main(int argc, char **argv) {
                       << " -t TrigTrheshV   Set the trigger threshold in Volts. Default = -0.05V\n"
                       << " -P               Trigger on positive edge [default NEGATIVE]\n"
                       << " -D delay         Trigger Delay in percent\n"
+                      << " -R OFFSET,LENGTH Region of interest: only record LENGTH samples, starting OFFSET\n"
+                      << "                  samples (may be negative) after the trigger position set by -D\n"
                       << " -H user_header   Add a line to the user header\n"
                       << " -f FORMAT        Set the format of the recorded data.\n"
-                      << "                  FORMAT is one of MULTIFILE, MULTIFILE_BIN, TEXT, BIN, YAML or ROOT.\n"
+                      << "                  FORMAT is one of MULTIFILE, MULTIFILE_BIN, TEXT, BIN, BIN_MMAP,\n"
+                      << "                  YAML or ROOT. BIN writes checksummed chunks of frames, after a\n"
+                      << "                  crash the file can still be replayed up to its last chunk.\n"
+                      << "                  BIN_MMAP writes version 1 BIN files, frames back to back, through\n"
+                      << "                  a memory mapping, single channel, without pipelined mode straight\n"
+                      << "                  from the readout into the file. Of -I only fsync= applies to it\n"
                       << " -d               Output directory for MULTIFILE output (will create one file per frame!)\n"
                       << " -o               Name of the output file(s). The correct file extension will be\n"
                       << "                  appended automaticaly, so there is no need to specify it. If the\n"
                       << "                  wrong extension is specified, the correct one is appended, too!\n"
+                      << " -r               Raw readout: record the uncalibrated 16 bit ADC values and the\n"
+                      << "                  trigger cell, with the board calibration stored once in the\n"
+                      << "                  header (BIN format only). Replaying the file applies it.\n"
+                      << " -G KERNEL[,verify]\n"
+                      << "                  Read raw ADC values and calibrate them in get_data instead of\n"
+                      << "                  libdrs, in the writer thread if pipelined. KERNEL is auto, avx2,\n"
+                      << "                  sse or scalar. With verify, frames are calibrated by libdrs as\n"
+                      << "                  well and the results compared\n"
+                      << " -x               Write the trigger cell instead of the time axis with every\n"
+                      << "                  frame and the cell widths once per file (BIN and YAML formats)\n"
                       << " -C               Enable zlib compression (only works with single text file).\n"
 //                       << " -k COMMENT_VARS Add commentary variables to output file (single-file ASCII only)
-                      << " -l LVL           Set compression level (default 9). Only used if -c is set\n"
+                      << " -l LVL           Set compression level (default 9 with -C, the codec default with -z)\n"
+                      << " -j THREADS       Compress with THREADS threads in parallel (default 1), in blocks\n"
+                      << "                  of 128 kB. The output is a single gzip stream. Only used with -C\n"
+                      << " -z CODEC[:shuffle]\n"
+                      << "                  Compress BIN and YAML frame data in independent 256 kB blocks with\n"
+                      << "                  zlib"
+#ifdef HAVE_LZ4
+                      << ", lz4"
+#endif
+#ifdef HAVE_ZSTD
+                      << ", zstd"
+#endif
+                      << ", at the -l level if given. shuffle groups the bytes of the\n"
+                      << "                  samples by significance first, which usually compresses better\n"
+                      << " -A MIN,MAX       Adapt the compression level (-C or -z) between MIN and MAX to the\n"
+                      << "                  load of the writer: lower while the pipeline buffer fills or writing\n"
+                      << "                  takes most of the time, higher again once it keeps up. Starts at\n"
+                      << "                  the -l level, or MAX. The levels used go into the run summary\n"
 //                       << " -v               Verbose output\n"
                       << " -F f_SAMPLE      Sampling frequency in GSp/s, range ~0.68-5, default 0.68GSp/s\n"
                       << " -U socket        UNIX domain socket for detector control.\n"
                       << "                  Default: /tmp/detector_control.unix\n"
+                      << " -p DEPTH         Pipelined mode: write frames in a separate thread, buffering\n"
+                      << "                  up to DEPTH frames between readout and writer (default off)\n"
+                      << " -Q POLICY        What to do if the pipeline buffer is full: block (default),\n"
+                      << "                  drop-newest or drop-oldest. Dropped frames are counted in the\n"
+                      << "                  run summary of the output file\n"
                       << " -s T_soll        Enable temperature stabilized measurement.\n"
                       << "                  Value in Kelvin if suffixed by K, other wise\n"
                       << "                  it is interpreted as degree Celsius\n"
+                      << " -B all|N1[,N2,...] Read out all or the listed DRS boards (default: board 0),\n"
+                      << "                  each from its own thread into its own output file\n"
+                      << "                  NAME_board<N>. Implies pipelined mode.\n"
+                      << " -E WINDOW,MULT[,THRESH]\n"
+                      << "                  Software coincidence: only record events with at least MULT\n"
+                      << "                  channels (of all boards) crossing THRESH Volts (default: the\n"
+                      << "                  trigger threshold) within WINDOW ns. Implies pipelined mode.\n"
+                      << " -i WAIT          How to wait for triggers: spin (default, lowest latency, one\n"
+                      << "                  core per board), yield (spin shortly, then yield the core) or\n"
+                      << "                  sleep[:MAX_US] (sleep 1, 2, 4, ... up to MAX_US microseconds\n"
+                      << "                  between polls, default 1000). Latency and CPU use are reported\n"
+                      << " -I BACKEND[,direct][,fsync=POLICY][,buffer=MB]\n"
+                      << "                  How TEXT, BIN and YAML files are written: stdio (default, one\n"
+                      << "                  write per frame), thread (4 buffers of MB megabytes, default 4,\n"
+                      << "                  written by a thread of their own)"
+#ifdef HAVE_IO_URING
+                      << " or uring (the same through io_uring)"
+#endif
+                      << ".\n"
+                      << "                  Files are preallocated ahead of the writes. direct bypasses the\n"
+                      << "                  page cache (O_DIRECT). POLICY is none (default), close or SECONDS\n"
+                      << "                  between fdatasync() calls\n"
+                      << " -S SOURCE        Where frames come from: 'drs' (default) for the DRS4 board or\n"
+                      << "                  'synth[:key=value,...]' for generated pulses without hardware.\n"
+                      << "                  synth options: rate (Hz, 0 = as fast as possible), amplitude (mV),\n"
+                      << "                  noise (mV RMS), jitter (cells), rise/fall (ns), channels, seed\n"
+                      << "                  'replay:file=PATH[,pace=realtime][,loop=1][,start=N]' reads frames\n"
+                      << "                  back from a .cdt, .ybin, .csv, .csv.gz or .root file, e.g. to convert\n"
+                      << "                  or to reproduce the load of a recording, from frame N on (default 0)\n"
+                      << " -M file=PATH,socket=PATH[,interval=SECONDS]\n"
+                      << "                  Export live metrics in the Prometheus text format: stage latency\n"
+                      << "                  histograms, frame and byte counters, dead time and queue depths.\n"
+                      << "                  The file is rewritten every interval (default 10s), the UNIX\n"
+                      << "                  socket answers every connection. Either one may be left out\n"
+                      << " -X FILE          Trace capture, transfer, calibration, writing and detector control\n"
+                      << "                  of every frame and write the spans to FILE in the Chrome trace\n"
+                      << "                  format, for chrome://tracing or ui.perfetto.dev\n"
                       << " -v               Show version information\n"
 #ifndef ROOT_FOUND
                       << "\nThis version of get_data was compiled without ROOT support!\n"
@@ -159,6 +291,7 @@ int main(int argc, char **argv) {
             else if(format_str == "MULTIFILE_BIN") output_format = OF_MULTIFILE_BIN;
             else if(format_str == "TEXT") output_format = OF_TEXTSTREAM;
             else if(format_str == "BIN") output_format = OF_BINARY;
+            else if(format_str == "BIN_MMAP") output_format = OF_BINARY_MMAP;
             else if(format_str == "YAML") output_format = OF_YAML_BINARY;
             else if(format_str == "ROOT") output_format = OF_ROOT;
             else {
@@ -176,7 +309,64 @@ int main(int argc, char **argv) {
         }
         else if(optchar == 'a') auto_trigger = true;
         else if(optchar == 'C') compress_data = true;
-        else if(optchar == 'l') compression_level = atoi(optarg);
+        else if(optchar == 'r') raw_readout = true;
+        else if(optchar == 'x') cell_time_axis = true;
+        else if(optchar == 'G') {
+            std::vector<std::string> tokens;
+            boost::algorithm::split(tokens, optarg, boost::algorithm::is_any_of(","));
+            verify_calibration = tokens.size() == 2 && tokens[1] == "verify";
+            if(tokens.size() > 2 || (tokens.size() == 2 && !verify_calibration)
+               || !parse_calibration_kernel(tokens[0], calibration_kernel)) {
+                std::cerr << argv[0] << ": Cannot parse calibration setting '" << optarg
+                          << "', must be auto, avx2, sse or scalar, optionally followed by ',verify'." << std::endl;
+                return 1;
+            }
+            host_calibration = true;
+        }
+        else if(optchar == 'l') {
+            compression_level = atoi(optarg);
+            compression_level_set = true;
+        }
+        else if(optchar == 'z') {
+            if(!parse_codec_spec(optarg, codec)) {
+                std::cerr << argv[0] << ": Unknown codec '" << optarg << "', must be zlib"
+#ifdef HAVE_LZ4
+                          << ", lz4"
+#endif
+#ifdef HAVE_ZSTD
+                          << ", zstd"
+#endif
+                          << ", optionally followed by ':shuffle'." << std::endl;
+                return 1;
+            }
+        }
+        else if(optchar == 'A') {
+            std::vector<std::string> tokens;
+            boost::algorithm::split(tokens, optarg, boost::algorithm::is_any_of(","));
+            try {
+                if(tokens.size() != 2) {
+                    throw boost::bad_lexical_cast();
+                }
+                adaptive_min_level = boost::lexical_cast<int>(tokens[0]);
+                adaptive_max_level = boost::lexical_cast<int>(tokens[1]);
+            } catch(boost::bad_lexical_cast const& e) {
+                std::cerr << argv[0] << ": Cannot parse compression level range '" << optarg
+                          << "', must be MIN,MAX." << std::endl;
+                return 1;
+            }
+            adaptive_level = true;
+        }
+        else if(optchar == 'j') {
+            try {
+                compression_threads = boost::lexical_cast<int>(optarg);
+            } catch(boost::bad_lexical_cast const& e) {
+                compression_threads = 0;
+            }
+            if(compression_threads < 1) {
+                std::cerr << argv[0] << ": The number of compression threads must be at least 1" << std::endl;
+                return 1;
+            }
+        }
 	else if(optchar == 't') trigger_threshold = atof(optarg);
         else if(optchar == 'n') {
             istringstream in(optarg);
@@ -232,6 +422,105 @@ int main(int argc, char **argv) {
         else if(optchar == 'U') {
             unix_socket = optarg;
         }
+        else if(optchar == 'p') {
+            try {
+                pipeline_depth = boost::lexical_cast<unsigned int>(optarg);
+            } catch(boost::bad_lexical_cast const& e) {
+                std::cerr << argv[0] << ": Cannot parse pipeline depth '" << optarg << "', must be a positive integer." << std::endl;
+                return 1;
+            }
+        }
+        else if(optchar == 'S') {
+            source_spec = optarg;
+        }
+        else if(optchar == 'E') {
+            std::vector<std::string> tokens;
+            boost::algorithm::split(tokens, optarg, boost::algorithm::is_any_of(","));
+            try {
+                if(tokens.size() < 2 || tokens.size() > 3) {
+                    throw boost::bad_lexical_cast();
+                }
+                event_settings.window_ns = boost::lexical_cast<int64_t>(tokens[0]);
+                event_settings.multiplicity = boost::lexical_cast<int>(tokens[1]);
+                if(tokens.size() == 3) {
+                    event_settings.threshold_mv = boost::lexical_cast<float>(tokens[2]) * 1000.0;
+                    event_threshold_set = true;
+                }
+            } catch(boost::bad_lexical_cast const& e) {
+                std::cerr << argv[0] << ": Cannot parse coincidence setting '" << optarg
+                          << "', must be WINDOW_NS,MULTIPLICITY[,THRESHOLD_V]." << std::endl;
+                return 1;
+            }
+            use_event_builder = true;
+        }
+        else if(optchar == 'R') {
+            std::vector<std::string> tokens;
+            boost::algorithm::split(tokens, optarg, boost::algorithm::is_any_of(","));
+            try {
+                if(tokens.size() != 2) {
+                    throw boost::bad_lexical_cast();
+                }
+                roi_offset = boost::lexical_cast<int>(tokens[0]);
+                roi_length = boost::lexical_cast<int>(tokens[1]);
+            } catch(boost::bad_lexical_cast const& e) {
+                std::cerr << argv[0] << ": Cannot parse region of interest '" << optarg
+                          << "', must be OFFSET,LENGTH in samples." << std::endl;
+                return 1;
+            }
+            roi_set = true;
+        }
+        else if(optchar == 'M') {
+            if(!parse_metrics_spec(optarg, metrics_settings)) {
+                std::cerr << argv[0] << ": Cannot parse metrics setting '" << optarg
+                          << "', must be file=PATH,socket=PATH[,interval=SECONDS] with a file or a socket." << std::endl;
+                return 1;
+            }
+            use_metrics = true;
+        }
+        else if(optchar == 'X') {
+            trace_file = optarg;
+        }
+        else if(optchar == 'i') {
+            if(!parse_wait_strategy(optarg, wait_strategy)) {
+                std::cerr << argv[0] << ": Unknown wait strategy '" << optarg
+                          << "', must be spin, yield or sleep[:MAX_US]." << std::endl;
+                return 1;
+            }
+        }
+        else if(optchar == 'I') {
+            if(!parse_output_spec(optarg, output_settings)) {
+                std::cerr << argv[0] << ": Cannot parse output setting '" << optarg << "', must be stdio, thread"
+#ifdef HAVE_IO_URING
+                          << " or uring"
+#endif
+                          << ", optionally followed by ',direct', ',fsync=none|close|SECONDS' and ',buffer=MB'."
+                          << std::endl;
+                return 1;
+            }
+            output_set = true;
+        }
+        else if(optchar == 'B') {
+            board_indices.clear();
+            all_boards = strcmp(optarg, "all") == 0;
+            std::istringstream ss(optarg);
+            std::string index_string;
+            while(!all_boards && std::getline(ss, index_string, ',')) {
+                try {
+                    board_indices.push_back(boost::lexical_cast<int>(index_string));
+                } catch(boost::bad_lexical_cast const& e) {
+                    std::cerr << argv[0] << ": Cannot parse board list '" << optarg
+                              << "', must be 'all' or comma separated board numbers." << std::endl;
+                    return 1;
+                }
+            }
+        }
+        else if(optchar == 'Q') {
+            if(!parse_ring_policy(optarg, ring_policy)) {
+                std::cerr << argv[0] << ": Unknown buffer policy '" << optarg
+                          << "', must be one of block, drop-newest or drop-oldest." << std::endl;
+                return 1;
+            }
+        }
         else if(optchar == 'c') {
             std::istringstream ss(optarg);
             std::string ch_string;
@@ -252,7 +541,6 @@ int main(int argc, char **argv) {
                               << std::endl;
                     return -1;
                 }
-                if(i > 0) do_multichannel_recording = true;
                 ch_num[i]--;
             }
         }
@@ -264,6 +552,28 @@ int main(int argc, char **argv) {
         return 1;
     }
 #endif
+    if(raw_readout && output_format != OF_BINARY) {
+        std::cerr << argv[0] << ": Raw readout is only supported by the BIN format" << std::endl;
+        return 1;
+    }
+    if(raw_readout && host_calibration) {
+        std::cerr << argv[0] << ": Raw readout records uncalibrated data, it cannot be combined with -G" << std::endl;
+        return 1;
+    }
+    RegionOfInterest roi;
+    if(roi_set) {
+        roi = RegionOfInterest(trigger_position(trigger_delay_percent) + roi_offset, roi_length);
+        if(!roi.valid()) {
+            std::cerr << argv[0] << ": The region of interest, samples " << roi.start << ".."
+                      << roi.start + roi.length - 1 << ", is not within the " << FRAME_MAX_SAMPLES
+                      << " samples of a frame" << std::endl;
+            return 1;
+        }
+    }
+    if(raw_readout && use_event_builder) {
+        std::cerr << argv[0] << ": Software coincidence needs calibrated data, it cannot be used with raw readout" << std::endl;
+        return 1;
+    }
 
     DetectorControl* control = NULL;
     if(use_control) {
@@ -273,45 +583,133 @@ int main(int argc, char **argv) {
             return -1;
         control->setTsoll(T_soll);
         sleep(2);
-        control->disconnect_control();
+        // the connection stays open, the capture loop only reads the latest state
+        if(!control->start_polling(std::chrono::milliseconds(DETECTOR_POLL_INTERVAL_MS)))
+            return -1;
     }
 
+    if(adaptive_level) {
+        if(!compress_data && codec.codec == CODEC_NONE) {
+            std::cerr << argv[0] << ": Adapting the compression level needs compressed output, -C or -z" << std::endl;
+            return 1;
+        }
+        if(adaptive_min_level < 0 || adaptive_min_level > adaptive_max_level
+           || adaptive_max_level > codec_max_level(codec.codec)) {
+            std::cerr << argv[0] << ": The compression level range must be within 0.."
+                      << codec_max_level(codec.codec) << std::endl;
+            return 1;
+        }
+        compression_level = std::min(std::max(compression_level_set? compression_level : adaptive_max_level,
+                                              adaptive_min_level), adaptive_max_level);
+        compression_level_set = true;
+    }
+    if(compression_level_set)
+        codec.level = compression_level;
     if(!compress_data)
         compression_level = -1;
 
-    DRS* drs = new DRS();
-    if(drs->GetNumberOfBoards() > 0 && verbose)
-        std::cout << "DRS Eval boards found, using first one" << std::endl;
-    else if(drs->GetNumberOfBoards() == 0) {
-        std::cerr << "No DRS Eval board can be accessed, aborting!" << std::endl;
+    std::string source_name;
+    std::map<std::string, std::string> source_options;
+    parse_source_spec(source_spec, source_name, source_options);
+    DRS* drs = NULL;
+    std::vector<std::unique_ptr<FrameSource> > sources;
+    if(source_name == "drs") {
+        drs = new DRS();
+        if(drs->GetNumberOfBoards() == 0) {
+            std::cerr << "No DRS Eval board can be accessed, aborting!" << std::endl;
+            return 1;
+        }
+        if(all_boards) {
+            board_indices.clear();
+            for(int i=0; i<drs->GetNumberOfBoards(); i++) {
+                board_indices.push_back(i);
+            }
+        }
+        if(verbose) {
+            std::cout << drs->GetNumberOfBoards() << " DRS Eval board(s) found, using";
+            for(auto index: board_indices) std::cout << " " << index;
+            std::cout << std::endl;
+        }
+        DRSSettings settings;
+        settings.sample_rate = sample_rate;
+        settings.auto_trigger = auto_trigger;
+        settings.trigger_ch_num = trigger_ch_num;
+        settings.trigger_delay_percent = trigger_delay_percent;
+        settings.trigger_threshold = trigger_threshold;
+        settings.trigger_edge_negative = trigger_edge_negative;
+        settings.ch_config = ch_num;
+        settings.roi = roi;
+        settings.wait_strategy = wait_strategy;
+        settings.read_raw = raw_readout || host_calibration;
+        settings.read_calibrated = !raw_readout && (!host_calibration || verify_calibration);
+        for(auto index: board_indices) {
+            if(index >= drs->GetNumberOfBoards()) {
+                std::cerr << argv[0] << ": There is no board " << index << "!" << std::endl;
+                return 1;
+            }
+            DRSSource* drs_source = new DRSSource(drs->GetBoard(index), settings, abort_measurement);
+            sources.emplace_back(drs_source);
+            DRSBoard* b = drs_source->board();
+            std::cout << "Board " << index << ": serial " << b->GetBoardSerialNumber() << std::endl;
+            std::cout << "Board type " << b->GetBoardType() << std::endl;
+            std::cout << "DRS type " << b->GetDRSType() << std::endl;
+            if(!drs_source->init()) {
+                return 1;
+            }
+            if(!auto_trigger && verbose) {
+                std::cout << "Trigger delay " << b->GetTriggerDelayNs() << "ns, " << b->GetTriggerDelay() << "%" << std::endl;
+            }
+        }
+    } else if(board_indices.size() > 1) {
+        std::cerr << argv[0] << ": Multiple boards need the drs frame source" << std::endl;
         return 1;
-    }
-    DRSBoard* b = board = drs->GetBoard(0);
-    std::cout << "Board type " << b->GetBoardType() << std::endl;
-    std::cout << "DRS type " << b->GetDRSType() << std::endl;
-    if(b->GetBoardType() != 8) {
-        std::cerr << "DRS4 Eval Board required!" << std::endl;
+    } else if(raw_readout || host_calibration) {
+        std::cerr << argv[0] << ": Raw readout needs the drs frame source" << std::endl;
         return 1;
+    } else if(source_name == "synth") {
+        SynthSource* synth_source = new SynthSource(sample_rate, trigger_delay_percent, ch_num, roi,
+                                                     wait_strategy, abort_measurement);
+        sources.emplace_back(synth_source);
+        if(!synth_source->configure(source_options)) {
+            return 1;
+        }
+        if(verbose) std::cout << "Using " << synth_source->description() << std::endl;
+    } else if(source_name == "replay") {
+        if(roi_set) {
+            std::cerr << argv[0] << ": Replayed frames keep the region of interest of the recording" << std::endl;
+            return 1;
+        }
+        ReplaySource* replay_source = new ReplaySource(ch_num, abort_measurement);
+        sources.emplace_back(replay_source);
+        if(!replay_source->configure(source_options)) {
+            return 1;
+        }
+        roi = replay_source->region_of_interest();
+        if(verbose) std::cout << "Using " << replay_source->description() << std::endl;
+    } else {
+        std::cerr << argv[0] << ": Unknown frame source '" << source_name << "'" << std::endl;
+        return 1;
+    }
+    if(!event_threshold_set) {
+        event_settings.threshold_mv = trigger_threshold * 1000.0;
+    }
+    event_settings.ch_config = ch_num;
+    event_settings.frames_per_sample = roi.length;
+    bool multi_board = sources.size() > 1;
+    if((multi_board || use_event_builder) && pipeline_depth == 0) {
+        pipeline_depth = 64;
     }
-    // basic DRS setup
-    b->Init();
-    b->SetFrequency(sample_rate, true); // sampling freq in GHz
-    b->SetInputRange(0);
 
-    if(!auto_trigger) {
-        // trigger settings
-        b->SetTranspMode(1);
-        b->EnableTrigger(1, 0);
-        b->SetTriggerSource(1<<trigger_ch_num); // CH1
-    //     b->SetTriggerDelayNs(int(1024/0.69));
-        b->SetTriggerDelayPercent(trigger_delay_percent);
-        if(verbose) {
-            std::cout << "Selected channels: column 1: CH " << ch_num[0] + 1;
-            for(size_t i=1; i<4; i++) {
-                if(ch_num[i] != -1) std::cout << "\n                   column " << i+1 << ": CH " << ch_num[i] + 1;
-            }
-            std::cout << std::endl;
-            std::cout << "Trigger delay " << b->GetTriggerDelayNs() << "ns, " << b->GetTriggerDelay() << "%" << std::endl;
+    if(verbose) {
+        std::cout << "Selected channels: column 1: CH " << ch_num[0] + 1;
+        for(size_t i=1; i<4; i++) {
+            if(ch_num[i] != -1) std::cout << "\n                   column " << i+1 << ": CH " << ch_num[i] + 1;
+        }
+        std::cout << std::endl;
+        if(!roi.full()) {
+            std::cout << "Region of interest: samples " << roi.start << ".." << roi.start + roi.length - 1 << std::endl;
+        }
+        if(!auto_trigger) {
             std::cout << "Trigger threshold " << trigger_threshold << " V, "
                       << (trigger_edge_negative? "negative" : "positive")
                       << " polarity" << endl;
@@ -320,44 +718,130 @@ int main(int argc, char **argv) {
             else
                 cout << "Trigger source: Channel " << trigger_ch_num+1 << endl;
         }
-        b->SetTriggerLevel(trigger_threshold, trigger_edge_negative); // (V), pos. edge == false
     }
 
-    std::unique_ptr<DataStream> datastream;
-    bool binary_output = true;
-    if(output_format == OF_MULTIFILE) {
-        binary_output = false;
-        datastream.reset(new MultiFileStream);
-    } else if(output_format == OF_MULTIFILE_BIN) {
-        binary_output = true;
-        datastream.reset(new MultiFileStream);
-    } else if(output_format == OF_BINARY) {
-        binary_output = true;
-        datastream.reset(new BinaryStream);
-    } else if(output_format == OF_YAML_BINARY) {
-        binary_output = true;
-        datastream.reset(new YAMLBinaryStream);
-    } else if(output_format == OF_TEXTSTREAM) {
-        binary_output = compress_data;
-        datastream.reset(new TextStream);
-#ifdef ROOT_FOUND
-    } else if(output_format == OF_ROOT) {
-        datastream.reset(new RootOutput);
-//     } else if(output_format == OF_ROOT_TREE) {
-//         datastream.reset(new RootTree);
-#endif
-    } else {
-        std::cerr << argv[0] << ": output format not implemented!" << std::endl;
-        return 1;
+    std::vector<std::unique_ptr<CellCalibration> > calibrations;
+    for(size_t lane=0; host_calibration && lane<sources.size(); lane++) {
+        DRSCalibration calibration;
+        if(!static_cast<DRSSource*>(sources[lane].get())->read_calibration(calibration)) {
+            return 1;
+        }
+        calibrations.emplace_back(new CellCalibration(calibration, ch_num, roi, calibration_kernel, verify_calibration));
+        if(!calibrations[lane]->valid()) {
+            return 1;
+        }
+        if(verbose && lane == 0) {
+            std::cout << "Calibration in get_data with the "
+                      << calibration_kernel_name(calibrations[lane]->kernel()) << " kernel"
+                      << (verify_calibration? ", verified against libdrs" : "") << std::endl;
+        }
+    }
+
+    // one output per board, file names get a _board<N> suffix with several boards
+    std::vector<std::unique_ptr<DataStream> > datastreams;
+    std::vector<std::unique_ptr<LevelController> > level_controls;
+    std::string base_name = output_file;
+    if(multi_board && base_name.empty()) {
+        char default_filename[50];
+        time_t now = time(0);
+        strftime(default_filename, sizeof(default_filename)-1, "%Y-%m-%d_%H-%M-%S", gmtime(&now));
+        base_name = default_filename;
+    }
+    for(size_t lane=0; lane<sources.size(); lane++) {
+        bool binary_output = true;
+        DataStream* datastream = make_datastream(output_format, compress_data, binary_output);
+        if(!datastream) {
+            std::cerr << argv[0] << ": output format not implemented!" << std::endl;
+            return 1;
+        }
+        datastreams.emplace_back(datastream);
+        if(use_control)
+            datastream->add_user_entry("T_soll_f", T_soll);
+        if(use_event_builder) {
+            datastream->add_user_entry("coincidence_window_ns", static_cast<int>(event_settings.window_ns));
+            datastream->add_user_entry("coincidence_multiplicity", event_settings.multiplicity);
+            datastream->add_user_entry("coincidence_threshold_mv", event_settings.threshold_mv);
+        }
+        std::string lane_file = output_file;
+        std::string lane_directory = output_directory;
+        if(multi_board) {
+            std::ostringstream suffix;
+            suffix << "_board" << board_indices[lane];
+            lane_file = base_name + suffix.str();
+            if(!lane_directory.empty() || output_format == OF_MULTIFILE || output_format == OF_MULTIFILE_BIN) {
+                lane_directory = (lane_directory.empty()? base_name : lane_directory) + suffix.str();
+            }
+            datastream->add_user_entry("board_index", board_indices[lane]);
+            datastream->add_user_entry("board_serial",
+                static_cast<DRSSource*>(sources[lane].get())->board()->GetBoardSerialNumber());
+        }
+        datastream->set_compression_threads(compression_threads);
+        if(output_set && !datastream->set_output(output_settings)) {
+            std::cerr << argv[0] << ": Only the TEXT, BIN and YAML formats can change how they are written,"
+                      << " BIN_MMAP only the fsync policy" << std::endl;
+            return 1;
+        }
+        if(codec.codec != CODEC_NONE && !datastream->set_codec(codec)) {
+            std::cerr << argv[0] << ": Only the BIN and YAML formats can be compressed with a codec" << std::endl;
+            return 1;
+        }
+        datastream->init(lane_directory, lane_file, roi,
+                         compression_level, auto_trigger, binary_output,
+                         trigger_delay_percent, ch_num,
+                         argc, argv
+                        );
+        if(adaptive_level) {
+            if(!datastream->set_compression_level(codec.level)) {
+                std::cerr << argv[0] << ": Only compressed TEXT (-C), BIN and YAML (-z) output can adapt the compression level" << std::endl;
+                return 1;
+            }
+            level_controls.emplace_back(new LevelController(adaptive_min_level, adaptive_max_level, codec.level));
+        }
+        if(raw_readout) {
+            DRSCalibration calibration;
+            if(!static_cast<DRSSource*>(sources[lane].get())->read_calibration(calibration)
+               || !datastream->set_calibration(calibration)) {
+                return 1;
+            }
+        } else if(cell_time_axis) {
+            float cell_widths[DRS_NUM_CELLS];
+            if(!sources[lane]->cell_widths(cell_widths)) {
+                std::cerr << argv[0] << ": The time axes of this source do not only depend on the trigger cell" << std::endl;
+                return 1;
+            }
+            if(!datastream->set_cell_widths(cell_widths) && verbose && lane == 0) {
+                std::cout << "The output format writes the full time axis with every frame" << std::endl;
+            }
+        }
+        if(!datastream->write_header()) {
+            std::cerr << argv[0] << ": Cannot write the file header" << std::endl;
+            return 1;
+        }
+    }
+
+    Metrics metrics;
+    for(size_t lane=0; use_metrics && lane<sources.size(); lane++) {
+        LaneMetrics& lane_metrics = metrics.add_lane(board_indices[lane]);
+        sources[lane]->set_metrics(&lane_metrics);
+        datastreams[lane]->set_metrics(&lane_metrics);
+        if(lane < calibrations.size()) {
+            calibrations[lane]->set_metrics(&lane_metrics);
+        }
+    }
+
+    std::unique_ptr<MetricsExporter> metrics_exporter;
+    if(use_metrics) {
+        metrics_exporter.reset(new MetricsExporter(metrics, metrics_settings));
+        if(!metrics_exporter->start()) {
+            return 1;
+        }
+        if(verbose) {
+            std::cout << "Exporting metrics";
+            if(!metrics_settings.file.empty()) std::cout << " to " << metrics_settings.file << " every " << metrics_settings.interval_s << "s";
+            if(!metrics_settings.socket.empty()) std::cout << " on socket " << metrics_settings.socket;
+            std::cout << std::endl;
+        }
     }
-    if(use_control)
-        datastream->add_user_entry("T_soll_f", T_soll);
-    datastream->init(output_directory, output_file, 1024,
-                     compression_level, auto_trigger, binary_output,
-                     trigger_delay_percent, ch_num,
-                     argc, argv
-                    );
-    datastream->write_header();
 
     struct sigaction action;
     memset(&action, 0, sizeof(struct sigaction));
@@ -365,103 +849,348 @@ int main(int argc, char **argv) {
     sigaction(SIGTERM, &action, NULL);
     sigaction(SIGINT, &action, NULL);
 
-    if(verbose) std::cout << "Sampling Rate " << b->GetFrequency() << " GSp/s" << std::endl;
+    if(verbose && sources[0]->frequency() > 0) std::cout << "Sampling Rate " << sources[0]->frequency() << " GSp/s" << std::endl;
     if(verbose) std::cout << "Record " << num_frames << " frames" << std::endl;
     uint32_t num_frames_written = 0;
     bool temperature_stable = false;
+    bool source_exhausted = false;
     int subframe_set = 500;
-    float time[2048];
-    float data_1[2048];
-    float data_2[2048];
-    float data_3[2048];
-    float data_4[2048];
-    std::array<float*, 4> data_array{ {data_1, data_2, data_3, data_4} };
-    auto start_time = high_resolution_clock::now();
-    nanoseconds previous_time;
+    Frame frame;
+    std::vector<std::unique_ptr<FrameRing> > rings;
+    std::vector<std::unique_ptr<FrameRing> > write_rings;
+    std::vector<std::unique_ptr<FrameWriter> > writers;
+    std::vector<std::unique_ptr<CaptureWorker> > workers;
+    std::unique_ptr<EventBuilder> event_builder;
+    RunClock::init();
+    if(!trace_file.empty()) {
+        Trace::set_thread_name("acquisition");
+        Trace::enable();
+    }
+    auto start_time = steady_clock::now();
+    metrics.start(start_time);
+    if(pipeline_depth > 0) {
+        for(size_t lane=0; lane<sources.size(); lane++) {
+            rings.emplace_back(new FrameRing(pipeline_depth, ring_policy));
+            // with the event builder in between, writers get rings of their own
+            FrameRing* writer_ring = rings[lane].get();
+            if(use_event_builder) {
+                write_rings.emplace_back(new FrameRing(pipeline_depth, RP_BLOCK));
+                writer_ring = write_rings[lane].get();
+            }
+            writers.emplace_back(new FrameWriter(*writer_ring, *datastreams[lane]));
+            if(!calibrations.empty() && !use_event_builder) {
+                writers[lane]->set_calibration(calibrations[lane].get());
+            }
+            if(use_metrics) {
+                metrics.lane(lane).set_rings(rings[lane].get(), use_event_builder? writer_ring : NULL);
+                writers[lane]->set_metrics(&metrics.lane(lane));
+            }
+            if(!level_controls.empty()) {
+                writers[lane]->set_level_control(level_controls[lane].get());
+            }
+            writers[lane]->start();
+            if(multi_board) {
+                workers.emplace_back(new CaptureWorker(*sources[lane], *rings[lane], board_indices[lane],
+                                                       abort_measurement));
+                if(use_metrics) workers[lane]->set_metrics(&metrics.lane(lane));
+                workers[lane]->start();
+            }
+        }
+        if(verbose) std::cout << "Pipelined mode, buffering up to " << rings[0]->capacity() << " frames, "
+                              << ring_policy_name(ring_policy) << " if full" << std::endl;
+        if(verbose && multi_board) std::cout << "Reading out " << workers.size() << " boards in parallel" << std::endl;
+    }
+    if(use_event_builder) {
+        std::vector<FrameRing*> inputs, outputs;
+        for(size_t lane=0; lane<rings.size(); lane++) {
+            inputs.push_back(rings[lane].get());
+            outputs.push_back(write_rings[lane].get());
+        }
+        event_builder.reset(new EventBuilder(event_settings, inputs, outputs, abort_measurement));
+        for(size_t lane=0; lane<calibrations.size(); lane++) {
+            event_builder->set_calibration(lane, calibrations[lane].get());
+        }
+        event_builder->start();
+        if(verbose) std::cout << "Software coincidence: " << event_settings.multiplicity << " or more channels beyond "
+                              << event_settings.threshold_mv << " mV within " << event_settings.window_ns << " ns" << std::endl;
+    }
+    FrameSource* source = sources[0].get();
+    LaneMetrics* lane_metrics = use_metrics? &metrics.lane(0) : NULL;
+    DataStream* datastream = datastreams[0].get();
+    FrameRing* ring = rings.empty()? NULL : rings[0].get();
+    FrameWriter* writer = writers.empty()? NULL : writers[0].get();
+    // without a pipeline in between, frames can be captured right into the output
+    bool place_frames = !ring && datastream->can_place();
+    StageStats capture_stats;
+    LiveTime live_time;
+    nanoseconds previous_time(0);
     float averaged_sample_frequency = 0.0;
-    for(unsigned int i=0; i<num_frames && !abort_measurement; i++) {
+    for(unsigned int i=0; i<num_frames && !abort_measurement && !source_exhausted; i++) {
         if(temperature_stable) {
-            control->connect_control();
-            if(!control->temperatureStable()) {
+            // published by the control engine, polled with the end of the previous hold,
+            // so at most one batch old. Invalid while the engine reconnects
+            DetectorState state = control->state();
+            if(!state.valid) {
+                // a missed answer is no failed stabilization, pause until the engine is answered again
+                if(verbose) std::cout << "\33[2K\rLost the detector control connection, waiting for it..." << std::flush;
+                auto give_up = steady_clock::now() + std::chrono::milliseconds(DETECTOR_RECONNECT_GRACE_MS);
+                while(!state.valid && !abort_measurement && steady_clock::now() < give_up) {
+                    usleep(DETECTOR_POLL_INTERVAL_MS*1000);
+                    state = control->state();
+                }
+                if(!state.valid && !abort_measurement) {
+                    temperature_stable = false;
+                    abort_measurement = true;
+                    std::cout << "\33[2K\rDetector control did not answer for " << DETECTOR_RECONNECT_GRACE_MS/1000
+                              << " s, connection lost. Abort measurement" << std::endl;
+                    continue;
+                }
+            }
+            if(state.valid && !state.stable) {
                 temperature_stable = false;
                 abort_measurement = true;
                 std::cout << "\33[2K\rTemperature stabilization failed, probably cooling limits reached. Abort measurement" << std::endl;
-                control->disconnect_control();
                 continue;
             }
-            control->disconnect_control();
         } else {
             while(use_control && !temperature_stable && !abort_measurement) {
-                control->connect_control();
-                temperature_stable = control->temperatureStable();
-                float T_ist = control->getTist();
-                control->disconnect_control();
-                if(verbose) 
+                DetectorState state = control->state();
+                temperature_stable = state.valid && state.stable;
+                if(verbose && state.valid)
                     std::cout << "\33[2K\rWait for detector temperature to stabilize... T_ist="
-                              << T_ist << "K, T_ist-T_soll=" << T_ist-T_soll << std::flush;
-                sleep(1);
+                              << state.T_detector << "K, T_ist-T_soll=" << state.T_detector-T_soll << std::flush;
+                if(!temperature_stable)
+                    usleep(DETECTOR_POLL_INTERVAL_MS*1000);
             }
         }
         if(abort_measurement) {
             continue;
         }
         if(use_control) {
-            control->connect_control();
             control->hold_start();
 //             std::cout << "Hold start" << std::endl;
         }
         unsigned int j=0;
 
-        for(j=i; j<(i+subframe_set) && j<num_frames && !abort_measurement; j++) {
-            auto record_time = duration_cast<nanoseconds>(high_resolution_clock::now() - start_time);
-//             std::cout << "Sample!" << std::endl;
+        if(multi_board) {
+            unsigned int batch = std::min<unsigned int>(subframe_set, num_frames - i);
+            for(auto& worker: workers) {
+                worker->run_batch(batch);
+            }
+            for(auto& worker: workers) {
+                if(!worker->wait_batch()) source_exhausted = true;
+            }
+            for(auto& lane_writer: writers) {
+                if(lane_writer->failed()) abort_measurement = true;
+            }
+            j = i + batch;
             if(verbose) {
-                averaged_sample_frequency += ((10.0/static_cast<double>((record_time-previous_time).count())*1e9) - averaged_sample_frequency)*0.001f;
-                previous_time = record_time;
-                if(j % 10 == 0)
-                    std::cout << "\33[2K\rSample " << j << " of " << num_frames << ", frequency " << averaged_sample_frequency << "Hz" << std::flush;
-            }
-            captureSample();
-            if(abort_measurement) break;
-            board->GetTime(0, board->GetTriggerCell(0), time);
-            board->GetWave(0, 0, data_1);
-            if(do_multichannel_recording) {
-                board->GetWave(0, 2, data_2);
-                board->GetWave(0, 4, data_3);
-                board->GetWave(0, 6, data_4);
-                if(!datastream->write_frame(record_time, time, data_array)) {
+                auto record_time = duration_cast<nanoseconds>(steady_clock::now() - start_time);
+                std::cout << "\33[2K\rSample " << j << " of " << num_frames << ", frequency "
+                          << static_cast<double>(j) / static_cast<double>(record_time.count())*1e9
+                          << "Hz per board" << std::flush;
+            }
+        } else {
+            for(j=i; j<(i+subframe_set) && j<num_frames && !abort_measurement; j++) {
+                auto record_time = duration_cast<nanoseconds>(steady_clock::now() - start_time);
+    //             std::cout << "Sample!" << std::endl;
+                if(verbose) {
+                    averaged_sample_frequency += ((10.0/static_cast<double>((record_time-previous_time).count())*1e9) - averaged_sample_frequency)*0.001f;
+                    previous_time = record_time;
+                    if(j % 10 == 0)
+                        std::cout << "\33[2K\rSample " << j << " of " << num_frames << ", frequency " << averaged_sample_frequency << "Hz" << std::flush;
+                }
+                Frame* target = &frame;
+                if(ring) {
+                    while(!(target = ring->claim(std::chrono::milliseconds(100))) && !abort_measurement) {
+                        if(writer->failed()) abort_measurement = true;
+                    }
+                    if(abort_measurement) break;
+                } else if(place_frames && !datastream->place(frame)) {
                     abort_measurement = true;
                     break;
                 }
-            } else {
-                if(!datastream->write_frame(record_time, time, data_1)) {
-                    abort_measurement = true;
+                auto capture_start = steady_clock::now();
+                target->timestamps = FrameTimestamps();
+                bool captured;
+                {
+                    TraceSpan span("capture");
+                    captured = source->capture(*target);
+                }
+                if(!captured) {
+                    source_exhausted = !abort_measurement;
                     break;
                 }
+                capture_stats.busy += duration_cast<nanoseconds>(steady_clock::now() - capture_start);
+                capture_stats.frames++;
+                live_time.add(target->timestamps);
+                if(lane_metrics) lane_metrics->count_captured();
+                if(ring) {
+                    ring->publish(target);
+                    if(writer->failed()) {
+                        abort_measurement = true;
+                        break;
+                    }
+                } else {
+                    if(!calibrations.empty()) {
+                        calibrations[0]->apply(frame);
+                    }
+                    auto write_start = steady_clock::now();
+                    if(!frame.timestamps.written) frame.timestamps.written = RunClock::now();
+                    bool written;
+                    {
+                        TraceSpan span("write_frame");
+                        written = datastream->write(frame);
+                    }
+                    if(!written) {
+                        abort_measurement = true;
+                        break;
+                    }
+                    auto write_end = steady_clock::now();
+                    if(lane_metrics) {
+                        lane_metrics->record(MS_WRITE, write_end - write_start);
+                        lane_metrics->count_written(datastream->bytes_written());
+                    }
+                    // no buffer in between, only the time spent writing tells the load
+                    if(!level_controls.empty() && level_controls[0]->update(0, 0,
+                            duration_cast<nanoseconds>(write_end - write_start), write_end)) {
+                        datastream->set_compression_level(level_controls[0]->level());
+                    }
+                }
+                num_frames_written++;
             }
-            num_frames_written++;
         }
         i = j;
         if(use_control) {
 //             std::cout << "Hold end" << std::endl;
             control->hold_end();
-            control->disconnect_control();
-            usleep(1000);
         }
     }
-    datastream->finalize();
-    datastream.release();
+    for(auto& worker: workers) {
+        worker->stop();
+    }
+    if(control) {
+        control->disconnect_control();
+    }
+    if(event_builder) {
+        event_builder->finish();
+    }
+    if(!writers.empty()) {
+        num_frames_written = 0;
+    }
+    for(size_t lane=0; lane<writers.size(); lane++) {
+        writers[lane]->finish();
+        if(writers[lane]->failed()) abort_measurement = true;
+        num_frames_written += writers[lane]->stats().frames;
+        datastreams[lane]->add_summary_entry("buffer_policy", ring_policy_name(rings[lane]->policy()));
+        datastreams[lane]->add_summary_entry("frames_dropped", rings[lane]->dropped());
+        datastreams[lane]->add_summary_entry("frames_dropped_newest", rings[lane]->dropped_newest());
+        datastreams[lane]->add_summary_entry("frames_dropped_oldest", rings[lane]->dropped_oldest());
+        if(event_builder) {
+            datastreams[lane]->add_summary_entry("events_accepted", event_builder->events_accepted());
+            datastreams[lane]->add_summary_entry("events_rejected", event_builder->events_rejected());
+        }
+    }
+    for(size_t lane=0; lane<level_controls.size(); lane++) {
+        datastreams[lane]->add_summary_entry("compression_levels", level_controls[lane]->history());
+        datastreams[lane]->add_summary_entry("compression_level_changes", level_controls[lane]->changes());
+        datastreams[lane]->add_summary_entry("compression_level_mean", level_controls[lane]->mean_level());
+    }
+    for(size_t lane=0; lane<calibrations.size(); lane++) {
+        datastreams[lane]->add_summary_entry("calibration_kernel", calibration_kernel_name(calibrations[lane]->kernel()));
+        if(verify_calibration) {
+            datastreams[lane]->add_summary_entry("calibration_frames_differing", calibrations[lane]->frames_differing());
+        }
+    }
+    for(size_t lane=0; lane<sources.size(); lane++) {
+        const TriggerWait* wait = sources[lane]->trigger_wait();
+        if(!wait) continue;
+        datastreams[lane]->add_summary_entry("wait_strategy", wait_strategy_name(wait->strategy()));
+        datastreams[lane]->add_summary_entry("trigger_latency_mean_ns", wait->latency().mean());
+        datastreams[lane]->add_summary_entry("trigger_latency_p50_ns", wait->latency().quantile(0.5));
+        datastreams[lane]->add_summary_entry("trigger_latency_p99_ns", wait->latency().quantile(0.99));
+        datastreams[lane]->add_summary_entry("trigger_latency_max_ns", wait->latency().max());
+        datastreams[lane]->add_summary_entry("trigger_wait_cpu_ns", static_cast<uint64_t>(wait->cpu_time().count()));
+        datastreams[lane]->add_summary_entry("trigger_wait_ns", static_cast<uint64_t>(wait->wait_time().count()));
+    }
+    for(size_t lane=0; lane<sources.size(); lane++) {
+        const LiveTime& lane_live_time = multi_board? workers[lane]->live_time() : live_time;
+        datastreams[lane]->add_summary_entry("clock_source", RunClock::source());
+        if(RunClock::tsc_frequency() > 0.0) {
+            datastreams[lane]->add_summary_entry("clock_tsc_hz", RunClock::tsc_frequency());
+        }
+        datastreams[lane]->add_summary_entry("clock_drift_ns", static_cast<double>(RunClock::drift()));
+        datastreams[lane]->add_summary_entry("live_time_ns", static_cast<uint64_t>(lane_live_time.live_ns()));
+        datastreams[lane]->add_summary_entry("dead_time_ns", static_cast<uint64_t>(lane_live_time.dead_ns()));
+        datastreams[lane]->add_summary_entry("dead_time_fraction", lane_live_time.dead_fraction());
+        datastreams[lane]->add_summary_entry("trigger_rate_live_hz", lane_live_time.live_rate());
+    }
+    for(size_t lane=0; control && lane<datastreams.size(); lane++) {
+        const LatencyHistogram& round_trip = control->round_trip();
+        datastreams[lane]->add_summary_entry("control_round_trip_mean_ns", round_trip.mean());
+        datastreams[lane]->add_summary_entry("control_round_trip_p99_ns", round_trip.quantile(0.99));
+        datastreams[lane]->add_summary_entry("control_round_trip_max_ns", round_trip.max());
+        datastreams[lane]->add_summary_entry("control_timeouts", control->timeouts());
+        datastreams[lane]->add_summary_entry("control_reconnects", control->reconnects());
+    }
+    auto total_time = duration_cast<nanoseconds>(steady_clock::now() - start_time);
+    if(metrics_exporter) {
+        metrics_exporter->stop();
+    }
+    for(auto& lane_stream: datastreams) {
+        lane_stream->finalize();
+        lane_stream.reset();
+    }
     if(verbose) {
         if(abort_measurement)
             std::cout << "\33[K\rAborted reading samples after "
                       << num_frames_written << " frames" << std::endl;
         else {
-            auto total_time = duration_cast<nanoseconds>(high_resolution_clock::now() - start_time);
             double frequency = static_cast<double>(num_frames_written) / static_cast<double>(total_time.count())*1e9;
             std::cout << "\33[2K\rDone reading samples, average frequency " << frequency << "Hz" << std::endl;
         }
+        for(size_t lane=0; lane<writers.size(); lane++) {
+            if(multi_board) {
+                std::cout << "Board " << board_indices[lane] << " pipeline stages:" << std::endl;
+                print_stage_stats("capture", workers[lane]->stats(), total_time);
+            } else {
+                std::cout << "Pipeline stages:" << std::endl;
+                print_stage_stats("capture", capture_stats, total_time);
+            }
+            print_stage_stats("write  ", writers[lane]->stats(), total_time);
+            print_ring_stats(*rings[lane]);
+        }
+        if(event_builder) {
+            print_event_builder_stats(*event_builder, total_time);
+        }
+        if(control) {
+            print_detector_control_stats(*control);
+        }
+        for(size_t lane=0; lane<sources.size(); lane++) {
+            if(multi_board) std::cout << "Board " << board_indices[lane] << ":" << std::endl;
+            sources[lane]->print_stats();
+            print_live_time(multi_board? workers[lane]->live_time() : live_time);
+            if(lane < calibrations.size()) print_calibration_stats(*calibrations[lane]);
+            if(lane < level_controls.size()) print_level_control_stats(*level_controls[lane]);
+            if(sources[lane]->trigger_wait()) print_trigger_wait_stats(*sources[lane]->trigger_wait());
+        }
     }
 
+    workers.clear();
+    writers.clear();
+    sources.clear();
+    delete control;
     delete drs;
+    // all threads are done now
+    if(!trace_file.empty()) {
+        if(!Trace::write(trace_file)) {
+            return 1;
+        }
+        if(verbose) {
+            std::cout << "Trace: " << Trace::events() << " spans written to " << trace_file;
+            if(Trace::dropped()) std::cout << ", " << Trace::dropped() << " dropped";
+            std::cout << std::endl;
+        }
+    }
     return 0;
 }
@@ -0,0 +1,403 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "metrics.h"
+#include "framering.h"
+#include "trace.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+/// Exported histogram buckets are the powers of two from 2^10 ns (~1 us) to 2^36 ns (~69 s)
+#define METRICS_FIRST_BUCKET_SHIFT 10
+#define METRICS_LAST_BUCKET_SHIFT 36
+#define METRICS_CLIENT_TIMEOUT_MS 1000
+
+static const char* stage_names[MS_NUM_STAGES] = {
+    "trigger_wait", "transfer", "decode", "calibrate", "write", "compress"
+};
+
+const char* metric_stage_name(metric_stage_t stage)
+{
+    return stage_names[stage];
+}
+
+LaneMetrics::LaneMetrics(int board)
+: m_board(board), m_frames_captured(0), m_frames_written(0), m_bytes_written(0),
+m_capture_ring(NULL), m_write_ring(NULL)
+{
+}
+
+void LaneMetrics::record(metric_stage_t stage, const steady_clock::duration& duration)
+{
+    uint64_t ns = duration_cast<nanoseconds>(duration).count();
+    std::lock_guard<std::mutex> lock(m_mutex[stage]);
+    m_stages[stage].add(ns);
+}
+
+LatencyHistogram LaneMetrics::stage(metric_stage_t stage) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex[stage]);
+    return m_stages[stage];
+}
+
+void LaneMetrics::count_written(uint64_t bytes_total)
+{
+    m_frames_written.fetch_add(1, std::memory_order_relaxed);
+    m_bytes_written.store(bytes_total, std::memory_order_relaxed);
+}
+
+void LaneMetrics::set_rings(const FrameRing* capture_ring, const FrameRing* write_ring)
+{
+    m_capture_ring.store(capture_ring, std::memory_order_release);
+    m_write_ring.store(write_ring, std::memory_order_release);
+}
+
+Metrics::Metrics()
+: m_started(false)
+{
+}
+
+LaneMetrics& Metrics::add_lane(int board)
+{
+    m_lanes.emplace_back(new LaneMetrics(board));
+    return *m_lanes.back();
+}
+
+void Metrics::start(const steady_clock::time_point& start_time)
+{
+    m_start_time = start_time;
+    m_started.store(true, std::memory_order_release);
+}
+
+static std::string format_seconds(uint64_t ns)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", ns * 1e-9);
+    return buf;
+}
+
+static void format_header(std::ostringstream& out, const char* name, const char* type, const char* help)
+{
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n";
+}
+
+static void format_histogram(std::ostringstream& out, const std::string& labels, const LatencyHistogram& histogram)
+{
+    const char* name = "get_data_stage_duration_seconds";
+    uint64_t cumulative = 0;
+    size_t i = 0;
+    for(int shift=METRICS_FIRST_BUCKET_SHIFT; shift<=METRICS_LAST_BUCKET_SHIFT; shift++) {
+        uint64_t le = static_cast<uint64_t>(1) << shift;
+        for(; i<LATENCY_HISTOGRAM_BUCKETS && LatencyHistogram::bucket_upper(i) < le; i++) {
+            cumulative += histogram.bucket(i);
+        }
+        out << name << "_bucket{" << labels << ",le=\"" << format_seconds(le) << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << histogram.count() << "\n"
+        << name << "_sum{" << labels << "} " << format_seconds(histogram.sum()) << "\n"
+        << name << "_count{" << labels << "} " << histogram.count() << "\n";
+}
+
+std::string Metrics::format() const
+{
+    std::ostringstream out;
+    bool started = m_started.load(std::memory_order_acquire);
+    nanoseconds elapsed(0);
+    if(started) {
+        elapsed = duration_cast<nanoseconds>(steady_clock::now() - m_start_time);
+    }
+    format_header(out, "get_data_elapsed_seconds", "gauge", "Time since the acquisition started");
+    out << "get_data_elapsed_seconds " << format_seconds(elapsed.count()) << "\n";
+
+    std::vector<std::string> labels;
+    std::vector<LatencyHistogram> histograms(m_lanes.size() * MS_NUM_STAGES);
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        std::ostringstream ss;
+        ss << "board=\"" << m_lanes[lane]->board() << "\"";
+        labels.push_back(ss.str());
+        for(int stage=0; stage<MS_NUM_STAGES; stage++) {
+            histograms[lane*MS_NUM_STAGES + stage] = m_lanes[lane]->stage(static_cast<metric_stage_t>(stage));
+        }
+    }
+
+    // stages a setup does not have, e.g. calibration without -G, are left out
+    format_header(out, "get_data_stage_duration_seconds", "histogram", "Duration of an acquisition stage per frame");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        for(int stage=0; stage<MS_NUM_STAGES; stage++) {
+            const LatencyHistogram& histogram = histograms[lane*MS_NUM_STAGES + stage];
+            if(histogram.count() == 0) continue;
+            format_histogram(out, labels[lane] + ",stage=\"" + stage_names[stage] + "\"", histogram);
+        }
+    }
+
+    format_header(out, "get_data_frames_captured_total", "counter", "Frames read from the source");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        out << "get_data_frames_captured_total{" << labels[lane] << "} " << m_lanes[lane]->frames_captured() << "\n";
+    }
+    format_header(out, "get_data_frames_written_total", "counter", "Frames written to the output");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        out << "get_data_frames_written_total{" << labels[lane] << "} " << m_lanes[lane]->frames_written() << "\n";
+    }
+    format_header(out, "get_data_bytes_written_total", "counter", "Size of the output, 0 if the format does not tell");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        out << "get_data_bytes_written_total{" << labels[lane] << "} " << m_lanes[lane]->bytes_written() << "\n";
+    }
+
+    // the share of the run in which the board was not armed; without trigger waits it is not known
+    format_header(out, "get_data_dead_time_ratio", "gauge", "Fraction of the elapsed time not waiting for a trigger");
+    for(size_t lane=0; lane<m_lanes.size() && elapsed.count() > 0; lane++) {
+        const LatencyHistogram& wait = histograms[lane*MS_NUM_STAGES + MS_TRIGGER_WAIT];
+        if(wait.count() == 0) continue;
+        double live = static_cast<double>(wait.sum()) / elapsed.count();
+        out << "get_data_dead_time_ratio{" << labels[lane] << "} " << std::max(0.0, 1.0 - live) << "\n";
+    }
+
+    format_header(out, "get_data_queue_depth", "gauge", "Frames buffered between two threads");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        const FrameRing* capture = m_lanes[lane]->capture_ring();
+        const FrameRing* write = m_lanes[lane]->write_ring();
+        if(capture) out << "get_data_queue_depth{" << labels[lane] << ",queue=\"capture\"} " << capture->fill() << "\n";
+        if(write) out << "get_data_queue_depth{" << labels[lane] << ",queue=\"write\"} " << write->fill() << "\n";
+    }
+    format_header(out, "get_data_queue_capacity", "gauge", "Frames a queue can buffer");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        const FrameRing* capture = m_lanes[lane]->capture_ring();
+        const FrameRing* write = m_lanes[lane]->write_ring();
+        if(capture) out << "get_data_queue_capacity{" << labels[lane] << ",queue=\"capture\"} " << capture->capacity() << "\n";
+        if(write) out << "get_data_queue_capacity{" << labels[lane] << ",queue=\"write\"} " << write->capacity() << "\n";
+    }
+    format_header(out, "get_data_frames_dropped_total", "counter", "Frames dropped because the capture queue was full");
+    for(size_t lane=0; lane<m_lanes.size(); lane++) {
+        const FrameRing* capture = m_lanes[lane]->capture_ring();
+        if(capture) out << "get_data_frames_dropped_total{" << labels[lane] << "} " << capture->dropped() << "\n";
+    }
+    return out.str();
+}
+
+bool parse_metrics_spec(const std::string& spec, MetricsSettings& settings)
+{
+    std::vector<std::string> tokens;
+    boost::algorithm::split(tokens, spec, boost::algorithm::is_any_of(","));
+    for(auto& token: tokens) {
+        size_t eq = token.find('=');
+        std::string key = token.substr(0, eq);
+        std::string value = eq == std::string::npos? "" : token.substr(eq + 1);
+        if(key == "file" && !value.empty()) {
+            settings.file = value;
+        } else if(key == "socket" && !value.empty()) {
+            settings.socket = value;
+        } else if(key == "interval") {
+            try {
+                settings.interval_s = boost::lexical_cast<double>(value);
+            } catch(boost::bad_lexical_cast const& e) {
+                return false;
+            }
+            if(settings.interval_s <= 0.0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return !settings.file.empty() || !settings.socket.empty();
+}
+
+MetricsExporter::MetricsExporter(const Metrics& metrics, const MetricsSettings& settings)
+: m_metrics(metrics), m_settings(settings), m_listen(-1), m_wakeup(-1)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+bool MetricsExporter::start()
+{
+    m_wakeup = eventfd(0, EFD_CLOEXEC);
+    if(m_wakeup == -1) {
+        std::cerr << "Cannot create the metrics exporter wakeup: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if(!m_settings.socket.empty()) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(m_settings.socket.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Metrics socket path '" << m_settings.socket << "' is too long" << std::endl;
+            return false;
+        }
+        strncpy(addr.sun_path, m_settings.socket.c_str(), sizeof(addr.sun_path) - 1);
+        // a socket left over by a previous run would make bind() fail
+        unlink(m_settings.socket.c_str());
+        m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(m_listen == -1 || bind(m_listen, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen, 4) != 0) {
+            std::cerr << "Cannot serve metrics on '" << m_settings.socket << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if(!m_settings.file.empty() && !write_file()) {
+        return false;
+    }
+    m_thread = std::thread(&MetricsExporter::run, this);
+    return true;
+}
+
+void MetricsExporter::stop()
+{
+    if(m_thread.joinable()) {
+        uint64_t one = 1;
+        if(write(m_wakeup, &one, sizeof(one)) != sizeof(one)) {
+            std::cerr << "Cannot wake up the metrics exporter: " << strerror(errno) << std::endl;
+        }
+        m_thread.join();
+        if(!m_settings.file.empty()) {
+            write_file();
+        }
+    }
+    if(m_listen != -1) {
+        close(m_listen);
+        unlink(m_settings.socket.c_str());
+        m_listen = -1;
+    }
+    if(m_wakeup != -1) {
+        close(m_wakeup);
+        m_wakeup = -1;
+    }
+}
+
+void MetricsExporter::run()
+{
+    Trace::set_thread_name("metrics exporter");
+    auto interval = duration_cast<steady_clock::duration>(std::chrono::duration<double>(m_settings.interval_s));
+    auto next_write = steady_clock::now() + interval;
+    for(;;) {
+        int timeout_ms = -1;
+        if(!m_settings.file.empty()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(next_write - steady_clock::now());
+            timeout_ms = std::max<int>(0, remaining.count() + 1);
+        }
+        pollfd fds[2];
+        fds[0].fd = m_wakeup;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_listen;
+        fds[1].events = POLLIN;
+        int n = poll(fds, m_listen == -1? 1 : 2, timeout_ms);
+        if(n == -1 && errno != EINTR) {
+            std::cerr << "Metrics exporter failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        if(n > 0 && (fds[0].revents & POLLIN)) {
+            return;
+        }
+        if(n > 0 && m_listen != -1 && (fds[1].revents & POLLIN)) {
+            int client;
+            while((client = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+                serve(client);
+                close(client);
+            }
+        }
+        if(!m_settings.file.empty() && steady_clock::now() >= next_write) {
+            write_file();
+            next_write += interval;
+            if(next_write < steady_clock::now()) {
+                next_write = steady_clock::now() + interval;
+            }
+        }
+    }
+}
+
+bool MetricsExporter::write_file()
+{
+    std::string text = m_metrics.format();
+    std::string tmp_file = m_settings.file + ".tmp";
+    FILE* f = fopen(tmp_file.c_str(), "w");
+    if(!f) {
+        std::cerr << "Cannot write metrics file '" << tmp_file << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = fwrite(text.c_str(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    if(!ok || rename(tmp_file.c_str(), m_settings.file.c_str()) != 0) {
+        std::cerr << "Cannot write metrics file '" << m_settings.file << "': " << strerror(errno) << std::endl;
+        unlink(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+void MetricsExporter::serve(int client)
+{
+    // a slow client must not stall the exporter for longer than the timeout
+    timeval timeout;
+    timeout.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // HTTP clients send their request right away, plain readers send nothing
+    bool http = false;
+    pollfd pfd;
+    pfd.fd = client;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, 100) == 1 && (pfd.revents & POLLIN)) {
+        char request[4096];
+        ssize_t n = recv(client, request, sizeof(request), MSG_DONTWAIT);
+        http = n >= 4 && strncmp(request, "GET ", 4) == 0;
+    }
+    std::string body = m_metrics.format();
+    std::string response;
+    if(http) {
+        std::ostringstream header;
+        header << "HTTP/1.0 200 OK\r\n"
+               << "Content-Type: text/plain; version=0.0.4\r\n"
+               << "Content-Length: " << body.size() << "\r\n"
+               << "Connection: close\r\n\r\n";
+        response = header.str();
+    }
+    response += body;
+    size_t sent = 0;
+    while(sent < response.size()) {
+        ssize_t n = send(client, response.c_str() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) {
+            if(n == -1 && errno == EINTR) continue;
+            return;
+        }
+        sent += n;
+    }
+}
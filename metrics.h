@@ -0,0 +1,166 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+class FrameRing;
+
+/**
+ * Stages of the acquisition whose durations are recorded per frame
+ */
+enum metric_stage_t {
+    MS_TRIGGER_WAIT,  ///< armed, waiting for the trigger
+    MS_TRANSFER,      ///< TransferWaves()
+    MS_DECODE,        ///< GetWave(), GetTime(), GetRawWave()
+    MS_CALIBRATE,     ///< calibration in get_data (-G)
+    MS_WRITE,         ///< DataStream::write()
+    MS_COMPRESS,      ///< compression inside a DataStream
+    MS_NUM_STAGES
+};
+
+const char* metric_stage_name(metric_stage_t stage);
+
+/**
+ * Live metrics of one board: per stage latency histograms, frame and byte
+ * counters and the rings between its threads.
+ *
+ * Recorded into by the capture, writer and calibration threads of the board
+ * and read by the exporter at any time. Every stage has its own lock, which
+ * is only contended while the exporter copies the histogram.
+ */
+class LaneMetrics {
+public:
+    explicit LaneMetrics(int board);
+
+    int board() const { return m_board; }
+
+    void record(metric_stage_t stage, const std::chrono::steady_clock::duration& duration);
+    /// Copy of the histogram of a stage
+    LatencyHistogram stage(metric_stage_t stage) const;
+
+    void count_captured() { m_frames_captured.fetch_add(1, std::memory_order_relaxed); }
+    /// A frame was written, the output has bytes_total bytes now
+    void count_written(uint64_t bytes_total);
+    uint64_t frames_captured() const { return m_frames_captured.load(std::memory_order_relaxed); }
+    uint64_t frames_written() const { return m_frames_written.load(std::memory_order_relaxed); }
+    uint64_t bytes_written() const { return m_bytes_written.load(std::memory_order_relaxed); }
+
+    /// Rings whose depth and drops are exported, either may be NULL
+    void set_rings(const FrameRing* capture_ring, const FrameRing* write_ring);
+    const FrameRing* capture_ring() const { return m_capture_ring.load(std::memory_order_acquire); }
+    const FrameRing* write_ring() const { return m_write_ring.load(std::memory_order_acquire); }
+
+private:
+    LaneMetrics(const LaneMetrics&);
+    LaneMetrics& operator=(const LaneMetrics&);
+
+    int m_board;
+    mutable std::mutex m_mutex[MS_NUM_STAGES];
+    LatencyHistogram m_stages[MS_NUM_STAGES];
+    std::atomic<uint64_t> m_frames_captured;
+    std::atomic<uint64_t> m_frames_written;
+    std::atomic<uint64_t> m_bytes_written;
+    /// set up while the exporter may already run
+    std::atomic<const FrameRing*> m_capture_ring;
+    std::atomic<const FrameRing*> m_write_ring;
+};
+
+/**
+ * All metrics of a run, formatted in the Prometheus text exposition format.
+ *
+ * Lanes are added during setup, before any thread records into them.
+ */
+class Metrics {
+public:
+    Metrics();
+
+    LaneMetrics& add_lane(int board);
+    size_t lanes() const { return m_lanes.size(); }
+    LaneMetrics& lane(size_t i) { return *m_lanes[i]; }
+
+    /// Acquisition start, the reference of the elapsed and the dead time
+    void start(const std::chrono::steady_clock::time_point& start_time);
+
+    std::string format() const;
+
+private:
+    std::vector<std::unique_ptr<LaneMetrics> > m_lanes;
+    std::atomic<bool> m_started;
+    std::chrono::steady_clock::time_point m_start_time;
+};
+
+struct MetricsSettings {
+    std::string file;        ///< rewritten every interval, empty for none
+    std::string socket;      ///< UNIX socket serving the metrics, empty for none
+    double interval_s;
+
+    MetricsSettings() : interval_s(10.0) {}
+};
+
+/// Parse "file=PATH,socket=PATH,interval=SECONDS", at least one of file and socket
+bool parse_metrics_spec(const std::string& spec, MetricsSettings& settings);
+
+/**
+ * Thread exporting Metrics while the acquisition runs.
+ *
+ * The file is replaced atomically every interval and once more when the
+ * exporter stops, so it always holds a complete set. Every connection to
+ * the socket gets the current metrics and is closed, plain for e.g.
+ * "socat - UNIX-CONNECT:PATH", or as an HTTP response if the client sent a
+ * GET request, for "curl --unix-socket PATH http://localhost/metrics" and
+ * Prometheus behind a socket proxy.
+ */
+class MetricsExporter {
+public:
+    MetricsExporter(const Metrics& metrics, const MetricsSettings& settings);
+    ~MetricsExporter();
+
+    /// Listen on the socket and start the thread, false on errors
+    bool start();
+    /// Write the file a last time, stop the thread and remove the socket
+    void stop();
+
+private:
+    void run();
+    bool write_file();
+    void serve(int client);
+
+    const Metrics& m_metrics;
+    MetricsSettings m_settings;
+    int m_listen;
+    int m_wakeup;
+    std::thread m_thread;
+};
+
+#endif // METRICS_H
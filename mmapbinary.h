@@ -0,0 +1,240 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef _MMAPBINARY_H_
+#define _MMAPBINARY_H_
+
+#include "binary.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the file is mapped and preallocated in windows of this size
+#define MMAP_WINDOW_SIZE (64 << 20)
+
+/**
+ * The BIN format, written through a window of the file mapped into memory.
+ *
+ * The file is a version 1 .cdt file, frames back to back without chunks,
+ * codec, raw readout and cell widths. Frames are placed into the window, place() points the time
+ * axis and the waveform of a frame directly at its slot so the source fills
+ * the file without a copy. Windows are preallocated, so a full disk fails
+ * the write instead of raising SIGBUS. Windows are populated when mapped,
+ * and read sequentially. fsync= of the output settings chooses when the
+ * data is forced to the disk, with a policy the writeback of a finished
+ * window is started when it is unmapped.
+ */
+class MappedBinaryStream : public BinaryStream {
+protected:
+    int fd;
+    /// file offset of the next frame
+    uint64_t offset;
+    /// file offset of the first frame
+    uint64_t data_start;
+    char* window;
+    uint64_t window_start;
+    uint64_t window_end;
+    std::chrono::steady_clock::time_point last_sync;
+
+    virtual bool init_stream() {
+        // a shared writable mapping needs the file open for reading as well
+        file = fopen64(filename.c_str(), "w+b");
+        return true;
+    }
+
+    size_t frame_size() const {
+        return 4*sizeof(int64_t) + 2*frames_per_sample*sizeof(float);
+    }
+
+    void release_window() {
+        if(!window) return;
+        // data to be synced later gets on its way now, so syncing does not wait for all of it
+        if(output_settings.sync != SYNC_NONE) {
+            sync_file_range(fd, window_start, offset - window_start, SYNC_FILE_RANGE_WRITE);
+        }
+        munmap(window, window_end - window_start);
+        window = NULL;
+    }
+
+    /// Map the file from offset on for at least size bytes
+    bool reserve(size_t size) {
+        if(window && offset + size <= window_end) {
+            return true;
+        }
+        TraceSpan span("map_window");
+        release_window();
+        uint64_t page_size = sysconf(_SC_PAGESIZE);
+        window_start = offset / page_size * page_size;
+        window_end = window_start + std::max<uint64_t>(MMAP_WINDOW_SIZE, (offset - window_start + size + page_size - 1) / page_size * page_size);
+        int error = fallocate(fd, 0, window_start, window_end - window_start);
+        if(error != 0 && errno == EOPNOTSUPP) {
+            error = ftruncate(fd, window_end);
+        }
+        if(error != 0) {
+            std::cerr << "Cannot allocate '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        void* mapping = mmap(NULL, window_end - window_start, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, window_start);
+        if(mapping == MAP_FAILED) {
+            std::cerr << "Cannot map '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        window = static_cast<char*>(mapping);
+        madvise(window, window_end - window_start, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    bool sync() {
+        TraceSpan span("fdatasync");
+        if(window && msync(window, offset - window_start, MS_SYNC) != 0) {
+            std::cerr << "Cannot sync '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        // also the earlier windows and the file size
+        if(fdatasync(fd) != 0) {
+            std::cerr << "Cannot sync '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        last_sync = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void close_mapping() {
+        release_window();
+        if(fd != -1) {
+            if(ftruncate(fd, offset) != 0) {
+                std::cerr << "Cannot truncate '" << filename << "': " << strerror(errno) << std::endl;
+            }
+            fd = -1;
+        }
+    }
+
+public:
+    MappedBinaryStream() : fd(-1), offset(0), data_start(0), window(NULL), window_start(0), window_end(0) {
+        version = 1;
+    }
+    virtual ~MappedBinaryStream() {
+        close_mapping();
+    }
+    virtual bool set_calibration(const DRSCalibration& p_calibration) {
+        return false;
+    }
+    virtual bool set_cell_widths(const float* dt) {
+        return false;
+    }
+    virtual bool set_codec(const CodecSettings& p_codec) {
+        return false;
+    }
+    /// Only the fsync= policy applies, the file is always written through the mapping
+    virtual bool set_output(const OutputSettings& settings) {
+        if(settings.backend != OB_STDIO || settings.direct) return false;
+        output_settings = settings;
+        return true;
+    }
+    virtual bool set_compression_level(int level) {
+        return false;
+    }
+    virtual bool write_header() {
+        if(!file || !write_file_header() || fflush(file) != 0) {
+            return false;
+        }
+        fd = fileno(file);
+        offset = data_start = ftello64(file);
+        last_sync = std::chrono::steady_clock::now();
+        return reserve(frame_size());
+    }
+
+    virtual bool can_place() const {
+        return ch_config[1] == -1;
+    }
+    virtual bool place(Frame& frame) {
+        // With a region of interest the board still writes all FRAME_MAX_SAMPLES
+        // into data before the window is moved to its start. The rest goes over
+        // the slot of the next frame, it has to be mapped as well
+        if(!reserve(frame_size() + (FRAME_MAX_SAMPLES - frames_per_sample)*sizeof(float))) {
+            return false;
+        }
+        float* slot = reinterpret_cast<float*>(window + (offset - window_start) + 4*sizeof(int64_t));
+        frame.time = slot;
+        frame.data[ch_config[0]] = slot + frames_per_sample;
+        return true;
+    }
+
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) {
+        if(frame_counter == 4294967295UL || !reserve(frame_size()))
+            return false;
+        frame_counter++;
+        char* slot = window + (offset - window_start);
+        int64_t frame_timestamps[4] = {timestamps.armed, timestamps.triggered,
+                                       timestamps.transferred, timestamps.written};
+        memcpy(slot, frame_timestamps, sizeof(frame_timestamps));
+        float* slot_time = reinterpret_cast<float*>(slot + sizeof(frame_timestamps));
+        float* slot_data = slot_time + frames_per_sample;
+        // a placed frame is already there
+        if(time != slot_time) memcpy(slot_time, time, frames_per_sample*sizeof(float));
+        if(data != slot_data) memcpy(slot_data, data, frames_per_sample*sizeof(float));
+        offset += frame_size();
+        if(output_settings.sync == SYNC_INTERVAL
+           && std::chrono::steady_clock::now() - last_sync >= output_settings.sync_interval) {
+            return sync();
+        }
+        return true;
+    }
+
+    virtual bool write(const Frame& frame) {
+        return DataStream::write(frame);
+    }
+
+    virtual bool finalize() {
+        if(!summary.empty()) {
+            string summary_string = "#SUM\n" + format_summary("", "=");
+            if(!reserve(summary_string.length())) {
+                return false;
+            }
+            memcpy(window + (offset - window_start), summary_string.c_str(), summary_string.length());
+            offset += summary_string.length();
+            header.flags |= DAT_SUMMARY;
+        }
+        if(output_settings.sync != SYNC_NONE && !sync()) {
+            return false;
+        }
+        close_mapping();
+        header.num_frames = frame_counter;
+	rewind(file);
+	fwrite(&header, sizeof(header), 1, file);
+	fflush(file);
+        if(output_settings.sync != SYNC_NONE) {
+            fdatasync(fileno(file));
+        }
+        return true;
+    }
+
+    virtual uint64_t bytes_written() const {
+        return offset - data_start;
+    }
+};
+
+#endif
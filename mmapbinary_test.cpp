@@ -0,0 +1,137 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Writes BIN_MMAP frames with a region of interest the way DRSSource fills
+ * them, all FRAME_MAX_SAMPLES into the placed waveform before the window is
+ * moved to its start, over more than one mapping window, and reads the file
+ * back. Run by ctest.
+ */
+
+#include "configuration.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "mmapbinary.h"
+#include "frame.h"
+
+#define TEST_FRAMES 30000
+#define TEST_ROI_START 200
+#define TEST_ROI_LENGTH 300
+
+static Frame frame;
+
+static float sample_value(uint32_t i, int position)
+{
+    // exact in a float
+    return static_cast<float>((i % 1000)*FRAME_MAX_SAMPLES + position);
+}
+
+static bool write_file(const std::string& name, int argc, char** argv)
+{
+    std::unique_ptr<MappedBinaryStream> stream(new MappedBinaryStream);
+    std::array<int, 4> ch_config{ {0, -1, -1, -1} };
+    RegionOfInterest roi(TEST_ROI_START, TEST_ROI_LENGTH);
+    if(!stream->init("", name, roi, -1, false, true, 100.0, ch_config, argc, argv) ||
+       !stream->write_header() || !stream->can_place()) {
+        std::cerr << "Cannot open '" << name << "'" << std::endl;
+        return false;
+    }
+    for(uint32_t i=0; i<TEST_FRAMES; i++) {
+        if(!stream->place(frame)) {
+            std::cerr << "Cannot place frame " << i << std::endl;
+            return false;
+        }
+        frame.timestamps.triggered = i;
+        for(int k=0; k<TEST_ROI_LENGTH; k++) {
+            frame.time[k] = i + k;
+        }
+        // like DRSBoard::GetWave, the whole domino ring
+        for(int j=0; j<FRAME_MAX_SAMPLES; j++) {
+            frame.data[0][j] = sample_value(i, j);
+        }
+        memmove(frame.data[0], frame.data[0] + roi.start, roi.length*sizeof(float));
+        if(!stream->write(frame)) {
+            std::cerr << "Cannot write frame " << i << std::endl;
+            return false;
+        }
+    }
+    return stream->finalize();
+}
+
+static bool check_file(const std::string& name)
+{
+    FILE* file = fopen(name.c_str(), "rb");
+    if(!file) {
+        std::cerr << "Cannot open '" << name << "'" << std::endl;
+        return false;
+    }
+    dat_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    if(!ok || header.version != 1 || header.num_frames != TEST_FRAMES ||
+       header.frames_per_sample != TEST_ROI_LENGTH || header.roi_start != TEST_ROI_START) {
+        std::cerr << "Unexpected header in '" << name << "'" << std::endl;
+        fclose(file);
+        return false;
+    }
+    // the frames are the end of the file, after the user header
+    size_t frame_size = 4*sizeof(int64_t) + 2*TEST_ROI_LENGTH*sizeof(float);
+    fseeko64(file, 0, SEEK_END);
+    off64_t data_start = ftello64(file) - static_cast<off64_t>(TEST_FRAMES*frame_size);
+    ok = data_start >= static_cast<off64_t>(sizeof(header)) && fseeko64(file, data_start, SEEK_SET) == 0;
+    std::vector<char> buffer(frame_size);
+    for(uint32_t i=0; ok && i<TEST_FRAMES; i++) {
+        if(fread(buffer.data(), frame_size, 1, file) != 1) {
+            std::cerr << "'" << name << "' ends in frame " << i << std::endl;
+            ok = false;
+            break;
+        }
+        int64_t timestamps[4];
+        memcpy(timestamps, buffer.data(), sizeof(timestamps));
+        const float* time = reinterpret_cast<const float*>(buffer.data() + sizeof(timestamps));
+        const float* data = time + TEST_ROI_LENGTH;
+        ok = timestamps[1] == i;
+        for(int k=0; ok && k<TEST_ROI_LENGTH; k++) {
+            ok = time[k] == i + k && data[k] == sample_value(i, TEST_ROI_START + k);
+        }
+        if(!ok) {
+            std::cerr << "Frame " << i << " of '" << name << "' differs" << std::endl;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::string name("mmapbinary_test.cdt");
+    bool ok = write_file(name, argc, argv) && check_file(name);
+    remove(name.c_str());
+    if(!ok) {
+        return 1;
+    }
+    std::cout << TEST_FRAMES << " frames with a region of interest written and read back" << std::endl;
+    return 0;
+}
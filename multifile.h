@@ -22,6 +22,7 @@
 #define _MULTIFILE_H_
 
 #include "datastream.h"
+#include "textbuffer.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,6 +33,28 @@ using namespace std;
 class MultiFileStream : public DataStream {
 protected:
     int frame_counter;
+    uint64_t bytes_counter;
+    TextBuffer buffer;
+
+    void write_text_header(const FrameTimestamps& timestamps) {
+        buffer.clear();
+        buffer.append("#TXT\n", 5);
+        buffer.printf("# cmd: %s\n# record timestamp: %li us\n",
+                      command_line.c_str(), timestamps.triggered / 1000);
+        buffer.printf("# timestamps: armed=%li triggered=%li transferred=%li written=%li ns\n",
+                      timestamps.armed, timestamps.triggered, timestamps.transferred, timestamps.written);
+    }
+    bool write_text_file(const char* fname) {
+        FILE* f = fopen(fname, "w");
+        if(!f) {
+            std::cerr << "Cannot open output file '" << fname << "', errno " << errno << std::endl;
+            return false;
+        }
+        fwrite(buffer.data(), 1, buffer.size(), f);
+        bytes_counter += buffer.size();
+        fclose(f);
+        return true;
+    }
     virtual bool init_stream() {
         filename = "sample";
         if(directory.length() == 0) {
@@ -55,12 +78,12 @@ protected:
     }
 
 public:
-    MultiFileStream() : frame_counter(0) {
+    MultiFileStream() : frame_counter(0), bytes_counter(0) {
     }
     virtual bool write_header() {
         return true;
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data) {
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) {
         if(frame_counter >= 1000000)
             return false;
         if(binary_output) {
@@ -72,32 +95,33 @@ public:
                 return false;
             }
             fwrite("#BIN\n", strlen("#BIN\n"), 1, f);
+            // armed, triggered, transferred and written as int64 ns
+            int64_t frame_timestamps[4] = {timestamps.armed, timestamps.triggered,
+                                           timestamps.transferred, timestamps.written};
+            fwrite(frame_timestamps, sizeof(frame_timestamps), 1, f);
             fwrite(&time, sizeof(float), frames_per_sample, f);
             fwrite(&data, sizeof(float), frames_per_sample, f);
+            bytes_counter += ftell(f);
             fclose(f);
         }
         else {
             char fname[1024];
             sprintf(fname, "%s%s_%06i.csv", directory.c_str(), filename.c_str(), frame_counter);
-            FILE* f = fopen(fname, "w");
-            if(!f) {
-                std::cerr << "Cannot open output file '" << fname << "', errno " << errno << std::endl;
-                return false;
-            }
-            fwrite("#TXT\n", strlen("#TXT\n"), 1, f);
-            fprintf(f, "# cmd: %s\n# record timestamp: %li us\n",
-                    command_line.c_str(), record_time.count() / 1000);
+            write_text_header(timestamps);
             for(int i=0; i<frames_per_sample; i++) {
-                fprintf(f, "%f", time[i]);
-                fprintf(f, " %f", data[i]);
-                fprintf(f, "\n");
+                buffer.append_fixed(time[i]);
+                buffer.append(' ');
+                buffer.append_fixed(data[i]);
+                buffer.append('\n');
+            }
+            if(!write_text_file(fname)) {
+                return false;
             }
-            fclose(f);
         }
         frame_counter++;
         return true;
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data) {
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data) {
         if(frame_counter >= 1000000)
             return false;
         if(binary_output) {
@@ -106,31 +130,45 @@ public:
         else {
             char fname[1024];
             sprintf(fname, "%s%s_%06i.csv", directory.c_str(), filename.c_str(), frame_counter);
-            FILE* f = fopen(fname, "w");
-            fwrite("#TXT\n", 5, 1, f);
-            fprintf(f, "# cmd: %s\n# record timestamp: %li us\n",
-                    command_line.c_str(), record_time.count() / 1000);
+            write_text_header(timestamps);
             for(int i=0; i<frames_per_sample; i++) {
-                fprintf(f, "%f", time[i]);
+                buffer.append_fixed(time[i]);
                 for(auto ch: ch_config) {
                     if(ch != -1) {
-                        fprintf(f, " %f", data[ch][i]);
+                        buffer.append(' ');
+                        buffer.append_fixed(data[ch][i]);
                     }
                 }
-                fprintf(f, "\n");
+                buffer.append('\n');
+            }
+            if(!write_text_file(fname)) {
+                return false;
             }
-            fclose(f);
         }
         frame_counter++;
         return true;
     }
     virtual bool finalize() {
+        if(!summary.empty()) {
+            string fname = directory + "summary.txt";
+            FILE* f = fopen(fname.c_str(), "w");
+            if(!f) {
+                std::cerr << "Cannot open output file '" << fname << "', errno " << errno << std::endl;
+                return false;
+            }
+            string summary_string = format_summary("# ", " = ");
+            fwrite(summary_string.c_str(), summary_string.length(), 1, f);
+            fclose(f);
+        }
         return true;
     }
 
     virtual std::string get_file_extension() const {
         return std::string(".unused");
     }
+    virtual uint64_t bytes_written() const {
+        return bytes_counter;
+    }
 };
 
 #endif
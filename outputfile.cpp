@@ -0,0 +1,709 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "configuration.h"
+#include "outputfile.h"
+#include "trace.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+ #include <linux/io_uring.h>
+ #include <sys/mman.h>
+ #include <sys/syscall.h>
+#endif
+
+using std::chrono::steady_clock;
+
+/// Two being written, one filling, one spare
+#define OUTPUT_BUFFERS 4
+/// Block size for O_DIRECT, enough for all common devices
+#define OUTPUT_ALIGNMENT 4096
+/// The file is extended in steps of this
+#define OUTPUT_PREALLOCATE (256ULL << 20)
+/// user_data of fsync requests, buffer indices otherwise
+#define URING_SYNC_TAG (~0ULL)
+
+bool parse_output_spec(const std::string& spec, OutputSettings& settings)
+{
+    std::vector<std::string> tokens;
+    boost::algorithm::split(tokens, spec, boost::algorithm::is_any_of(","));
+    if(tokens[0] == "stdio") settings.backend = OB_STDIO;
+    else if(tokens[0] == "thread") settings.backend = OB_THREAD;
+#ifdef HAVE_IO_URING
+    else if(tokens[0] == "uring") settings.backend = OB_URING;
+#endif
+    else return false;
+    for(size_t i=1; i<tokens.size(); i++) {
+        if(tokens[i] == "direct") {
+            settings.direct = true;
+            continue;
+        }
+        size_t eq = tokens[i].find('=');
+        if(eq == std::string::npos) {
+            return false;
+        }
+        std::string key = tokens[i].substr(0, eq);
+        std::string value = tokens[i].substr(eq + 1);
+        try {
+            if(key == "fsync" && value == "none") {
+                settings.sync = SYNC_NONE;
+            } else if(key == "fsync" && value == "close") {
+                settings.sync = SYNC_CLOSE;
+            } else if(key == "fsync") {
+                double seconds = boost::lexical_cast<double>(value);
+                if(seconds <= 0.0) {
+                    return false;
+                }
+                settings.sync = SYNC_INTERVAL;
+                settings.sync_interval = std::chrono::milliseconds(llround(seconds*1000.0));
+            } else if(key == "buffer") {
+                int megabytes = boost::lexical_cast<int>(value);
+                if(megabytes < 1 || megabytes > 1024) {
+                    return false;
+                }
+                settings.buffer_size = static_cast<size_t>(megabytes) << 20;
+            } else {
+                return false;
+            }
+        } catch(boost::bad_lexical_cast const& e) {
+            return false;
+        }
+    }
+    // stdio has no buffers of its own to align
+    return !(settings.direct && settings.backend == OB_STDIO);
+}
+
+std::string output_spec_name(const OutputSettings& settings)
+{
+    std::ostringstream ss;
+    switch(settings.backend) {
+        case OB_STDIO: ss << "stdio"; break;
+        case OB_THREAD: ss << "thread"; break;
+        case OB_URING: ss << "uring"; break;
+    }
+    if(settings.direct) ss << ",direct";
+    if(settings.sync == SYNC_CLOSE) ss << ",fsync=close";
+    if(settings.sync == SYNC_INTERVAL) ss << ",fsync=" << settings.sync_interval.count() / 1000.0;
+    if(settings.backend != OB_STDIO) ss << ",buffer=" << (settings.buffer_size >> 20);
+    return ss.str();
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Minimal io_uring submission and completion queue on the raw system calls,
+ * requests are submitted one at a time right away.
+ */
+class UringQueue {
+public:
+    UringQueue();
+    ~UringQueue();
+
+    /// False with errno set if io_uring is not available
+    bool setup(unsigned entries);
+    /// drain: start only after all earlier requests completed
+    bool write(int fd, const struct iovec* iov, uint64_t offset, uint64_t user_data, bool drain);
+    /// fdatasync() after all earlier requests completed
+    bool sync(int fd, uint64_t user_data);
+    /// 1 and the next completion, 0 if there is none and not waiting, -1 on errors
+    int complete(bool wait, uint64_t& user_data, int& result);
+
+private:
+    bool push(const io_uring_sqe& sqe);
+    bool enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+    int m_fd;
+    void* m_sq;
+    size_t m_sq_size;
+    void* m_cq;
+    size_t m_cq_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned* m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned* m_cq_mask;
+    io_uring_cqe* m_cqes;
+};
+
+UringQueue::UringQueue()
+: m_fd(-1), m_sq(MAP_FAILED), m_sq_size(0), m_cq(MAP_FAILED), m_cq_size(0),
+m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), m_sqes_size(0)
+{
+}
+
+UringQueue::~UringQueue()
+{
+    if(m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+    if(m_cq != MAP_FAILED && m_cq != m_sq) munmap(m_cq, m_cq_size);
+    if(m_sq != MAP_FAILED) munmap(m_sq, m_sq_size);
+    if(m_fd >= 0) close(m_fd);
+}
+
+bool UringQueue::setup(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_fd < 0) {
+        return false;
+    }
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+    }
+    m_sq = mmap(NULL, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sq == MAP_FAILED) {
+        return false;
+    }
+    m_cq = single_mmap? m_sq : mmap(NULL, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    m_fd, IORING_OFF_CQ_RING);
+    if(m_cq == MAP_FAILED) {
+        return false;
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe*>(mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             m_fd, IORING_OFF_SQES));
+    if(m_sqes == MAP_FAILED) {
+        return false;
+    }
+    char* sq = static_cast<char*>(m_sq);
+    m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(m_cq);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool UringQueue::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    for(;;) {
+        int ret = syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, NULL, 0);
+        if(ret >= 0) {
+            return true;
+        }
+        if(errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+bool UringQueue::push(const io_uring_sqe& sqe)
+{
+    // only this thread moves the tail, the kernel the head
+    unsigned tail = *m_sq_tail;
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if(tail - head > *m_sq_mask) {
+        errno = EBUSY;
+        return false;
+    }
+    unsigned index = tail & *m_sq_mask;
+    m_sqes[index] = sqe;
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return enter(1, 0, 0);
+}
+
+bool UringQueue::write(int fd, const struct iovec* iov, uint64_t offset, uint64_t user_data, bool drain)
+{
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.flags = drain? IOSQE_IO_DRAIN : 0;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uintptr_t>(iov);
+    sqe.len = 1;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    return push(sqe);
+}
+
+bool UringQueue::sync(int fd, uint64_t user_data)
+{
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_FSYNC;
+    sqe.flags = IOSQE_IO_DRAIN;
+    sqe.fd = fd;
+    sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe.user_data = user_data;
+    return push(sqe);
+}
+
+int UringQueue::complete(bool wait, uint64_t& user_data, int& result)
+{
+    for(;;) {
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        if(head != tail) {
+            const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+            user_data = cqe.user_data;
+            result = cqe.res;
+            __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+            return 1;
+        }
+        if(!wait) {
+            return 0;
+        }
+        if(!enter(0, 1, IORING_ENTER_GETEVENTS)) {
+            return -1;
+        }
+    }
+}
+#else
+/// Without the io_uring header, parse_output_spec() does not offer it
+class UringQueue {
+public:
+    bool setup(unsigned entries) { errno = ENOSYS; return false; }
+    bool write(int fd, const struct iovec* iov, uint64_t offset, uint64_t user_data, bool drain) { return false; }
+    bool sync(int fd, uint64_t user_data) { return false; }
+    int complete(bool wait, uint64_t& user_data, int& result) { return -1; }
+};
+#endif
+
+OutputFile::OutputFile()
+: m_file(NULL), m_fd(-1), m_own_fd(false), m_open(false), m_current(0), m_end(0),
+m_allocated(0), m_preallocate(true), m_requests(0), m_failed(false), m_drain(false),
+m_stop(false), m_error(0)
+{
+}
+
+OutputFile::~OutputFile()
+{
+    if(m_open) {
+        close();
+    }
+    for(auto& buffer: m_buffers) {
+        free(buffer.data);
+    }
+}
+
+bool OutputFile::fail(const char* what, int error)
+{
+    if(!m_failed) {
+        std::cerr << what << ": " << strerror(error) << std::endl;
+    }
+    m_failed = true;
+    return false;
+}
+
+bool OutputFile::open(FILE* file, const std::string& path, const OutputSettings& settings)
+{
+    m_settings = settings;
+    m_file = file;
+    m_open = true;
+    m_last_sync = steady_clock::now();
+    if(m_settings.backend == OB_STDIO) {
+        return true;
+    }
+    if(fflush(file) != 0) {
+        return fail("Writing output failed", errno);
+    }
+    m_end = ftello64(file);
+    m_fd = fileno(file);
+    if(m_settings.direct) {
+        // a descriptor of its own, the header is updated through the FILE at the end
+        int fd = ::open(path.c_str(), O_RDWR | O_DIRECT | O_CLOEXEC);
+        if(fd < 0) {
+            std::cerr << "Cannot open '" << path << "' for direct I/O (" << strerror(errno)
+                      << "), writing through the page cache" << std::endl;
+            m_settings.direct = false;
+        } else {
+            m_fd = fd;
+            m_own_fd = true;
+        }
+    }
+    m_settings.buffer_size = (m_settings.buffer_size + OUTPUT_ALIGNMENT - 1) / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+    m_buffers.resize(OUTPUT_BUFFERS);
+    for(auto& buffer: m_buffers) {
+        if(posix_memalign(reinterpret_cast<void**>(&buffer.data), OUTPUT_ALIGNMENT, m_settings.buffer_size) != 0) {
+            buffer.data = NULL;
+            return fail("Cannot allocate output buffers", ENOMEM);
+        }
+        buffer.offset = 0;
+        buffer.length = 0;
+        buffer.busy = false;
+    }
+    m_current = 0;
+    Buffer& first = m_buffers[0];
+    first.offset = m_end;
+    if(m_settings.direct) {
+        // the data starts in the last block of the header, which is written again
+        first.offset = m_end / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+        first.length = m_end - first.offset;
+        if(first.length > 0) {
+            ssize_t n = pread(m_fd, first.data, OUTPUT_ALIGNMENT, first.offset);
+            if(n < static_cast<ssize_t>(first.length)) {
+                return fail("Cannot read back the file header", n < 0? errno : EIO);
+            }
+        }
+    }
+    m_allocated = m_end;
+    if(m_settings.backend == OB_URING) {
+        m_uring.reset(new UringQueue);
+        if(!m_uring->setup(4*OUTPUT_BUFFERS)) {
+            std::cerr << "io_uring is not available (" << strerror(errno) << "), writing from a thread instead" << std::endl;
+            m_uring.reset();
+            m_settings.backend = OB_THREAD;
+        }
+    }
+    if(m_settings.backend == OB_THREAD) {
+        m_thread = std::thread(&OutputFile::run, this);
+    }
+    return true;
+}
+
+uint64_t OutputFile::offset() const
+{
+    if(m_settings.backend == OB_STDIO) {
+        return m_file? ftello64(m_file) : 0;
+    }
+    return m_end;
+}
+
+bool OutputFile::write(const void* data, size_t length)
+{
+    if(m_failed) {
+        return false;
+    }
+    if(m_settings.backend == OB_STDIO) {
+        if(fwrite(data, 1, length, m_file) != length) {
+            return fail("Writing output failed", errno);
+        }
+        return !sync_due() || sync_now();
+    }
+    const char* in = static_cast<const char*>(data);
+    while(length > 0) {
+        Buffer& buffer = m_buffers[m_current];
+        size_t chunk = std::min(length, m_settings.buffer_size - buffer.length);
+        memcpy(buffer.data + buffer.length, in, chunk);
+        buffer.length += chunk;
+        m_end += chunk;
+        in += chunk;
+        length -= chunk;
+        if(buffer.length == m_settings.buffer_size && !(submit() && next_buffer())) {
+            return false;
+        }
+    }
+    return !sync_due() || sync_now();
+}
+
+bool OutputFile::flush()
+{
+    if(m_failed) {
+        return false;
+    }
+    if(m_settings.backend == OB_STDIO) {
+        m_requests++;
+        if(fflush(m_file) != 0) {
+            return fail("Writing output failed", errno);
+        }
+        return true;
+    }
+    if(m_uring) {
+        // completions are in shared memory, no system call
+        reap(false);
+    } else if(m_error) {
+        return fail("Writing output failed", m_error);
+    }
+    return !m_failed;
+}
+
+bool OutputFile::sync_now()
+{
+    if(m_settings.backend == OB_STDIO) {
+        m_requests++;
+        if(fflush(m_file) != 0) {
+            return fail("Writing output failed", errno);
+        }
+        if(fdatasync(fileno(m_file)) != 0) {
+            return fail("Syncing output failed", errno);
+        }
+        return true;
+    }
+    // durable up to here, so the partial buffer goes out now
+    return submit() && next_buffer() && request_sync();
+}
+
+bool OutputFile::sync_due()
+{
+    if(m_settings.sync != SYNC_INTERVAL) {
+        return false;
+    }
+    auto now = steady_clock::now();
+    if(now - m_last_sync < m_settings.sync_interval) {
+        return false;
+    }
+    m_last_sync = now;
+    return true;
+}
+
+void OutputFile::preallocate(uint64_t end)
+{
+    if(!m_preallocate || end <= m_allocated) {
+        return;
+    }
+    // KEEP_SIZE: a file cut short by a crash does not end in zeros
+    uint64_t length = std::max<uint64_t>(OUTPUT_PREALLOCATE, end - m_allocated);
+    if(fallocate(m_fd, FALLOC_FL_KEEP_SIZE, m_allocated, length) != 0) {
+        // not supported by the file system, or full: the writes will tell
+        m_preallocate = false;
+        return;
+    }
+    m_allocated += length;
+}
+
+bool OutputFile::submit()
+{
+    Buffer& buffer = m_buffers[m_current];
+    if(buffer.length == 0 || m_failed) {
+        return !m_failed;
+    }
+    if(m_settings.direct) {
+        size_t padded = (buffer.length + OUTPUT_ALIGNMENT - 1) / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+        memset(buffer.data + buffer.length, 0, padded - buffer.length);
+        buffer.length = padded;
+    }
+    preallocate(buffer.offset + buffer.length);
+    m_requests++;
+    if(m_uring) {
+        TraceSpan span("submit_output");
+        buffer.busy = true;
+        buffer.iov.iov_base = buffer.data;
+        buffer.iov.iov_len = buffer.length;
+        if(!m_uring->write(m_fd, &buffer.iov, buffer.offset, m_current, m_drain)) {
+            buffer.busy = false;
+            return fail("Submitting to io_uring failed", errno);
+        }
+        m_drain = false;
+        reap(false);
+        return !m_failed;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        buffer.busy = true;
+        m_queue.push_back(&buffer);
+    }
+    m_work.notify_one();
+    return true;
+}
+
+bool OutputFile::next_buffer()
+{
+    Buffer& previous = m_buffers[m_current];
+    // direct requests start on a block, a partial last block is written again
+    uint64_t start = m_settings.direct? m_end / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT : m_end;
+    size_t tail = m_end - start;
+    m_current = (m_current + 1) % m_buffers.size();
+    Buffer& buffer = m_buffers[m_current];
+    if(m_uring) {
+        if(buffer.busy) {
+            TraceSpan span("wait_output");
+            while(buffer.busy) {
+                if(!reap(true)) {
+                    return fail("Waiting for io_uring failed", errno);
+                }
+            }
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(buffer.busy) {
+            TraceSpan span("wait_output");
+            m_done.wait(lock, [&buffer]{ return !buffer.busy; });
+        }
+    }
+    if(m_error) {
+        return fail("Writing output failed", m_error);
+    }
+    // the previous buffer may still be read by the kernel, which is fine
+    memcpy(buffer.data, previous.data + (start - previous.offset), tail);
+    buffer.offset = start;
+    buffer.length = tail;
+    // with io_uring, requests may run in any order
+    m_drain = tail > 0;
+    return !m_failed;
+}
+
+bool OutputFile::request_sync()
+{
+    m_requests++;
+    if(m_uring) {
+        if(!m_uring->sync(m_fd, URING_SYNC_TAG)) {
+            return fail("Submitting to io_uring failed", errno);
+        }
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(NULL);
+    }
+    m_work.notify_one();
+    return true;
+}
+
+bool OutputFile::reap(bool wait)
+{
+    uint64_t tag;
+    int result;
+    int got;
+    while((got = m_uring->complete(wait, tag, result)) > 0) {
+        wait = false;
+        if(tag == URING_SYNC_TAG) {
+            if(result < 0) {
+                fail("Syncing output failed", -result);
+            }
+            continue;
+        }
+        Buffer& buffer = m_buffers[tag];
+        if(result < 0) {
+            fail("Writing output failed", -result);
+        } else if(static_cast<size_t>(result) < buffer.length && !m_failed) {
+            // short write, rare enough to finish it right here
+            Buffer rest = buffer;
+            rest.data += result;
+            rest.offset += result;
+            rest.length -= result;
+            if(!write_all(rest)) {
+                fail("Writing output failed", errno);
+            }
+        }
+        buffer.busy = false;
+    }
+    return got >= 0;
+}
+
+bool OutputFile::write_all(const Buffer& buffer)
+{
+    size_t done = 0;
+    while(done < buffer.length) {
+        ssize_t n = pwrite(m_fd, buffer.data + done, buffer.length - done, buffer.offset + done);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void OutputFile::run()
+{
+    Trace::set_thread_name("output");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;) {
+        m_work.wait(lock, [this]{ return m_stop || !m_queue.empty(); });
+        if(m_queue.empty()) {
+            return;
+        }
+        Buffer* buffer = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+        int error = 0;
+        // nothing more is written after an error, buffers are only given back
+        if(!m_error) {
+            if(buffer) {
+                TraceSpan span("pwrite");
+                if(!write_all(*buffer)) error = errno;
+            } else {
+                TraceSpan span("fdatasync");
+                if(fdatasync(m_fd) != 0) error = errno;
+            }
+        }
+        lock.lock();
+        if(error && !m_error) {
+            m_error = error;
+        }
+        if(buffer) {
+            buffer->busy = false;
+        }
+        m_done.notify_all();
+    }
+}
+
+bool OutputFile::close()
+{
+    if(!m_open) {
+        return !m_failed;
+    }
+    m_open = false;
+    if(m_settings.backend == OB_STDIO) {
+        if(fflush(m_file) != 0) {
+            return fail("Writing output failed", errno);
+        }
+        if(m_settings.sync != SYNC_NONE && fdatasync(fileno(m_file)) != 0) {
+            return fail("Syncing output failed", errno);
+        }
+        return !m_failed;
+    }
+    submit();
+    // all buffers back, even after errors, the kernel may still read them
+    if(m_uring) {
+        for(auto& buffer: m_buffers) {
+            while(buffer.busy && reap(true));
+        }
+        m_uring.reset();
+    } else if(m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work.notify_all();
+        m_thread.join();
+    }
+    if(m_error) {
+        fail("Writing output failed", m_error);
+    }
+    // padding of direct writes and preallocated space are cut off
+    if(!m_failed && (m_settings.direct || m_allocated > m_end) && ftruncate(m_fd, m_end) != 0) {
+        fail("Cannot truncate output", errno);
+    }
+    if(!m_failed && m_settings.sync != SYNC_NONE && fdatasync(m_fd) != 0) {
+        fail("Syncing output failed", errno);
+    }
+    if(m_own_fd) {
+        ::close(m_fd);
+        m_own_fd = false;
+    }
+    m_fd = -1;
+    return !m_failed;
+}
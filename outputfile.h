@@ -0,0 +1,165 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+/**
+ * How the frames of a file based format get to the disk
+ */
+enum output_backend_t {
+    OB_STDIO,   ///< fwrite() and fflush() after every frame, the default
+    OB_THREAD,  ///< large buffers written with pwrite() by a thread of their own
+    OB_URING    ///< large buffers written through io_uring from the writing thread
+};
+
+/**
+ * When written data is forced to the disk with fdatasync()
+ */
+enum sync_policy_t {
+    SYNC_NONE,     ///< left to the kernel
+    SYNC_CLOSE,    ///< once, when the file is closed
+    SYNC_INTERVAL  ///< every sync_interval and when the file is closed
+};
+
+struct OutputSettings {
+    output_backend_t backend;
+    /// O_DIRECT, past the page cache, for the buffered backends
+    bool direct;
+    sync_policy_t sync;
+    std::chrono::milliseconds sync_interval;
+    /// size of each of the OUTPUT_BUFFERS buffers
+    size_t buffer_size;
+
+    OutputSettings() : backend(OB_STDIO), direct(false), sync(SYNC_NONE), sync_interval(0), buffer_size(4 << 20) {}
+};
+
+/// Parse "stdio|thread|uring[,direct][,fsync=none|close|SECONDS][,buffer=MB]"
+bool parse_output_spec(const std::string& spec, OutputSettings& settings);
+std::string output_spec_name(const OutputSettings& settings);
+
+class UringQueue;
+
+/**
+ * Sequential writer of the data part of an output file.
+ *
+ * The file is opened with stdio by the stream, which writes its header and
+ * hands over. With OB_STDIO everything stays with the FILE. Otherwise data
+ * is collected into OUTPUT_BUFFERS aligned buffers of buffer_size bytes, a
+ * full buffer goes to the disk in one request while the next one fills, so
+ * there is about one request per buffer instead of one per frame. The file
+ * is extended with fallocate() ahead of the writes, which keeps its extents
+ * contiguous. With direct, requests bypass the page cache: the data starts
+ * at the block boundary before the header end, the tail is padded to a
+ * block and cut off again when closing.
+ *
+ * Not thread safe, write() and close() come from the stream's thread.
+ */
+class OutputFile {
+public:
+    OutputFile();
+    ~OutputFile();
+
+    /// Continue file at its current position, path is needed for direct
+    bool open(FILE* file, const std::string& path, const OutputSettings& settings);
+    /// Append, false once writing failed
+    bool write(const void* data, size_t length);
+    /// After a frame: fflush() with OB_STDIO, otherwise only a check for errors
+    bool flush();
+    /// Write and wait for everything, sync as configured. The FILE stays open for header updates
+    bool close();
+
+    /// Position in the file after the data written so far
+    uint64_t offset() const;
+    /// Write requests sent to the kernel so far
+    uint64_t requests() const { return m_requests; }
+    const OutputSettings& settings() const { return m_settings; }
+
+private:
+    struct Buffer {
+        char* data;
+        uint64_t offset;
+        size_t length;
+        /// written by the thread or io_uring
+        bool busy;
+        struct iovec iov;
+    };
+
+    /// Send the current buffer to the disk, padded to a block with direct
+    bool submit();
+    /// Wait until the next buffer is free and continue the data there
+    bool next_buffer();
+    /// fdatasync() after the requests submitted so far
+    bool request_sync();
+    void preallocate(uint64_t end);
+    bool sync_due();
+    /// Everything written so far to the disk, with the fsync=SECONDS policy
+    bool sync_now();
+    bool fail(const char* what, int error);
+    bool write_all(const Buffer& buffer);
+    /// Handle io_uring completions, false if waiting failed
+    bool reap(bool wait);
+    void run();
+
+    OutputSettings m_settings;
+    FILE* m_file;
+    int m_fd;
+    bool m_own_fd;
+    bool m_open;
+    std::vector<Buffer> m_buffers;
+    size_t m_current;
+    /// logical end of the data, the file is cut here on close
+    uint64_t m_end;
+    uint64_t m_allocated;
+    bool m_preallocate;
+    uint64_t m_requests;
+    std::chrono::steady_clock::time_point m_last_sync;
+    bool m_failed;
+
+    std::unique_ptr<UringQueue> m_uring;
+    /// the next write overlaps the block padded by the previous one
+    bool m_drain;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_done;
+    /// NULL entries request an fdatasync()
+    std::deque<Buffer*> m_queue;
+    bool m_stop;
+    std::atomic<int> m_error;
+};
+
+#endif // OUTPUTFILE_H
@@ -0,0 +1,237 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "parallelgzip.h"
+#include "metrics.h"
+#include "outputfile.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <zlib.h>
+
+/// pigz uses 128 kB too, large enough that the dictionary loss does not matter
+#define PGZ_BLOCK_SIZE (128*1024)
+#define PGZ_DICTIONARY_SIZE (32*1024)
+
+ParallelGzip::ParallelGzip(OutputFile* output, int level, int threads)
+: m_output(output), m_level(level), m_metrics(NULL),
+m_max_in_flight(2*std::max(threads, 1) + 2),
+m_crc(crc32(0L, Z_NULL, 0)), m_length(0), m_bytes_written(0),
+m_started(false), m_finished(false), m_failed(false), m_stop(false)
+{
+    m_pending.reserve(PGZ_BLOCK_SIZE);
+    for(int i=0; i<std::max(threads, 1); i++) {
+        m_threads.emplace_back(&ParallelGzip::run, this);
+    }
+}
+
+ParallelGzip::~ParallelGzip()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_work.notify_all();
+    for(auto& thread: m_threads) {
+        thread.join();
+    }
+}
+
+bool ParallelGzip::write(const char* data, size_t length)
+{
+    while(length > 0 && !m_failed) {
+        size_t chunk = std::min(length, PGZ_BLOCK_SIZE - m_pending.size());
+        m_pending.append(data, chunk);
+        data += chunk;
+        length -= chunk;
+        if(m_pending.size() == PGZ_BLOCK_SIZE) {
+            submit(m_level, false);
+        }
+    }
+    return !m_failed;
+}
+
+bool ParallelGzip::write_stored(const char* data, size_t length)
+{
+    if(!m_pending.empty()) {
+        submit(m_level, false);
+    }
+    while(length > 0 && !m_failed) {
+        size_t chunk = std::min(length, static_cast<size_t>(PGZ_BLOCK_SIZE));
+        m_pending.assign(data, chunk);
+        data += chunk;
+        length -= chunk;
+        submit(0, false);
+    }
+    return !m_failed;
+}
+
+bool ParallelGzip::finish()
+{
+    if(m_finished) {
+        return !m_failed;
+    }
+    m_finished = true;
+    // the last block sets the final bit, even if it is empty
+    submit(m_level, true);
+    if(!write_blocks(0)) {
+        return false;
+    }
+    unsigned char trailer[8];
+    for(int i=0; i<4; i++) {
+        trailer[i] = (m_crc >> 8*i) & 0xff;
+        trailer[4+i] = (m_length >> 8*i) & 0xff;
+    }
+    if(!m_output->write(trailer, sizeof(trailer))) {
+        m_failed = true;
+        return false;
+    }
+    m_bytes_written += sizeof(trailer);
+    return true;
+}
+
+void ParallelGzip::submit(int level, bool last)
+{
+    if(m_failed) {
+        m_pending.clear();
+        return;
+    }
+    if(!m_started) {
+        // gzip header: deflate, no name, no time, unix
+        static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        if(!m_output->write(header, sizeof(header))) {
+            m_failed = true;
+            return;
+        }
+        m_bytes_written += sizeof(header);
+        m_started = true;
+    }
+    std::shared_ptr<Block> block(new Block);
+    block->input.swap(m_pending);
+    block->dictionary = m_dictionary;
+    block->level = level;
+    block->last = last;
+    block->crc = 0;
+    block->done = false;
+    if(block->input.size() >= PGZ_DICTIONARY_SIZE) {
+        m_dictionary.assign(block->input, block->input.size() - PGZ_DICTIONARY_SIZE, PGZ_DICTIONARY_SIZE);
+    } else {
+        m_dictionary.append(block->input);
+        if(m_dictionary.size() > PGZ_DICTIONARY_SIZE) {
+            m_dictionary.erase(0, m_dictionary.size() - PGZ_DICTIONARY_SIZE);
+        }
+    }
+    m_pending.reserve(PGZ_BLOCK_SIZE);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_in_flight.push_back(block);
+        m_queue.push_back(block.get());
+    }
+    m_work.notify_one();
+    write_blocks(m_max_in_flight);
+}
+
+bool ParallelGzip::write_blocks(size_t max_in_flight)
+{
+    for(;;) {
+        std::shared_ptr<Block> block;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_in_flight.empty()) {
+                break;
+            }
+            if(m_in_flight.size() > max_in_flight) {
+                m_done.wait(lock, [this]() { return m_in_flight.front()->done; });
+            } else if(!m_in_flight.front()->done) {
+                break;
+            }
+            block = m_in_flight.front();
+            m_in_flight.pop_front();
+        }
+        if(m_failed) {
+            continue;
+        }
+        m_crc = crc32_combine(m_crc, block->crc, block->input.size());
+        m_length += block->input.size();
+        if(!block->output.empty() && !m_output->write(block->output.data(), block->output.size())) {
+            m_failed = true;
+            continue;
+        }
+        m_bytes_written += block->output.size();
+    }
+    return !m_failed;
+}
+
+void ParallelGzip::compress(Block& block)
+{
+    auto start = std::chrono::steady_clock::now();
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // raw deflate, the gzip header and trailer are written around all blocks
+    deflateInit2(&stream, block.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if(!block.dictionary.empty()) {
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(block.dictionary.data()),
+                             block.dictionary.size());
+    }
+    // room for the worst case, plus the empty stored block of the flush
+    block.output.resize(deflateBound(&stream, block.input.size()) + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(&block.input[0]);
+    stream.avail_in = block.input.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&block.output[0]);
+    stream.avail_out = block.output.size();
+    int flush = block.last? Z_FINISH : Z_SYNC_FLUSH;
+    while(deflate(&stream, flush) == Z_OK && stream.avail_out == 0) {
+        size_t used = block.output.size();
+        block.output.resize(2*used);
+        stream.next_out = reinterpret_cast<Bytef*>(&block.output[used]);
+        stream.avail_out = block.output.size() - used;
+    }
+    block.output.resize(block.output.size() - stream.avail_out);
+    deflateEnd(&stream);
+    block.crc = crc32(0L, reinterpret_cast<const Bytef*>(block.input.data()), block.input.size());
+    if(m_metrics) {
+        m_metrics->record(MS_COMPRESS, std::chrono::steady_clock::now() - start);
+    }
+}
+
+void ParallelGzip::run()
+{
+    Trace::set_thread_name("gzip");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;) {
+        m_work.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+        if(m_queue.empty()) {
+            return;
+        }
+        Block* block = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+        {
+            TraceSpan span("deflate");
+            compress(*block);
+        }
+        lock.lock();
+        block->done = true;
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef PARALLELGZIP_H
+#define PARALLELGZIP_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+class LaneMetrics;
+class OutputFile;
+
+/**
+ * gzip writer that compresses blocks of the stream on a pool of threads,
+ * the way pigz does.
+ *
+ * The input is cut into blocks of PGZ_BLOCK_SIZE bytes. Every block is
+ * deflated on its own, with the last 32 kB of the previous block as
+ * dictionary, so the ratio is close to that of a single deflate stream.
+ * Blocks end on a byte boundary (Z_SYNC_FLUSH) and are written in order,
+ * forming one gzip member with the CRC of all input. Any gzip reader
+ * reads the result. The OutputFile is closed by the owner after finish().
+ *
+ * write() and finish() must be called from one thread. Compressed blocks
+ * are written to the file from that thread too, at most a few blocks per
+ * compression thread are in flight.
+ */
+class ParallelGzip {
+public:
+    ParallelGzip(OutputFile* output, int level, int threads);
+    ~ParallelGzip();
+
+    /// Compression time of every block goes here if set
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+    /// Level of the blocks submitted from now on
+    void set_level(int level) { m_level = level; }
+
+    /// Append to the stream, false once writing the file failed
+    bool write(const char* data, size_t length);
+    /// Append uncompressed (level 0), in blocks of their own, e.g. headers
+    bool write_stored(const char* data, size_t length);
+    /// Compress what is left and end the gzip member, false if writing failed
+    bool finish();
+
+    /// Compressed bytes written to the file so far
+    uint64_t bytes_written() const { return m_bytes_written; }
+
+private:
+    struct Block {
+        std::string input;
+        /// last 32 kB of the input before this block
+        std::string dictionary;
+        int level;
+        bool last;
+        std::string output;
+        unsigned long crc;
+        bool done;
+    };
+
+    void submit(int level, bool last);
+    void compress(Block& block);
+    /// Write the finished blocks at the front, waiting while more than max_in_flight are left
+    bool write_blocks(size_t max_in_flight);
+    void run();
+
+    OutputFile* m_output;
+    int m_level;
+    LaneMetrics* m_metrics;
+    std::string m_pending;
+    std::string m_dictionary;
+    std::deque<std::shared_ptr<Block> > m_in_flight;
+    size_t m_max_in_flight;
+    unsigned long m_crc;
+    uint64_t m_length;
+    uint64_t m_bytes_written;
+    bool m_started;
+    bool m_finished;
+    bool m_failed;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_done;
+    std::deque<Block*> m_queue;
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+};
+
+#endif // PARALLELGZIP_H
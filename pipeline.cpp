@@ -0,0 +1,245 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "pipeline.h"
+#include "cellcalibration.h"
+#include "framesource.h"
+#include "levelcontrol.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <iostream>
+
+using std::chrono::high_resolution_clock;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+
+double StageStats::busy_rate() const
+{
+    if(busy.count() == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(frames) / static_cast<double>(busy.count()) * 1e9;
+}
+
+FrameWriter::FrameWriter(FrameRing& ring, DataStream& stream)
+: m_ring(ring), m_stream(stream), m_calibration(NULL), m_metrics(NULL), m_level_control(NULL), m_failed(false), m_frames(0), m_busy_ns(0)
+{
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+}
+
+void FrameWriter::start()
+{
+    m_thread = std::thread(&FrameWriter::run, this);
+}
+
+void FrameWriter::finish()
+{
+    m_ring.close();
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+StageStats FrameWriter::stats() const
+{
+    StageStats s;
+    s.frames = m_frames;
+    s.busy = nanoseconds(m_busy_ns);
+    return s;
+}
+
+void FrameWriter::run()
+{
+    Trace::set_thread_name("writer");
+    Backoff backoff;
+    for(;;) {
+        Frame* frame = m_ring.pop();
+        if(!frame) {
+            if(!m_ring.closed()) {
+                backoff.pause();
+                continue;
+            }
+            // the producer may have published between pop() and closed()
+            frame = m_ring.pop();
+            if(!frame) {
+                break;
+            }
+        }
+        backoff.reset();
+        if(!m_failed) {
+            if(m_calibration) {
+                m_calibration->apply(*frame);
+            }
+            auto start = high_resolution_clock::now();
+            if(!frame->timestamps.written) {
+                frame->timestamps.written = RunClock::now();
+            }
+            try {
+                TraceSpan span("write_frame");
+                if(!m_stream.write(*frame)) {
+                    m_failed = true;
+                }
+            } catch(DataStream::not_suppported_write& e) {
+                std::cerr << "\nWriting frame failed: " << e.what() << std::endl;
+                m_failed = true;
+            }
+            auto end = high_resolution_clock::now();
+            m_busy_ns += duration_cast<nanoseconds>(end - start).count();
+            if(!m_failed) {
+                m_frames++;
+                if(m_metrics) {
+                    m_metrics->record(MS_WRITE, duration_cast<steady_clock::duration>(end - start));
+                    m_metrics->count_written(m_stream.bytes_written());
+                }
+                if(m_level_control && m_level_control->update(m_ring.fill(), m_ring.capacity(),
+                                                              duration_cast<nanoseconds>(end - start), steady_clock::now())) {
+                    m_stream.set_compression_level(m_level_control->level());
+                }
+            }
+        }
+        m_ring.release(frame);
+    }
+}
+
+CaptureWorker::CaptureWorker(FrameSource& source, FrameRing& ring, int board, const std::atomic<bool>& abort)
+: m_source(source), m_ring(ring), m_board(board), m_abort(abort),
+m_metrics(NULL), m_pending(0), m_stop(false), m_exhausted(false)
+{
+}
+
+CaptureWorker::~CaptureWorker()
+{
+    stop();
+}
+
+void CaptureWorker::start()
+{
+    m_thread = std::thread(&CaptureWorker::run, this);
+}
+
+void CaptureWorker::run_batch(unsigned int num_frames)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending = num_frames;
+    }
+    m_cond.notify_all();
+}
+
+bool CaptureWorker::wait_batch()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this]{ return m_pending == 0; });
+    return !m_exhausted;
+}
+
+void CaptureWorker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+StageStats CaptureWorker::stats() const
+{
+    return m_stats;
+}
+
+void CaptureWorker::run()
+{
+    Trace::set_thread_name("capture board " + std::to_string(m_board));
+    for(;;) {
+        unsigned int batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_stop || m_pending > 0; });
+            if(m_stop) {
+                return;
+            }
+            batch = m_pending;
+        }
+        for(unsigned int i=0; i<batch && !m_abort && !m_exhausted; i++) {
+            Frame* frame;
+            while(!(frame = m_ring.claim(std::chrono::milliseconds(100))) && !m_abort);
+            if(!frame) {
+                break;
+            }
+            auto capture_start = steady_clock::now();
+            frame->board = m_board;
+            frame->timestamps = FrameTimestamps();
+            bool captured;
+            {
+                TraceSpan span("capture");
+                captured = m_source.capture(*frame);
+            }
+            if(!captured) {
+                m_exhausted = !m_abort;
+                break;
+            }
+            m_stats.busy += duration_cast<nanoseconds>(steady_clock::now() - capture_start);
+            m_stats.frames++;
+            m_live_time.add(frame->timestamps);
+            if(m_metrics) {
+                m_metrics->count_captured();
+            }
+            m_ring.publish(frame);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending = 0;
+        }
+        m_cond.notify_all();
+    }
+}
+
+void print_stage_stats(const std::string& name, const StageStats& stats, const nanoseconds& total_time)
+{
+    double busy_fraction = 0.0;
+    if(total_time.count() > 0) {
+        busy_fraction = static_cast<double>(stats.busy.count()) / static_cast<double>(total_time.count());
+    }
+    uint64_t us_per_frame = 0;
+    if(stats.frames > 0) {
+        us_per_frame = stats.busy.count() / stats.frames / 1000;
+    }
+    std::cout << "  " << name << ": " << stats.frames << " frames, "
+              << us_per_frame << " us/frame, "
+              << stats.busy_rate() << " Hz max, "
+              << busy_fraction*100.0 << "% busy" << std::endl;
+}
+
+void print_ring_stats(const FrameRing& ring)
+{
+    std::cout << "  ring: " << ring.capacity() << " slots, max. fill " << ring.max_fill()
+              << ", policy " << ring_policy_name(ring.policy())
+              << ", dropped " << ring.dropped_newest() << " newest / "
+              << ring.dropped_oldest() << " oldest" << std::endl;
+}
@@ -0,0 +1,140 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "frame.h"
+#include "framering.h"
+#include "datastream.h"
+#include "runclock.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class FrameSource;
+class CellCalibration;
+class LaneMetrics;
+class LevelController;
+
+/**
+ * Busy time and frame count of one stage of the acquisition pipeline.
+ */
+struct StageStats {
+    uint64_t frames;
+    nanoseconds busy;
+
+    StageStats() : frames(0), busy(0) {}
+    double busy_rate() const;
+};
+
+/**
+ * Writer thread draining a FrameRing into a DataStream.
+ *
+ * A DataStream is stateful and expects its frames in order, so there is
+ * exactly one writer per stream.
+ */
+class FrameWriter {
+public:
+    FrameWriter(FrameRing& ring, DataStream& stream);
+    ~FrameWriter();
+
+    /// Calibrate raw frames in the writer thread before writing them
+    void set_calibration(CellCalibration* calibration) { m_calibration = calibration; }
+    /// Record write durations and count written frames and bytes
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+    /// Adapt the compression level of the stream to the ring fill and write time
+    void set_level_control(LevelController* level_control) { m_level_control = level_control; }
+
+    void start();
+    /// Close the ring, write all pending frames and wait for the thread
+    void finish();
+
+    bool failed() const { return m_failed; }
+    StageStats stats() const;
+
+private:
+    void run();
+
+    FrameRing& m_ring;
+    DataStream& m_stream;
+    CellCalibration* m_calibration;
+    LaneMetrics* m_metrics;
+    LevelController* m_level_control;
+    std::thread m_thread;
+    std::atomic<bool> m_failed;
+    std::atomic<uint64_t> m_frames;
+    std::atomic<int64_t> m_busy_ns;
+};
+
+/**
+ * Capture thread driving one FrameSource into a FrameRing, used to read out
+ * several boards in parallel.
+ *
+ * The main thread hands out batches of frames, so detector control can still
+ * hold the temperature regulation between batches. Frames of all workers
+ * are timestamped by the sources on the same RunClock.
+ */
+class CaptureWorker {
+public:
+    CaptureWorker(FrameSource& source, FrameRing& ring, int board, const std::atomic<bool>& abort);
+    ~CaptureWorker();
+
+    /// Count captured frames
+    void set_metrics(LaneMetrics* metrics) { m_metrics = metrics; }
+
+    void start();
+    /// Capture the next num_frames frames in the capture thread
+    void run_batch(unsigned int num_frames);
+    /// Wait until the current batch is done, false if the source is exhausted
+    bool wait_batch();
+    void stop();
+
+    StageStats stats() const;
+    /// Live and dead time of the board, after stop()
+    const LiveTime& live_time() const { return m_live_time; }
+
+private:
+    void run();
+
+    FrameSource& m_source;
+    FrameRing& m_ring;
+    int m_board;
+    const std::atomic<bool>& m_abort;
+    LaneMetrics* m_metrics;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    unsigned int m_pending;
+    bool m_stop;
+    bool m_exhausted;
+    StageStats m_stats;
+    LiveTime m_live_time;
+};
+
+void print_stage_stats(const std::string& name, const StageStats& stats, const nanoseconds& total_time);
+void print_ring_stats(const FrameRing& ring);
+
+#endif // PIPELINE_H
@@ -0,0 +1,666 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "configuration.h"
+#include "replaysource.h"
+#include "binary.h"
+#include "chunkfile.h"
+#include "codec.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef ROOT_FOUND
+ #include <TFile.h>
+ #include <TTree.h>
+ #include <TGraph.h>
+ #include <TObjString.h>
+#endif
+
+/// int64 ns armed, triggered, transferred and written in front of a frame
+template<class Input>
+static bool read_timestamps(Input& input, FrameTimestamps& timestamps)
+{
+    int64_t frame_timestamps[4];
+    if(input.read(frame_timestamps, sizeof(frame_timestamps), 1) != 1) {
+        return false;
+    }
+    timestamps.armed = frame_timestamps[0];
+    timestamps.triggered = frame_timestamps[1];
+    timestamps.transferred = frame_timestamps[2];
+    timestamps.written = frame_timestamps[3];
+    return true;
+}
+
+/**
+ * BinaryStream files: dat_header, user header, then time and data per frame,
+ * or with calibration block, trigger cell and data or raw values per frame.
+ * Newer files have the timestamps in front of every frame. With
+ * DAT_COMPRESSED, everything after the calibration is in codec blocks.
+ * Version 2 files have the frames in chunks instead, see chunkfile.h.
+ */
+class CdtReader : public ReplayReader {
+public:
+    CdtReader() : m_file(0), m_data_start(0), m_frame(0), m_num_frames(0), m_trigger_cell(0) {}
+    virtual ~CdtReader() { if(m_file) fclose(m_file); }
+
+    virtual bool open(const std::string& filename) {
+        m_file = fopen64(filename.c_str(), "rb");
+        if(!m_file) {
+            std::cerr << "Cannot open '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        if(fread(&m_header, sizeof(m_header), 1, m_file) != 1 || memcmp(m_header.magic, "#DTA\n", 5) != 0) {
+            std::cerr << "'" << filename << "' is not a .cdt file" << std::endl;
+            return false;
+        }
+        if(m_header.version < 1 || m_header.version > 2 || m_header.frames_per_sample > FRAME_MAX_SAMPLES
+           || !RegionOfInterest(m_header.roi_start, m_header.frames_per_sample).valid()) {
+            std::cerr << "Unsupported .cdt version " << int(m_header.version) << std::endl;
+            return false;
+        }
+        m_data_start = sizeof(m_header) + m_header.data_offset;
+        if(m_header.flags & (DAT_RAW | DAT_CELL_TIME)) {
+            if(fseeko64(m_file, m_data_start, SEEK_SET) != 0 || !m_calibration.read(m_file)) {
+                return false;
+            }
+            m_data_start = ftello64(m_file);
+        }
+        // num_frames is 0 if a version 1 recording was not finalized, read up to the end then
+        m_num_frames = m_header.num_frames;
+        if(m_header.version == 2) {
+            if(!m_chunks.open(m_file, m_data_start)) {
+                return false;
+            }
+            m_num_frames = m_chunks.frames();
+            if(m_chunks.recovered()) {
+                std::cerr << "'" << filename << "' was not finished, recovered " << m_num_frames
+                          << " frames from its complete chunks" << std::endl;
+            }
+        }
+        m_input.open(m_file, m_header.flags & DAT_COMPRESSED);
+        return rewind();
+    }
+    virtual bool next(FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& columns) {
+        if((m_num_frames != 0 || m_header.version == 2) && m_frame >= m_num_frames) {
+            return false;
+        }
+        timestamps = FrameTimestamps();
+        if((m_header.flags & DAT_TIMESTAMPS) && !read_timestamps(*this, timestamps)) {
+            return false;
+        }
+        if(m_header.flags & DAT_RAW) {
+            if(!next_raw(time, columns)) {
+                return false;
+            }
+        } else if(m_header.flags & DAT_CELL_TIME) {
+            if(!read_trigger_cell(time) ||
+               read(columns[0], sizeof(float), m_header.frames_per_sample) != m_header.frames_per_sample) {
+                return false;
+            }
+        } else if(read(time, sizeof(float), m_header.frames_per_sample) != m_header.frames_per_sample ||
+                  read(columns[0], sizeof(float), m_header.frames_per_sample) != m_header.frames_per_sample) {
+            return false;
+        }
+        m_frame++;
+        return true;
+    }
+    virtual bool rewind() {
+        m_frame = 0;
+        if(m_header.version == 2) {
+            return m_chunks.seek(0, frame_size());
+        }
+        return m_input.seek(m_data_start);
+    }
+    virtual bool seek(uint64_t frame) {
+        if(m_header.version != 2 || !m_chunks.seek(frame, frame_size())) {
+            return false;
+        }
+        m_frame = frame;
+        return true;
+    }
+    /// Frame data, from the codec blocks or the chunks
+    size_t read(void* data, size_t size, size_t count) {
+        if(m_header.version == 2) {
+            return m_chunks.read(data, size, count);
+        }
+        return m_input.read(data, size, count);
+    }
+    virtual int num_columns() const {
+        return (m_header.flags & DAT_RAW)? m_calibration.channels.size() : 1;
+    }
+    virtual int frames_per_sample() const { return m_header.frames_per_sample; }
+    virtual int roi_start() const { return m_header.roi_start; }
+    virtual bool has_record_time() const { return m_header.flags & DAT_TIMESTAMPS; }
+    virtual int trigger_cell() const { return m_trigger_cell; }
+    virtual bool cell_widths(float* dt) const {
+        if(!(m_header.flags & (DAT_RAW | DAT_CELL_TIME))) {
+            return false;
+        }
+        memcpy(dt, m_calibration.dt, sizeof(m_calibration.dt));
+        return true;
+    }
+
+private:
+    /// Bytes per frame, all frames of a file have the same size
+    size_t frame_size() const {
+        size_t size = (m_header.flags & DAT_TIMESTAMPS)? 4*sizeof(int64_t) : 0;
+        if(m_header.flags & DAT_RAW) {
+            return size + sizeof(uint16_t) + m_calibration.channels.size()*m_header.frames_per_sample*sizeof(uint16_t);
+        } else if(m_header.flags & DAT_CELL_TIME) {
+            return size + sizeof(uint16_t) + m_header.frames_per_sample*sizeof(float);
+        }
+        return size + 2*m_header.frames_per_sample*sizeof(float);
+    }
+
+    /// Trigger cell of the frame and its time axis
+    bool read_trigger_cell(float* time) {
+        uint16_t trigger_cell;
+        if(read(&trigger_cell, sizeof(trigger_cell), 1) != 1 || trigger_cell >= DRS_NUM_CELLS) {
+            return false;
+        }
+        m_trigger_cell = trigger_cell;
+        memcpy(time, m_time_axes.get(m_trigger_cell, m_calibration) + m_header.roi_start,
+               m_header.frames_per_sample*sizeof(float));
+        return true;
+    }
+
+    /// Trigger cell and raw ADC values of every column, calibrated on the fly
+    bool next_raw(float* time, const std::array<float*, 4>& columns) {
+        if(!read_trigger_cell(time)) {
+            return false;
+        }
+        uint16_t raw[FRAME_MAX_SAMPLES];
+        for(size_t col=0; col<m_calibration.channels.size(); col++) {
+            if(read(raw, sizeof(uint16_t), m_header.frames_per_sample) != m_header.frames_per_sample) {
+                return false;
+            }
+            m_calibration.calibrate_voltage(m_calibration.channels[col], m_trigger_cell, m_header.roi_start,
+                                            raw, columns[col], m_header.frames_per_sample);
+        }
+        return true;
+    }
+
+    FILE* m_file;
+    CodecReader m_input;
+    ChunkReader m_chunks;
+    dat_header m_header;
+    off64_t m_data_start;
+    uint64_t m_frame;
+    uint64_t m_num_frames;
+    DRSCalibration m_calibration;
+    TimeAxisCache m_time_axes;
+    int m_trigger_cell;
+};
+
+/**
+ * YAMLBinaryStream files: YAML header terminated by "...", then time and data
+ * per frame, or trigger cell and data if the header has cell widths. With
+ * frame_timestamps in the header, the timestamps come first in every frame.
+ * With a codec in the header, frames and summary are codec blocks.
+ */
+class YamlBinaryReader : public ReplayReader {
+public:
+    YamlBinaryReader() : m_file(0), m_data_start(0), m_frames_per_sample(FRAME_MAX_SAMPLES), m_roi_start(0),
+    m_cell_time(false), m_timestamps(false), m_trigger_cell(0) {}
+    virtual ~YamlBinaryReader() { if(m_file) fclose(m_file); }
+
+    virtual bool open(const std::string& filename) {
+        m_file = fopen64(filename.c_str(), "rb");
+        if(!m_file) {
+            std::cerr << "Cannot open '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        // the header ends with "..." without newline, frame data follows immediately
+        std::vector<char> head(65536);
+        size_t length = fread(&head[0], 1, head.size(), m_file);
+        std::string header(&head[0], length);
+        size_t end = header.find("\n...");
+        if(end != std::string::npos) {
+            m_data_start = end + 4;
+            header.resize(end);
+        }
+        size_t spf = header.find(" - samples_per_frame: ");
+        if(spf != std::string::npos) {
+            m_frames_per_sample = atoi(header.c_str() + spf + strlen(" - samples_per_frame: "));
+        }
+        size_t roi = header.find(" - roi_start: ");
+        if(roi != std::string::npos) {
+            m_roi_start = atoi(header.c_str() + roi + strlen(" - roi_start: "));
+        }
+        if(m_data_start == 0 || !RegionOfInterest(m_roi_start, m_frames_per_sample).valid()) {
+            std::cerr << "'" << filename << "' is not a YAML binary file" << std::endl;
+            return false;
+        }
+        m_timestamps = header.find(" - frame_timestamps: 1") != std::string::npos;
+        m_input.open(m_file, header.find(" - codec: ") != std::string::npos);
+        size_t widths = header.find(" - cell_widths_ns: [");
+        if(widths != std::string::npos) {
+            std::istringstream ss(header.substr(widths + strlen(" - cell_widths_ns: [")));
+            char separator = ',';
+            for(int cell=0; cell<DRS_NUM_CELLS && separator == ','; cell++) {
+                ss >> m_calibration.dt[cell] >> separator;
+            }
+            if(!ss || separator != ']') {
+                std::cerr << "'" << filename << "' has an invalid cell width table" << std::endl;
+                return false;
+            }
+            m_cell_time = true;
+        }
+        return rewind();
+    }
+    virtual bool next(FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& columns) {
+        size_t n = m_frames_per_sample;
+        timestamps = FrameTimestamps();
+        if(m_timestamps) {
+            // the run summary document starts with "\n---"
+            if(!read_timestamps(m_input, timestamps) || memcmp(&timestamps.armed, "\n---", 4) == 0) {
+                return false;
+            }
+        }
+        if(m_cell_time) {
+            // the run summary document starts with "\n-", which is no valid trigger cell
+            uint16_t trigger_cell;
+            if(m_input.read(&trigger_cell, sizeof(trigger_cell), 1) != 1 || trigger_cell >= DRS_NUM_CELLS ||
+               m_input.read(columns[0], sizeof(float), n) != n) {
+                return false;
+            }
+            m_trigger_cell = trigger_cell;
+            memcpy(time, m_time_axes.get(m_trigger_cell, m_calibration) + m_roi_start, n*sizeof(float));
+            return true;
+        }
+        if(m_input.read(time, sizeof(float), n) != n || m_input.read(columns[0], sizeof(float), n) != n) {
+            return false;
+        }
+        // the run summary document starts with "\n---"
+        if(memcmp(time, "\n---", 4) == 0) {
+            return false;
+        }
+        return true;
+    }
+    virtual bool rewind() {
+        return m_input.seek(m_data_start);
+    }
+    virtual int num_columns() const { return 1; }
+    virtual int frames_per_sample() const { return m_frames_per_sample; }
+    virtual int roi_start() const { return m_roi_start; }
+    virtual bool has_record_time() const { return m_timestamps; }
+    virtual int trigger_cell() const { return m_trigger_cell; }
+    virtual bool cell_widths(float* dt) const {
+        if(m_cell_time) {
+            memcpy(dt, m_calibration.dt, sizeof(m_calibration.dt));
+        }
+        return m_cell_time;
+    }
+
+private:
+    FILE* m_file;
+    CodecReader m_input;
+    off64_t m_data_start;
+    int m_frames_per_sample;
+    int m_roi_start;
+    bool m_cell_time;
+    bool m_timestamps;
+    DRSCalibration m_calibration;
+    TimeAxisCache m_time_axes;
+    int m_trigger_cell;
+};
+
+/**
+ * TextStream files, plain or gzip compressed
+ */
+class TextReader : public ReplayReader {
+public:
+    TextReader() : m_file(0), m_frames_per_sample(FRAME_MAX_SAMPLES), m_roi_start(0), m_num_columns(1),
+    m_pending_frame(false) {}
+    virtual ~TextReader() { if(m_file) gzclose(m_file); }
+
+    virtual bool open(const std::string& filename) {
+        // gzopen() reads uncompressed files transparently
+        m_file = gzopen64(filename.c_str(), "rb");
+        if(!m_file) {
+            std::cerr << "Cannot open '" << filename << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+        gzbuffer(m_file, 1<<20);
+        if(!read_line() || m_line != "##METATEXT") {
+            std::cerr << "'" << filename << "' is not a get_data text file" << std::endl;
+            return false;
+        }
+        while(read_line() && !is_frame_start()) {
+            if(boost::algorithm::starts_with(m_line, "# frames_per_sample_i = ")) {
+                m_frames_per_sample = atoi(m_line.c_str() + strlen("# frames_per_sample_i = "));
+            }
+            else if(boost::algorithm::starts_with(m_line, "# roi_start_i = ")) {
+                m_roi_start = atoi(m_line.c_str() + strlen("# roi_start_i = "));
+            }
+            else if(boost::algorithm::starts_with(m_line, "# channel_config_s = ")) {
+                m_num_columns = 1 + std::count(m_line.begin(), m_line.end(), ',');
+            }
+        }
+        if(!RegionOfInterest(m_roi_start, m_frames_per_sample).valid() || m_num_columns > 4) {
+            std::cerr << "Unsupported frame layout in '" << filename << "'" << std::endl;
+            return false;
+        }
+        m_pending_frame = is_frame_start();
+        return true;
+    }
+    virtual bool next(FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& columns) {
+        while(!m_pending_frame) {
+            if(!read_line()) {
+                return false;
+            }
+            m_pending_frame = is_frame_start();
+        }
+        m_pending_frame = false;
+        timestamps = FrameTimestamps();
+        // comment lines with the record time and, since version 3, all timestamps
+        bool data_line = false;
+        while(!data_line && read_line()) {
+            long record_time_us;
+            if(sscanf(m_line.c_str(), "# record time: %li us", &record_time_us) == 1) {
+                timestamps.triggered = record_time_us * 1000;
+            } else if(m_line.empty() || m_line[0] != '#') {
+                data_line = true;
+            } else {
+                sscanf(m_line.c_str(), "# timestamps: armed=%li triggered=%li transferred=%li written=%li ns",
+                       &timestamps.armed, &timestamps.triggered, &timestamps.transferred, &timestamps.written);
+            }
+        }
+        if(!data_line) {
+            return false;
+        }
+        for(int i=0; i<m_frames_per_sample; i++) {
+            if(i > 0 && !read_line()) {
+                return false;
+            }
+            char* pos = const_cast<char*>(m_line.c_str());
+            time[i] = strtof(pos, &pos);
+            for(int col=0; col<m_num_columns; col++) {
+                columns[col][i] = strtof(pos, &pos);
+            }
+        }
+        return true;
+    }
+    virtual bool rewind() {
+        if(gzrewind(m_file) != 0) {
+            return false;
+        }
+        m_pending_frame = false;
+        return true;
+    }
+    virtual int num_columns() const { return m_num_columns; }
+    virtual int frames_per_sample() const { return m_frames_per_sample; }
+    virtual int roi_start() const { return m_roi_start; }
+
+private:
+    bool read_line() {
+        if(!gzgets(m_file, m_buffer, sizeof(m_buffer))) {
+            return false;
+        }
+        m_line = m_buffer;
+        boost::algorithm::trim_right(m_line);
+        return true;
+    }
+    bool is_frame_start() const {
+        return boost::algorithm::starts_with(m_line, "##FRAME:");
+    }
+
+    gzFile m_file;
+    int m_frames_per_sample;
+    int m_roi_start;
+    int m_num_columns;
+    bool m_pending_frame;
+    char m_buffer[4096];
+    std::string m_line;
+};
+
+#ifdef ROOT_FOUND
+/**
+ * RootOutput files: TTree "data" with the record time t_0 and one TGraph per channel
+ */
+class RootReader : public ReplayReader {
+public:
+    RootReader() : m_file(0), m_tree(0), m_entry(0), m_record_timestamp(0), m_armed_timestamp(0),
+    m_transferred_timestamp(0), m_written_timestamp(0),
+    m_graphs{nullptr, nullptr, nullptr, nullptr}, m_num_columns(0), m_frames_per_sample(0), m_roi_start(0) {}
+    virtual ~RootReader() { if(m_file) m_file->Close(); delete m_file; }
+
+    virtual bool open(const std::string& filename) {
+        m_file = TFile::Open(filename.c_str(), "read");
+        if(!m_file || m_file->IsZombie()) {
+            std::cerr << "Cannot open '" << filename << "'" << std::endl;
+            return false;
+        }
+        m_file->GetObject("data", m_tree);
+        if(!m_tree) {
+            std::cerr << "'" << filename << "' has no data tree" << std::endl;
+            return false;
+        }
+        m_tree->SetBranchAddress("t_0", &m_record_timestamp);
+        // files before frame timestamps only have t_0
+        if(m_tree->GetBranch("t_armed")) {
+            m_tree->SetBranchAddress("t_armed", &m_armed_timestamp);
+            m_tree->SetBranchAddress("t_transferred", &m_transferred_timestamp);
+            m_tree->SetBranchAddress("t_written", &m_written_timestamp);
+        }
+        const char* branches[] = {"ch1", "ch2", "ch3", "ch4"};
+        for(size_t i=0; i<4; i++) {
+            m_tree->SetBranchAddress(branches[i], &m_graphs[i]);
+        }
+        if(m_tree->GetEntries() > 0) {
+            m_tree->GetEntry(0);
+            for(size_t i=0; i<4; i++) {
+                if(m_graphs[i] && m_graphs[i]->GetN() > 0) {
+                    m_channels[m_num_columns++] = i;
+                    m_frames_per_sample = m_graphs[i]->GetN();
+                }
+            }
+        }
+        TObjString* roi = 0;
+        m_file->GetObject("region_of_interest", roi);
+        if(roi) {
+            sscanf(roi->GetString().Data(), "start=%i", &m_roi_start);
+        }
+        if(m_frames_per_sample > 0 && !RegionOfInterest(m_roi_start, m_frames_per_sample).valid()) {
+            std::cerr << "Unsupported frame layout in '" << filename << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    virtual bool next(FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& columns) {
+        if(m_entry >= m_tree->GetEntries()) {
+            return false;
+        }
+        m_tree->GetEntry(m_entry++);
+        timestamps.armed = m_armed_timestamp;
+        timestamps.triggered = m_record_timestamp;
+        timestamps.transferred = m_transferred_timestamp;
+        timestamps.written = m_written_timestamp;
+        for(int col=0; col<m_num_columns; col++) {
+            TGraph* graph = m_graphs[m_channels[col]];
+            for(int i=0; i<m_frames_per_sample; i++) {
+                time[i] = graph->GetX()[i];
+                columns[col][i] = graph->GetY()[i];
+            }
+        }
+        return true;
+    }
+    virtual bool rewind() {
+        m_entry = 0;
+        return true;
+    }
+    virtual int num_columns() const { return m_num_columns; }
+    virtual int frames_per_sample() const { return m_frames_per_sample; }
+    virtual int roi_start() const { return m_roi_start; }
+
+private:
+    TFile* m_file;
+    TTree* m_tree;
+    Long64_t m_entry;
+    Long64_t m_record_timestamp;
+    Long64_t m_armed_timestamp;
+    Long64_t m_transferred_timestamp;
+    Long64_t m_written_timestamp;
+    TGraph* m_graphs[4];
+    int m_channels[4];
+    int m_num_columns;
+    int m_frames_per_sample;
+    int m_roi_start;
+};
+#endif
+
+ReplaySource::ReplaySource(const std::array<int, 4>& ch_config, const std::atomic<bool>& abort)
+: m_ch_config(ch_config),
+m_abort(abort),
+m_realtime(false),
+m_loop(false),
+m_first_frame(0),
+m_time_offset(0),
+m_last_record_time(0),
+m_frequency(0.0),
+m_started(false),
+m_discard{ {m_discard_buffer[0], m_discard_buffer[1], m_discard_buffer[2], m_discard_buffer[3]} }
+{
+}
+
+bool ReplaySource::configure(const std::map<std::string, std::string>& options)
+{
+    for(auto it: options) {
+        if(it.first == "file") m_filename = it.second;
+        else if(it.first == "pace" && it.second == "fast") m_realtime = false;
+        else if(it.first == "pace" && it.second == "realtime") m_realtime = true;
+        else if(it.first == "loop") m_loop = it.second != "0";
+        else if(it.first == "start") {
+            try {
+                m_first_frame = boost::lexical_cast<uint64_t>(it.second);
+            } catch(boost::bad_lexical_cast const& e) {
+                std::cerr << "Cannot parse first frame '" << it.second << "' of replay source" << std::endl;
+                return false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option '" << it.first << "=" << it.second << "' for replay source" << std::endl;
+            return false;
+        }
+    }
+    if(boost::algorithm::ends_with(m_filename, ".cdt")) m_reader.reset(new CdtReader);
+    else if(boost::algorithm::ends_with(m_filename, ".ybin")) m_reader.reset(new YamlBinaryReader);
+    else if(boost::algorithm::ends_with(m_filename, ".csv") ||
+            boost::algorithm::ends_with(m_filename, ".csv.gz")) m_reader.reset(new TextReader);
+#ifdef ROOT_FOUND
+    else if(boost::algorithm::ends_with(m_filename, ".root")) m_reader.reset(new RootReader);
+#endif
+    else {
+        std::cerr << "Cannot replay '" << m_filename << "', unknown file type" << std::endl;
+        return false;
+    }
+    if(!m_reader->open(m_filename)) {
+        return false;
+    }
+    // the sampling rate is not stored, it follows from the time axis of the first frame
+    std::vector<float> time(FRAME_MAX_SAMPLES);
+    FrameTimestamps first;
+    int samples = m_reader->frames_per_sample();
+    if(m_reader->next(first, time.data(), m_discard) && samples > 1 && time[samples - 1] > time[0]) {
+        m_frequency = (samples - 1)/(time[samples - 1] - time[0]);
+    }
+    if(!m_reader->rewind()) {
+        return false;
+    }
+    if(m_first_frame > 0 && !m_reader->seek(m_first_frame)) {
+        // no index to jump with, read up to the frame
+        FrameTimestamps timestamps;
+        for(uint64_t i=0; i<m_first_frame; i++) {
+            if(!m_reader->next(timestamps, m_discard_buffer[0], m_discard)) {
+                std::cerr << "'" << m_filename << "' has only " << i << " frames" << std::endl;
+                return false;
+            }
+        }
+    }
+    if(m_realtime && !m_reader->has_record_time()) {
+        std::cerr << "'" << m_filename << "' has no record times, replaying as fast as possible" << std::endl;
+        m_realtime = false;
+    }
+    return true;
+}
+
+bool ReplaySource::capture(Frame& frame)
+{
+    // file column k is board channel ch_config[k]
+    std::array<float*, 4> columns(m_discard);
+    for(size_t col=0; col<4 && m_ch_config[col] != -1; col++) {
+        columns[col] = frame.data[m_ch_config[col]];
+    }
+    FrameTimestamps& timestamps = frame.timestamps;
+    if(!m_reader->next(timestamps, frame.time, columns)) {
+        if(!m_loop || !m_reader->rewind() || !m_reader->next(timestamps, frame.time, columns)) {
+            return false;
+        }
+        m_time_offset = m_last_record_time;
+    }
+    // replayed frames keep their recorded timestamps, shifted by the loops so far
+    if(timestamps.armed) timestamps.armed += m_time_offset;
+    if(timestamps.transferred) timestamps.transferred += m_time_offset;
+    if(timestamps.written) timestamps.written += m_time_offset;
+    timestamps.triggered += m_time_offset;
+    m_last_record_time = timestamps.triggered;
+    nanoseconds record_time = timestamps.record_time();
+    frame.trigger_cell = m_reader->trigger_cell();
+
+    if(m_realtime) {
+        auto now = std::chrono::steady_clock::now();
+        if(!m_started) {
+            m_start = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(record_time);
+            m_started = true;
+        }
+        auto due = m_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(record_time);
+        while(std::chrono::steady_clock::now() < due) {
+            if(m_abort)
+                return false;
+            std::this_thread::sleep_until(std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+        }
+    }
+    return !m_abort;
+}
+
+double ReplaySource::frequency() const
+{
+    return m_frequency;
+}
+
+std::string ReplaySource::description() const
+{
+    std::ostringstream ss;
+    ss << "replay of '" << m_filename << "', " << m_reader->num_columns() << " column(s), "
+       << m_reader->frames_per_sample() << " samples per frame, "
+       << (m_realtime? "recorded cadence" : "as fast as possible");
+    if(m_loop) ss << ", looping";
+    return ss.str();
+}
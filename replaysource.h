@@ -0,0 +1,114 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include "framesource.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/**
+ * Reads frames back from one recorded file
+ */
+class ReplayReader {
+public:
+    virtual ~ReplayReader() {}
+    virtual bool open(const std::string& filename) = 0;
+    /// Next frame into time and columns, false at the end of the file
+    virtual bool next(FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& columns) = 0;
+    virtual bool rewind() = 0;
+    /// Continue with frame number frame, false if the file cannot jump there
+    virtual bool seek(uint64_t frame) { return false; }
+    /// Number of data columns per frame
+    virtual int num_columns() const = 0;
+    virtual int frames_per_sample() const = 0;
+    /// Readout position of the first sample of a frame, if only a region of interest was recorded
+    virtual int roi_start() const { return 0; }
+    /// Whether the file has record timestamps (.cdt and .ybin before frame timestamps have none)
+    virtual bool has_record_time() const { return true; }
+    /// Trigger cell of the last frame, 0 if not recorded
+    virtual int trigger_cell() const { return 0; }
+    /// Cell widths if the file stores time axes by trigger cell
+    virtual bool cell_widths(float* dt) const { return false; }
+};
+
+/**
+ * Frames from a file written by BinaryStream (.cdt), YAMLBinaryStream (.ybin),
+ * TextStream (.csv, .csv.gz) or RootOutput (.root), fed back into the
+ * acquisition pipeline. Options (from "-S replay:key=value,..."):
+ *
+ *  file=PATH      recorded file, the format is chosen by the extension
+ *  pace=MODE      'fast' (default) emits frames as fast as possible, 'realtime'
+ *                 at the cadence of the recorded record times
+ *  loop=1         start over at the end of the file
+ *  start=N        begin with frame N, found through the index of version 2
+ *                 .cdt files, read up to it in other files. Loops start at 0
+ *
+ * Frames keep their recorded timestamps, so a converted file has the live
+ * and dead time of the recording.
+ *
+ * Raw .cdt recordings are calibrated with the calibration from their header,
+ * so replaying them into another format converts them to calibrated data.
+ *
+ * Data column k of the file becomes board channel ch_config[k] of the frame,
+ * so the -c setting of the replay should match the one of the recording.
+ */
+class ReplaySource : public FrameSource {
+public:
+    ReplaySource(const std::array<int, 4>& ch_config, const std::atomic<bool>& abort);
+
+    /// Apply "-S replay:..." options and open the file
+    bool configure(const std::map<std::string, std::string>& options);
+
+    virtual bool capture(Frame& frame);
+    virtual double frequency() const;
+    virtual std::string description() const;
+    virtual bool cell_widths(float* dt) { return m_reader->cell_widths(dt); }
+
+    /// Recorded window of the file, the frames keep it
+    RegionOfInterest region_of_interest() const {
+        return RegionOfInterest(m_reader->roi_start(), m_reader->frames_per_sample());
+    }
+
+private:
+    std::unique_ptr<ReplayReader> m_reader;
+    std::string m_filename;
+    std::array<int, 4> m_ch_config;
+    const std::atomic<bool>& m_abort;
+    bool m_realtime;
+    bool m_loop;
+    uint64_t m_first_frame;
+    int64_t m_time_offset;
+    int64_t m_last_record_time;
+    /// GSp/s, 1/mean sample spacing of the first frame
+    double m_frequency;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_started;
+    std::array<float*, 4> m_discard;
+    float m_discard_buffer[4][FRAME_MAX_SAMPLES];
+};
+
+#endif // REPLAYSOURCE_H
@@ -41,6 +41,9 @@ bool RootOutput::init_stream()
     m_file = std::make_shared<TFile>(filename.c_str(), "create");
     m_tree = std::make_shared<TTree>("data", "data");
     m_tree->Branch("t_0", &m_record_timestamp, "t_0/L");
+    m_tree->Branch("t_armed", &m_armed_timestamp, "t_armed/L");
+    m_tree->Branch("t_transferred", &m_transferred_timestamp, "t_transferred/L");
+    m_tree->Branch("t_written", &m_written_timestamp, "t_written/L");
     m_tree->Branch("ch1", "TGraph", &m_data_graphs[0]);
     m_tree->Branch("ch2", "TGraph", &m_data_graphs[1]);
     m_tree->Branch("ch3", "TGraph", &m_data_graphs[2]);
@@ -54,27 +57,34 @@ bool RootOutput::write_header()
     text << command_line;
     auto config_text = std::make_shared<TObjString>(text.str().c_str());
     config_text->Write("record_settings");
+    std::ostringstream roi;
+    roi << "start=" << roi_start << "\nlength=" << frames_per_sample;
+    auto roi_text = std::make_shared<TObjString>(roi.str().c_str());
+    roi_text->Write("region_of_interest");
     return true;
 }
 
-bool RootOutput::write_frame(const nanoseconds& record_time, float* time, float* data)
+bool RootOutput::write_frame(const FrameTimestamps& timestamps, float* time, float* data)
 {
-    std::array<float*, 4> data_array{ {data, nullptr, nullptr, nullptr} };
-    std::array< int, 4> my_ch_config{ {0, -1, -1, -1} };
-    return write_frame(record_time, time, data_array, my_ch_config);
+    std::array<float*, 4> data_array{ {nullptr, nullptr, nullptr, nullptr} };
+    data_array[ch_config[0]] = data;
+    return write_frame(timestamps, time, data_array, ch_config);
 }
 
-bool RootOutput::write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data)
+bool RootOutput::write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data)
 {
-    return write_frame(record_time, time, data, ch_config);
+    return write_frame(timestamps, time, data, ch_config);
 }
 
-bool RootOutput::write_frame(const nanoseconds& record_time, float* time,
+bool RootOutput::write_frame(const FrameTimestamps& timestamps, float* time,
                              const std::array< float*, 4  >& data,
                              std::array< int, 4  > my_ch_config)
 {
-    m_record_timestamp = record_time.count();
-    for(auto ch: ch_config) {
+    m_record_timestamp = timestamps.triggered;
+    m_armed_timestamp = timestamps.armed;
+    m_transferred_timestamp = timestamps.transferred;
+    m_written_timestamp = timestamps.written;
+    for(auto ch: my_ch_config) {
         if(ch == -1) {
             continue;
         }
@@ -94,6 +104,10 @@ bool RootOutput::write_frame(const nanoseconds& record_time, float* time,
 bool RootOutput::finalize()
 {
 //     m_tree->Write();  <- don't! Written automatically
+    if(!summary.empty()) {
+        auto summary_text = std::make_shared<TObjString>(format_summary("", "=").c_str());
+        summary_text->Write("run_summary");
+    }
     m_file->Write();
     m_tree.reset();  // if the tree is not deleted, closing the file will crash!
 
@@ -35,15 +35,16 @@ public:
     RootOutput();
     virtual ~RootOutput();
 
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data);
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data);
-    virtual bool write_frame(const nanoseconds& record_time, float* time,
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data);
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data);
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time,
                              const std::array<float*, 4>& data,
                              std::array<int, 4> my_ch_config);
     virtual bool write_header();
     virtual bool finalize();
 
     virtual std::string get_file_extension() const { return std::string(".root"); }
+    virtual uint64_t bytes_written() const { return m_file? m_file->GetBytesWritten() : 0; }
 
 protected:
     virtual bool init_stream();
@@ -52,7 +53,11 @@ private:
     std::shared_ptr<TFile> m_file;
     std::shared_ptr<TTree> m_tree;
     std::ostringstream m_recordTimestampsText;
+    /// trigger time, the other timestamps of the frame below
     uint64_t m_record_timestamp;
+    uint64_t m_armed_timestamp;
+    uint64_t m_transferred_timestamp;
+    uint64_t m_written_timestamp;
     TGraph* m_data_graphs[4];
 };
 
@@ -0,0 +1,153 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "runclock.h"
+#include "frame.h"
+
+#include <fstream>
+#include <iostream>
+#if defined(__x86_64__)
+ #include <cpuid.h>
+#endif
+
+/// How long the TSC is compared with CLOCK_MONOTONIC_RAW in init()
+#define TSC_CALIBRATION_NS 50000000
+#define TSC_CALIBRATION_SAMPLES 16
+
+bool RunClock::s_tsc = false;
+uint64_t RunClock::s_tsc_epoch = 0;
+uint64_t RunClock::s_tsc_mult = 0;
+int64_t RunClock::s_raw_epoch = 0;
+
+#if defined(__x86_64__)
+/// The TSC ticks at a constant rate in all power states and the kernel trusts it
+static bool tsc_usable()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+        return false;
+    }
+    std::ifstream clocksource("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+    std::string name;
+    return clocksource >> name && name == "tsc";
+}
+
+/**
+ * A TSC reading and CLOCK_MONOTONIC_RAW at the same moment: the pair with the
+ * shortest TSC interval around clock_gettime() of a few tries
+ */
+static void read_both(uint64_t& tsc, int64_t& raw_ns)
+{
+    uint64_t best = ~static_cast<uint64_t>(0);
+    for(int i=0; i<TSC_CALIBRATION_SAMPLES; i++) {
+        timespec ts;
+        uint64_t before = __rdtsc();
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        uint64_t after = __rdtsc();
+        if(after - before < best) {
+            best = after - before;
+            tsc = before + (after - before)/2;
+            raw_ns = static_cast<int64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+        }
+    }
+}
+#endif
+
+void RunClock::init()
+{
+    s_tsc = false;
+#if defined(__x86_64__)
+    if(tsc_usable()) {
+        uint64_t tsc0, tsc1;
+        int64_t raw0, raw1;
+        read_both(tsc0, raw0);
+        timespec pause = {0, TSC_CALIBRATION_NS};
+        nanosleep(&pause, NULL);
+        read_both(tsc1, raw1);
+        if(tsc1 > tsc0 && raw1 > raw0) {
+            s_tsc_mult = (static_cast<unsigned __int128>(raw1 - raw0) << 32) / (tsc1 - tsc0);
+            s_tsc = true;
+        }
+    }
+#endif
+    reset_epoch();
+}
+
+void RunClock::reset_epoch()
+{
+#if defined(__x86_64__)
+    if(s_tsc) {
+        int64_t raw;
+        read_both(s_tsc_epoch, raw);
+        s_raw_epoch = raw;
+        return;
+    }
+#endif
+    s_raw_epoch = raw_ns();
+}
+
+std::string RunClock::source()
+{
+    return s_tsc? "tsc" : "monotonic_raw";
+}
+
+double RunClock::tsc_frequency()
+{
+    return s_tsc? 4294967296.0 / s_tsc_mult * 1e9 : 0.0;
+}
+
+int64_t RunClock::drift()
+{
+    return now() - (raw_ns() - s_raw_epoch);
+}
+
+void LiveTime::add(const FrameTimestamps& timestamps)
+{
+    // replayed frames of files without timestamps
+    if(timestamps.armed == 0) {
+        return;
+    }
+    if(m_frames == 0) {
+        m_first_armed = timestamps.armed;
+    }
+    m_frames++;
+    m_live_ns += timestamps.triggered - timestamps.armed;
+    m_last_transferred = timestamps.transferred;
+}
+
+double LiveTime::dead_fraction() const
+{
+    int64_t elapsed = elapsed_ns();
+    return elapsed > 0? static_cast<double>(dead_ns()) / elapsed : 0.0;
+}
+
+double LiveTime::live_rate() const
+{
+    return m_live_ns > 0? static_cast<double>(m_frames) / m_live_ns * 1e9 : 0.0;
+}
+
+void print_live_time(const LiveTime& live_time)
+{
+    std::cout << "  live time " << live_time.live_ns() / 1e9 << "s, dead time "
+              << live_time.dead_ns() / 1e9 << "s (" << 100.0 * live_time.dead_fraction()
+              << "%), " << live_time.live_rate() << " Hz triggers per live time" << std::endl;
+}
@@ -0,0 +1,119 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef RUNCLOCK_H
+#define RUNCLOCK_H
+
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__)
+ #include <x86intrin.h>
+#endif
+
+struct FrameTimestamps;
+
+/**
+ * Clock of the per-frame timestamps: nanoseconds on CLOCK_MONOTONIC_RAW
+ * since the start of the run.
+ *
+ * CLOCK_MONOTONIC_RAW is not slewed by NTP, so intervals are not distorted
+ * while the run goes on. Where the CPU has an invariant TSC that the kernel
+ * uses as clocksource as well, the clock reads the TSC directly, scaled by a
+ * factor calibrated against CLOCK_MONOTONIC_RAW in init(). That costs a few
+ * nanoseconds per timestamp instead of a clock_gettime() call.
+ *
+ * init() has to be called once before any thread takes timestamps.
+ */
+class RunClock {
+public:
+    /// Pick and calibrate the source, the run starts now
+    static void init();
+    /// Restart the run at the current time
+    static void reset_epoch();
+
+    static int64_t now()
+    {
+#if defined(__x86_64__)
+        if(s_tsc) {
+            uint64_t ticks = __rdtsc() - s_tsc_epoch;
+            return static_cast<int64_t>((static_cast<unsigned __int128>(ticks) * s_tsc_mult) >> 32);
+        }
+#endif
+        return raw_ns() - s_raw_epoch;
+    }
+
+    /// "tsc" or "monotonic_raw"
+    static std::string source();
+    /// TSC ticks per second, 0 if the TSC is not used
+    static double tsc_frequency();
+    /// now() minus the time since the epoch on CLOCK_MONOTONIC_RAW, the calibration error so far
+    static int64_t drift();
+
+private:
+    static int64_t raw_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return static_cast<int64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+    }
+
+    static bool s_tsc;
+    static uint64_t s_tsc_epoch;
+    /// nanoseconds per tick as 32.32 fixed point
+    static uint64_t s_tsc_mult;
+    static int64_t s_raw_epoch;
+};
+
+/**
+ * Live and dead time of one board from the timestamps of its frames.
+ *
+ * The board is live from arming until the trigger. Everything else from the
+ * first arming to the end of the last transfer is dead time: transfer and
+ * decoding, the capture loop, holds of the detector control. Triggers
+ * divided by live time is the rate the board saw. Frames without an arming
+ * time are left out.
+ */
+class LiveTime {
+public:
+    LiveTime() : m_frames(0), m_live_ns(0), m_first_armed(0), m_last_transferred(0) {}
+
+    void add(const FrameTimestamps& timestamps);
+
+    uint64_t frames() const { return m_frames; }
+    int64_t live_ns() const { return m_live_ns; }
+    int64_t dead_ns() const { return elapsed_ns() - m_live_ns; }
+    int64_t elapsed_ns() const { return m_frames? m_last_transferred - m_first_armed : 0; }
+    double dead_fraction() const;
+    /// Triggers per second of live time
+    double live_rate() const;
+
+private:
+    uint64_t m_frames;
+    int64_t m_live_ns;
+    int64_t m_first_armed;
+    int64_t m_last_transferred;
+};
+
+void print_live_time(const LiveTime& live_time);
+
+#endif // RUNCLOCK_H
@@ -0,0 +1,184 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "synthsource.h"
+#include "metrics.h"
+#include "runclock.h"
+#include "trace.h"
+
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <math.h>
+
+#define NOISE_TABLE_SIZE 65536
+#define PULSE_LENGTH 512
+#define TRIGGER_LATENCY_CELLS 40
+
+SynthSource::SynthSource(float sample_rate, float trigger_delay_percent, const std::array<int, 4>& ch_config,
+                         const RegionOfInterest& roi, const WaitStrategy& wait_strategy, const std::atomic<bool>& abort)
+: m_sample_rate(sample_rate),
+m_trigger_delay_percent(trigger_delay_percent),
+m_ch_config(ch_config),
+m_roi(roi),
+m_abort(abort),
+m_rate(0.0),
+m_amplitude(-100.0),
+m_noise(1.0),
+m_jitter(2.0),
+m_rise(2.0),
+m_fall(20.0),
+m_channels(1),
+m_random(4711),
+m_next_trigger(std::chrono::steady_clock::now()),
+m_wait(wait_strategy)
+{
+    for(size_t i=1; i<4 && ch_config[i] != -1; i++) {
+        m_channels++;
+    }
+}
+
+bool SynthSource::configure(const std::map<std::string, std::string>& options)
+{
+    for(auto it: options) {
+        try {
+            if(it.first == "rate") m_rate = boost::lexical_cast<double>(it.second);
+            else if(it.first == "amplitude") m_amplitude = boost::lexical_cast<float>(it.second);
+            else if(it.first == "noise") m_noise = boost::lexical_cast<float>(it.second);
+            else if(it.first == "jitter") m_jitter = boost::lexical_cast<float>(it.second);
+            else if(it.first == "rise") m_rise = boost::lexical_cast<float>(it.second);
+            else if(it.first == "fall") m_fall = boost::lexical_cast<float>(it.second);
+            else if(it.first == "channels") m_channels = boost::lexical_cast<int>(it.second);
+            else if(it.first == "seed") m_random.seed(boost::lexical_cast<unsigned int>(it.second));
+            else {
+                std::cerr << "Unknown option '" << it.first << "' for synthetic source" << std::endl;
+                return false;
+            }
+        } catch(boost::bad_lexical_cast const& e) {
+            std::cerr << "Cannot parse value '" << it.second << "' of synthetic source option '"
+                      << it.first << "'" << std::endl;
+            return false;
+        }
+    }
+    if(m_channels < 1 || m_channels > 4 || m_rise <= 0.0 || m_fall <= m_rise || m_rate < 0.0) {
+        std::cerr << "Invalid synthetic source settings" << std::endl;
+        return false;
+    }
+
+    std::normal_distribution<float> gauss(0.0, 1.0);
+    m_noise_table.resize(NOISE_TABLE_SIZE);
+    for(auto& n: m_noise_table) {
+        n = m_noise * gauss(m_random);
+    }
+    // cell widths vary by a few percent, like on a real domino ring
+    float nominal_width = 1.0 / m_sample_rate;
+    m_cell_width.resize(FRAME_MAX_SAMPLES);
+    for(auto& w: m_cell_width) {
+        w = nominal_width * (1.0 + 0.03*gauss(m_random));
+    }
+    // normalized double exponential pulse shape, sampled at nominal cell width
+    float t_peak = m_rise*m_fall/(m_fall - m_rise) * logf(m_fall/m_rise);
+    float norm = expf(-t_peak/m_fall) - expf(-t_peak/m_rise);
+    m_pulse.resize(PULSE_LENGTH);
+    for(size_t i=0; i<m_pulse.size(); i++) {
+        float t = i * nominal_width;
+        m_pulse[i] = m_amplitude * (expf(-t/m_fall) - expf(-t/m_rise)) / norm;
+    }
+    return true;
+}
+
+void SynthSource::fill_channel(float* data, float pulse_position, bool with_pulse)
+{
+    std::uniform_int_distribution<size_t> offset_dist(0, NOISE_TABLE_SIZE - m_roi.length);
+    const float* noise = &m_noise_table[offset_dist(m_random)];
+    for(int i=0; i<m_roi.length; i++) {
+        data[i] = noise[i];
+    }
+    if(!with_pulse) {
+        return;
+    }
+    // pulse_position is a readout position, data starts at the ROI
+    int start = static_cast<int>(ceilf(pulse_position)) - m_roi.start;
+    for(int i=std::max(start, 0); i<m_roi.length && i-start < PULSE_LENGTH; i++) {
+        data[i] += m_pulse[i-start];
+    }
+}
+
+bool SynthSource::capture(Frame& frame)
+{
+    frame.timestamps.armed = RunClock::now();
+    if(m_rate > 0.0) {
+        // like on the board, triggers while not armed are lost; the process
+        // has no memory, so the next one is just an interval after arming
+        std::exponential_distribution<double> interval(m_rate);
+        m_next_trigger = std::max(m_next_trigger, std::chrono::steady_clock::now());
+        m_next_trigger += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(interval(m_random)));
+        auto wait_start = std::chrono::steady_clock::now();
+        if(!m_wait.wait_until(m_next_trigger, m_abort))
+            return false;
+        if(m_metrics)
+            m_metrics->record(MS_TRIGGER_WAIT, std::chrono::steady_clock::now() - wait_start);
+    }
+    if(m_abort)
+        return false;
+    frame.timestamps.triggered = RunClock::now();
+
+    std::uniform_int_distribution<int> cell_dist(0, FRAME_MAX_SAMPLES - 1);
+    frame.trigger_cell = cell_dist(m_random);
+    float t = 0.0;
+    for(int i=0; i<m_roi.start + m_roi.length; i++) {
+        if(i >= m_roi.start) {
+            frame.time[i - m_roi.start] = t;
+        }
+        t += m_cell_width[(i+frame.trigger_cell) % FRAME_MAX_SAMPLES];
+    }
+
+    std::normal_distribution<float> jitter(0.0, m_jitter);
+    float pulse_position = trigger_position(m_trigger_delay_percent) + TRIGGER_LATENCY_CELLS + jitter(m_random);
+    // the first channels=N recorded channels get the pulse
+    for(int col=0; col<4 && m_ch_config[col] != -1; col++) {
+        fill_channel(frame.data[m_ch_config[col]], pulse_position, col < m_channels);
+    }
+    frame.timestamps.transferred = RunClock::now();
+    if(Trace::enabled()) {
+        Trace::record("wait_trigger", frame.timestamps.armed, frame.timestamps.triggered);
+        Trace::record("generate", frame.timestamps.triggered, frame.timestamps.transferred);
+    }
+    return true;
+}
+
+bool SynthSource::cell_widths(float* dt)
+{
+    std::copy(m_cell_width.begin(), m_cell_width.end(), dt);
+    return true;
+}
+
+std::string SynthSource::description() const
+{
+    std::ostringstream ss;
+    ss << "synthetic source, " << m_channels << " channel(s), ";
+    if(m_rate > 0.0) ss << m_rate << " Hz";
+    else ss << "free running";
+    ss << ", amplitude " << m_amplitude << " mV, noise " << m_noise << " mV";
+    return ss.str();
+}
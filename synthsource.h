@@ -0,0 +1,90 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef SYNTHSOURCE_H
+#define SYNTHSOURCE_H
+
+#include "framesource.h"
+#include "waitstrategy.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <vector>
+
+/**
+ * Generator of DRS4-like frames, for benchmarking without hardware.
+ *
+ * Produces exponential pulses on top of gaussian noise, at a random trigger
+ * cell with a slightly non-uniform time axis rotated by the trigger cell, the
+ * way calibrated board data looks. Options (from "-S synth:key=value,..."):
+ *
+ *  rate=HZ        mean trigger rate of a poisson process, 0 = as fast as possible (default).
+ *                 Triggers are waited for with the wait strategy of the board readout.
+ *  amplitude=MV   pulse amplitude in mV, negative for negative pulses (default -100)
+ *  noise=MV       RMS of the baseline noise in mV (default 1)
+ *  jitter=CELLS   RMS jitter of the pulse position in cells (default 2)
+ *  rise=NS        pulse rise time constant (default 2ns)
+ *  fall=NS        pulse fall time constant (default 20ns)
+ *  channels=N     number of channels with pulses, 1..4 (default: recorded channels)
+ *  seed=N         random seed
+ */
+class SynthSource : public FrameSource {
+public:
+    SynthSource(float sample_rate, float trigger_delay_percent, const std::array<int, 4>& ch_config,
+                const RegionOfInterest& roi, const WaitStrategy& wait_strategy, const std::atomic<bool>& abort);
+
+    /// Apply "-S synth:..." options, false on unknown or malformed options
+    bool configure(const std::map<std::string, std::string>& options);
+
+    virtual bool capture(Frame& frame);
+    virtual double frequency() const { return m_sample_rate; }
+    virtual std::string description() const;
+    virtual bool cell_widths(float* dt);
+    virtual const TriggerWait* trigger_wait() const { return m_rate > 0.0? &m_wait : NULL; }
+
+private:
+    void fill_channel(float* data, float pulse_position, bool with_pulse);
+
+    float m_sample_rate;
+    float m_trigger_delay_percent;
+    std::array<int, 4> m_ch_config;
+    RegionOfInterest m_roi;
+    const std::atomic<bool>& m_abort;
+
+    double m_rate;
+    float m_amplitude;
+    float m_noise;
+    float m_jitter;
+    float m_rise;
+    float m_fall;
+    int m_channels;
+
+    std::mt19937 m_random;
+    std::vector<float> m_noise_table;
+    std::vector<float> m_cell_width;
+    std::vector<float> m_pulse;
+    std::chrono::steady_clock::time_point m_next_trigger;
+    TriggerWait m_wait;
+};
+
+#endif // SYNTHSOURCE_H
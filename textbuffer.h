@@ -0,0 +1,165 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef TEXTBUFFER_H
+#define TEXTBUFFER_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/// Longest output of format_fixed(), "%f" of -FLT_MAX is 47 characters
+#define FIXED_TEXT_MAX 64
+
+/**
+ * Write value like printf("%f") does, six decimals rounded half to even on
+ * the exact binary value, and return the end of the text. out needs room
+ * for FIXED_TEXT_MAX characters, no terminating zero is written.
+ *
+ * A float is m*2^e with a 24 bit m, so value*10^6 is an integer division by
+ * a power of two for every float below 2^40, done here in 64 bit integers.
+ * Larger values, infinities and NaN go to snprintf.
+ */
+inline char* format_fixed(char* out, float value)
+{
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int exponent = (bits >> 23) & 0xff;
+    if(exponent >= 127 + 40) {
+        return out + snprintf(out, FIXED_TEXT_MAX, "%f", value);
+    }
+    uint64_t mantissa = bits & 0x7fffff;
+    if(exponent) {
+        mantissa |= 0x800000;
+    } else {
+        exponent = 1;  // subnormal
+    }
+    int shift = exponent - 127 - 23;
+    uint64_t micros;
+    if(shift >= 0) {
+        micros = (mantissa << shift) * 1000000;
+    } else if(shift > -64) {
+        uint64_t scaled = mantissa * 1000000;
+        micros = scaled >> -shift;
+        uint64_t rest = scaled & ((uint64_t(1) << -shift) - 1);
+        uint64_t half = uint64_t(1) << (-shift - 1);
+        // branch free, the rounding direction of noise is unpredictable
+        micros += (rest > half) | ((rest == half) & micros);
+    } else {
+        micros = 0;  // below 2^-20 * 10^-6
+    }
+
+    *out = '-';
+    out += bits >> 31;
+    uint64_t integer = micros / 1000000;
+    uint32_t fraction = micros % 1000000;
+    // integer digits two at a time, from the back
+    char digits[20];
+    char* first = digits + sizeof(digits);
+    while(integer >= 100) {
+        first -= 2;
+        memcpy(first, digit_pairs + 2*(integer % 100), 2);
+        integer /= 100;
+    }
+    if(integer >= 10) {
+        first -= 2;
+        memcpy(first, digit_pairs + 2*integer, 2);
+    } else {
+        *--first = '0' + integer;
+    }
+    size_t length = digits + sizeof(digits) - first;
+    memcpy(out, first, length);
+    out += length;
+    *out++ = '.';
+    memcpy(out, digit_pairs + 2*(fraction / 10000), 2);
+    memcpy(out + 2, digit_pairs + 2*(fraction / 100 % 100), 2);
+    memcpy(out + 4, digit_pairs + 2*(fraction % 100), 2);
+    return out + 6;
+}
+
+/**
+ * Growable buffer to assemble output text in, written out in one piece.
+ * Keeps its memory between frames, clear() only forgets the contents.
+ */
+class TextBuffer {
+public:
+    TextBuffer() : m_size(0) {}
+
+    void clear() { m_size = 0; }
+    const char* data() const { return m_data.data(); }
+    size_t size() const { return m_size; }
+
+    /// Room for length more characters at the end, for commit()
+    char* reserve(size_t length)
+    {
+        if(m_size + length > m_data.size()) {
+            m_data.resize(std::max(2*m_data.size(), m_size + length));
+        }
+        return &m_data[m_size];
+    }
+    void commit(size_t length) { m_size += length; }
+
+    void append(char c)
+    {
+        *reserve(1) = c;
+        m_size++;
+    }
+    void append(const char* text, size_t length)
+    {
+        memcpy(reserve(length), text, length);
+        m_size += length;
+    }
+    void append(const std::string& text) { append(text.c_str(), text.length()); }
+    /// value as printed by "%f"
+    void append_fixed(float value)
+    {
+        char* begin = reserve(FIXED_TEXT_MAX);
+        m_size += format_fixed(begin, value) - begin;
+    }
+    /// For headers, slower than append()
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(NULL, 0, format, args);
+        va_end(args);
+        if(length > 0) {
+            va_start(args, format);
+            vsnprintf(reserve(length + 1), length + 1, format, args);
+            va_end(args);
+            m_size += length;
+        }
+    }
+
+private:
+    std::vector<char> m_data;
+    size_t m_size;
+};
+
+#endif // TEXTBUFFER_H
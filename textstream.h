@@ -22,60 +22,88 @@
 #define _TEXT_STREAM_H_
 
 #include "datastream.h"
+#include "trace.h"
+#include "textbuffer.h"
+#include "parallelgzip.h"
+#include <memory>
 #include <stdlib.h>
 #include <stdio.h>
-#include <zlib.h>
 #include <string>
 
 class TextStream : public DataStream {
 private:
     FILE* file;
-    gzFile zfile;
+    OutputFile out;
+    std::unique_ptr<ParallelGzip> zfile;
     int frame_counter;
-    std::string write_fmt;
+    TextBuffer buffer;
 
-    void write_raw(std::string data, bool uncompressed) {
+    bool write_raw(const std::string& data, bool uncompressed) {
+        return write_raw(data.c_str(), data.length(), uncompressed);
+    }
+    /// uncompressed: headers are stored at level 0, readable in the raw file
+    bool write_raw(const char* data, size_t length, bool uncompressed) {
         if(compress_data) {
+            // blocks are compressed in the background, time is recorded there
+            TraceSpan span("gzwrite");
             if(uncompressed) {
-                gzsetparams(zfile, 0, Z_DEFAULT_STRATEGY);
-                gzwrite(zfile, data.c_str(), data.length());
-                gzflush(zfile, Z_SYNC_FLUSH);
-                gzsetparams(zfile, compression_level, Z_DEFAULT_STRATEGY);
-            }
-        }
-        else {
-            fwrite(data.c_str(), 1, data.length(), file);
-            int ferrno = ferror(file);
-            if(ferrno) {
-                clearerr(file);
-                fprintf(stderr, "Writing to output failed! Errno %i\n", ferrno);
+                return zfile->write_stored(data, length);
             }
+            return zfile->write(data, length);
         }
+        return out.write(data, length);
     }
     
+    void write_frame_header(const FrameTimestamps& timestamps) {
+        buffer.clear();
+        buffer.printf("\n\n##FRAME:%i\n# record time: %li us\n"
+                      "# timestamps: armed=%li triggered=%li transferred=%li written=%li ns\n",
+                      frame_counter, timestamps.triggered / 1000, timestamps.armed,
+                      timestamps.triggered, timestamps.transferred, timestamps.written);
+    }
+
     virtual bool init_stream() {
-        write_fmt = "%f";
-        for(auto ch: ch_config) {
-            if(ch != -1) {
-                write_fmt += " %f";
-            }
-        }
-        write_fmt += '\n';
         file = fopen64(filename.c_str(), "wb");
+        if(!file) {
+            fprintf(stderr, "Cannot open output file '%s'\n", filename.c_str());
+            return false;
+        }
+        if(!out.open(file, filename, output_settings)) {
+            return false;
+        }
         if(compress_data) {
-            zfile = gzdopen(fileno(file), "w0");
-                gzsetparams(zfile, compression_level, Z_DEFAULT_STRATEGY);
+            zfile.reset(new ParallelGzip(&out, compression_level, compression_threads));
+            zfile->set_metrics(metrics);
         }
         return true;
     }
     
 public:
     TextStream()
-    : DataStream(), file(0), zfile(0), frame_counter(0) {
+    : DataStream(), file(0), frame_counter(0) {
+    }
+    virtual bool set_output(const OutputSettings& settings) {
+        output_settings = settings;
+        return true;
+    }
+    virtual bool set_compression_level(int level) {
+        if(!zfile) return false;
+        compression_level = level;
+        zfile->set_level(level);
+        return true;
+    }
+    virtual void set_metrics(LaneMetrics* p_metrics) {
+        DataStream::set_metrics(p_metrics);
+        if(zfile) zfile->set_metrics(p_metrics);
+    }
+    virtual uint64_t bytes_written() const {
+        if(zfile) return zfile->bytes_written();
+        return out.offset();
     }
     virtual ~TextStream() {
-        if(zfile) gzclose(zfile);
-        else if(file) fclose(file);
+        zfile.reset();
+        out.close();
+        if(file) fclose(file);
     }
     virtual bool write_header() {
         std::ostringstream plaintext_user_header;
@@ -93,52 +121,58 @@ public:
         char record_date[50];
         time_t now = std::time(0);
         std::strftime(record_date, sizeof(record_date)-1, "%Y-%m-%d, %H-%M-%S", gmtime(&now));
-        char buf[65535];
-        sprintf(buf,
+        buffer.clear();
+        buffer.printf(
             "##METATEXT\n"
-            "# version_i = 2\n"
+            "# version_i = 3\n"
             "# compressed_b = %i\n"
             "# frames_per_sample_i = %i\n"
+            "# roi_start_i = %i\n"
             "# free_trigger_b = %i\n"
             "# channel_config_s = %s\n"
             "# cmd line_s = %s\n"
             "# record_start_date_s = %s\n"
             "##USERHEADER\n%s",
 //                     "# num_frames_i = %i\n
-            compress_data, frames_per_sample, free_trigger,
+            compress_data, frames_per_sample, roi_start, free_trigger,
             ss.str().c_str(), command_line.c_str(), record_date, plaintext_user_header.str().c_str());
-        write_raw(buf, true);
-        return true;
+        return write_raw(buffer.data(), buffer.size(), true);
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data) {
-        char buf[65535];
-        size_t len = sprintf(buf, "\n\n##FRAME:%i\n# record time: %li us\n",
-                             frame_counter, record_time.count() / 1000);
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) {
+        write_frame_header(timestamps);
         for(int i=0; i<frames_per_sample; i++) {
-            len += sprintf(buf+len, "%f %f\n", time[i], data[i]);
+            buffer.append_fixed(time[i]);
+            buffer.append(' ');
+            buffer.append_fixed(data[i]);
+            buffer.append('\n');
         }
-        write_raw(buf, false);
         frame_counter++;
-        return true;
+        return write_raw(buffer.data(), buffer.size(), false);
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data) {
-        char buf[65535];
-        size_t len = sprintf(buf, "\n\n##FRAME:%i\n# record time: %li us\n",
-                             frame_counter, record_time.count() / 1000);
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data) {
+        write_frame_header(timestamps);
         for(int i=0; i<frames_per_sample; i++) {
-            len += sprintf(buf+len, write_fmt.c_str(), time[i],
-                           ch_config[0] != -1? data[ch_config[0]][i] : 0.0f,
-                           ch_config[1] != -1? data[ch_config[1]][i] : 0.0f,
-                           ch_config[2] != -1? data[ch_config[2]][i] : 0.0f,
-                           ch_config[3] != -1? data[ch_config[3]][i] : 0.0f
-                   );
+            buffer.append_fixed(time[i]);
+            for(auto ch: ch_config) {
+                if(ch != -1) {
+                    buffer.append(' ');
+                    buffer.append_fixed(data[ch][i]);
+                }
+            }
+            buffer.append('\n');
         }
-        write_raw(buf, false);
         frame_counter++;
-        return true;
+        return write_raw(buffer.data(), buffer.size(), false);
     }
     virtual bool finalize() {
-        return true;
+        bool ok = true;
+        if(!summary.empty()) {
+            ok = write_raw("\n\n##SUMMARY\n" + format_summary("# ", " = "), true);
+        }
+        if(zfile) {
+            ok = zfile->finish() && ok;
+        }
+        return out.close() && ok;
     }
 
     virtual std::string get_file_extension() const {
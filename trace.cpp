@@ -0,0 +1,170 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "trace.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_CHUNK_EVENTS 65536
+/// 64 chunks of 64k events of 24 bytes: 96 MB per thread at most
+#define TRACE_MAX_CHUNKS 64
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+};
+
+/// Events of one thread, only touched by that thread until the trace is written
+struct TraceBuffer {
+    int tid;
+    std::string thread_name;
+    std::vector<std::unique_ptr<TraceEvent[]> > chunks;
+    size_t count;
+    uint64_t dropped;
+
+    explicit TraceBuffer(int p_tid) : tid(p_tid), count(0), dropped(0)
+    {
+        chunks.emplace_back(new TraceEvent[TRACE_CHUNK_EVENTS]);
+    }
+};
+
+std::mutex s_buffers_mutex;
+std::vector<std::unique_ptr<TraceBuffer> > s_buffers;
+thread_local TraceBuffer* t_buffer = NULL;
+// threads may be named before tracing is switched on
+thread_local std::string t_thread_name;
+
+TraceBuffer* thread_buffer()
+{
+    if(!t_buffer) {
+        std::lock_guard<std::mutex> lock(s_buffers_mutex);
+        s_buffers.emplace_back(new TraceBuffer(s_buffers.size() + 1));
+        t_buffer = s_buffers.back().get();
+        t_buffer->thread_name = t_thread_name;
+    }
+    return t_buffer;
+}
+
+/// JSON string contents, thread names are the only strings not under our control
+std::string escape(const std::string& text)
+{
+    std::string escaped;
+    for(char c: text) {
+        if(c == '"' || c == '\\') escaped += '\\';
+        if(static_cast<unsigned char>(c) >= 0x20) escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+std::atomic<bool> Trace::s_enabled(false);
+
+void Trace::enable()
+{
+    s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void Trace::set_thread_name(const std::string& name)
+{
+    t_thread_name = name;
+    if(t_buffer) {
+        t_buffer->thread_name = name;
+    }
+}
+
+void Trace::record(const char* name, int64_t begin_ns, int64_t end_ns)
+{
+    TraceBuffer* buffer = thread_buffer();
+    if(buffer->count == buffer->chunks.size() * TRACE_CHUNK_EVENTS) {
+        if(buffer->chunks.size() >= TRACE_MAX_CHUNKS) {
+            buffer->dropped++;
+            return;
+        }
+        buffer->chunks.emplace_back(new TraceEvent[TRACE_CHUNK_EVENTS]);
+    }
+    TraceEvent& event = buffer->chunks[buffer->count / TRACE_CHUNK_EVENTS][buffer->count % TRACE_CHUNK_EVENTS];
+    event.name = name;
+    event.begin = begin_ns;
+    event.end = end_ns;
+    buffer->count++;
+}
+
+uint64_t Trace::events()
+{
+    std::lock_guard<std::mutex> lock(s_buffers_mutex);
+    uint64_t count = 0;
+    for(auto& buffer: s_buffers) {
+        count += buffer->count;
+    }
+    return count;
+}
+
+uint64_t Trace::dropped()
+{
+    std::lock_guard<std::mutex> lock(s_buffers_mutex);
+    uint64_t count = 0;
+    for(auto& buffer: s_buffers) {
+        count += buffer->dropped;
+    }
+    return count;
+}
+
+bool Trace::write(const std::string& filename)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if(!file) {
+        std::cerr << "Cannot write trace '" << filename << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(s_buffers_mutex);
+    // complete events ("X") in microseconds, with nanosecond digits
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"get_data\"}}");
+    for(auto& buffer: s_buffers) {
+        if(!buffer->thread_name.empty()) {
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+                    buffer->tid, escape(buffer->thread_name).c_str());
+        }
+        for(size_t i=0; i<buffer->count; i++) {
+            const TraceEvent& event = buffer->chunks[i / TRACE_CHUNK_EVENTS][i % TRACE_CHUNK_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, buffer->tid, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if(!ok) {
+        std::cerr << "Writing trace '" << filename << "' failed: " << strerror(errno) << std::endl;
+    }
+    return ok;
+}
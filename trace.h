@@ -0,0 +1,88 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "runclock.h"
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Spans of the acquisition hot path, written in the Chrome trace event
+ * format for chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records into a buffer of its own, so recording takes no lock
+ * and shares no cache line with other threads. Buffers grow in chunks up to
+ * a limit, events beyond it are counted as dropped. Timestamps come from the
+ * RunClock, the same as the frame timestamps.
+ *
+ * While tracing is off, a span costs one relaxed load of a flag. Tracing is
+ * switched on after the RunClock is initialized, and the trace is written
+ * after the threads recording into it are done.
+ */
+class Trace {
+public:
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void enable();
+
+    /// Name of the calling thread in the trace, may be set before tracing is enabled
+    static void set_thread_name(const std::string& name);
+    /// A finished span, name must be a string literal
+    static void record(const char* name, int64_t begin_ns, int64_t end_ns);
+
+    /// Write all events as Chrome trace JSON, false if the file cannot be written
+    static bool write(const std::string& filename);
+    static uint64_t events();
+    static uint64_t dropped();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+/**
+ * Records the time from its construction to its destruction as a span
+ */
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+    : m_name(Trace::enabled()? name : NULL), m_begin(m_name? RunClock::now() : 0)
+    {
+    }
+    ~TraceSpan()
+    {
+        if(m_name) {
+            Trace::record(m_name, m_begin, RunClock::now());
+        }
+    }
+
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+
+    const char* m_name;
+    int64_t m_begin;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,148 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include "waitstrategy.h"
+
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+
+/// Polls before WS_YIELD starts to yield
+#define WAIT_SPIN_ROUNDS 64
+
+bool parse_wait_strategy(const std::string& spec, WaitStrategy& strategy)
+{
+    std::string name(spec.substr(0, spec.find(':')));
+    if(name == "spin") strategy.type = WS_SPIN;
+    else if(name == "yield") strategy.type = WS_YIELD;
+    else if(name == "sleep") strategy.type = WS_SLEEP;
+    else return false;
+    if(name.size() < spec.size()) {
+        if(strategy.type != WS_SLEEP) {
+            return false;
+        }
+        try {
+            strategy.max_sleep_us = boost::lexical_cast<unsigned int>(spec.substr(name.size() + 1));
+        } catch(boost::bad_lexical_cast const& e) {
+            return false;
+        }
+        if(strategy.max_sleep_us == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string wait_strategy_name(const WaitStrategy& strategy)
+{
+    switch(strategy.type) {
+        case WS_SPIN: return "spin";
+        case WS_YIELD: return "yield";
+        case WS_SLEEP: {
+            std::ostringstream ss;
+            ss << "sleep:" << strategy.max_sleep_us;
+            return ss.str();
+        }
+    }
+    return "unknown";
+}
+
+static int64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+TriggerWait::TriggerWait(const WaitStrategy& strategy)
+: m_strategy(strategy), m_cpu_begin(0), m_polls(0), m_wait_ns(0), m_cpu_ns(0)
+{
+}
+
+bool TriggerWait::wait_until(const steady_clock::time_point& trigger, const std::atomic<bool>& abort)
+{
+    steady_clock::time_point last_busy, detected;
+    begin();
+    if(!poll([&trigger]() { return steady_clock::now() < trigger; }, abort, last_busy, detected)) {
+        return false;
+    }
+    end(detected, std::max(static_cast<int64_t>(0),
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(detected - trigger).count()));
+    return true;
+}
+
+void TriggerWait::begin()
+{
+    m_begin = steady_clock::now();
+    m_cpu_begin = thread_cpu_ns();
+}
+
+void TriggerWait::pause(unsigned int round)
+{
+    switch(m_strategy.type) {
+        case WS_SPIN:
+            break;
+        case WS_YIELD:
+            if(round < WAIT_SPIN_ROUNDS) {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            } else {
+                std::this_thread::yield();
+            }
+            break;
+        case WS_SLEEP: {
+            // 1us, 2us, 4us, ... up to the maximum
+            unsigned int sleep_us = round < 31? 1u << round : m_strategy.max_sleep_us;
+            usleep(std::min(sleep_us, m_strategy.max_sleep_us));
+            break;
+        }
+    }
+}
+
+void TriggerWait::end(const steady_clock::time_point& detected, int64_t latency_ns)
+{
+    m_latency.add(latency_ns);
+    m_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(detected - m_begin).count();
+    m_cpu_ns += thread_cpu_ns() - m_cpu_begin;
+}
+
+void print_trigger_wait_stats(const TriggerWait& wait)
+{
+    const LatencyHistogram& latency = wait.latency();
+    double cpu_load = wait.wait_time().count() > 0?
+        static_cast<double>(wait.cpu_time().count()) / wait.wait_time().count() : 0.0;
+    std::cout << "  trigger wait (" << wait_strategy_name(wait.strategy()) << "): "
+              << latency.count() << " triggers, "
+              << (latency.count()? static_cast<double>(wait.polls())/latency.count() : 0.0) << " polls/trigger, "
+              << cpu_load*100.0 << "% CPU while waiting\n"
+              << "  trigger latency: mean " << latency.mean()/1000.0 << "us"
+              << ", p50 " << latency.quantile(0.5)/1000.0 << "us"
+              << ", p99 " << latency.quantile(0.99)/1000.0 << "us"
+              << ", p99.9 " << latency.quantile(0.999)/1000.0 << "us"
+              << ", max " << latency.max()/1000.0 << "us" << std::endl;
+}
@@ -0,0 +1,133 @@
+/*
+ * get_data - Record data from DRS4 Evaluation boards via provided libs
+ * Copyright (C) 2014  Gregor Vollmer <vollmer@ekp.uni-karlsruhe.de>
+ *                     and those in the CONTRIBUTORS file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef WAITSTRATEGY_H
+#define WAITSTRATEGY_H
+
+#include "histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+/**
+ * How a capture loop waits for the next trigger
+ */
+enum wait_strategy_t {
+    WS_SPIN,   ///< poll continuously, lowest latency, one full core per board
+    WS_YIELD,  ///< poll, give the core to other threads between polls after a short spin
+    WS_SLEEP   ///< poll with exponentially growing sleeps, up to a maximum
+};
+
+struct WaitStrategy {
+    wait_strategy_t type;
+    unsigned int max_sleep_us;  ///< only used by WS_SLEEP
+
+    WaitStrategy() : type(WS_SPIN), max_sleep_us(1000) {}
+};
+
+/// Parse "spin", "yield" or "sleep[:MAX_US]"
+bool parse_wait_strategy(const std::string& spec, WaitStrategy& strategy);
+std::string wait_strategy_name(const WaitStrategy& strategy);
+
+/**
+ * Waits for a trigger with the selected strategy and keeps statistics about
+ * the cost and the latency of waiting.
+ *
+ * The latency is the time from the trigger to the moment the capture loop
+ * noticed it. If the trigger time is unknown, as for the board's busy flag,
+ * the time since the last poll which still saw no trigger is recorded, which
+ * is an upper bound of the actual latency. CPU time is taken from the calling
+ * thread, so the CPU load shows what the strategy costs.
+ */
+class TriggerWait {
+public:
+    explicit TriggerWait(const WaitStrategy& strategy);
+
+    /// Poll busy() until it returns false. False if aborted.
+    template<typename Busy>
+    bool wait(Busy busy, const std::atomic<bool>& abort);
+    /// Wait until a known trigger time. False if aborted.
+    bool wait_until(const std::chrono::steady_clock::time_point& trigger, const std::atomic<bool>& abort);
+
+    const WaitStrategy& strategy() const { return m_strategy; }
+    const LatencyHistogram& latency() const { return m_latency; }
+    uint64_t polls() const { return m_polls; }
+    /// Wall clock time spent waiting
+    std::chrono::nanoseconds wait_time() const { return std::chrono::nanoseconds(m_wait_ns); }
+    /// CPU time spent waiting
+    std::chrono::nanoseconds cpu_time() const { return std::chrono::nanoseconds(m_cpu_ns); }
+
+private:
+    template<typename Busy>
+    bool poll(Busy busy, const std::atomic<bool>& abort,
+              std::chrono::steady_clock::time_point& last_busy,
+              std::chrono::steady_clock::time_point& detected);
+    void begin();
+    /// Between two polls
+    void pause(unsigned int round);
+    void end(const std::chrono::steady_clock::time_point& detected, int64_t latency_ns);
+
+    WaitStrategy m_strategy;
+    std::chrono::steady_clock::time_point m_begin;
+    int64_t m_cpu_begin;
+    LatencyHistogram m_latency;
+    uint64_t m_polls;
+    int64_t m_wait_ns;
+    int64_t m_cpu_ns;
+};
+
+template<typename Busy>
+bool TriggerWait::poll(Busy busy, const std::atomic<bool>& abort,
+                       std::chrono::steady_clock::time_point& last_busy,
+                       std::chrono::steady_clock::time_point& detected)
+{
+    last_busy = m_begin;
+    for(unsigned int round=0; !abort; round++) {
+        std::chrono::steady_clock::time_point poll_start = std::chrono::steady_clock::now();
+        m_polls++;
+        if(!busy()) {
+            detected = std::chrono::steady_clock::now();
+            return true;
+        }
+        last_busy = poll_start;
+        pause(round);
+    }
+    return false;
+}
+
+template<typename Busy>
+bool TriggerWait::wait(Busy busy, const std::atomic<bool>& abort)
+{
+    std::chrono::steady_clock::time_point last_busy, detected;
+    begin();
+    if(!poll(busy, abort, last_busy, detected)) {
+        return false;
+    }
+    end(detected, std::chrono::duration_cast<std::chrono::nanoseconds>(detected - last_busy).count());
+    return true;
+}
+
+void print_trigger_wait_stats(const TriggerWait& wait);
+
+#endif // WAITSTRATEGY_H
@@ -22,22 +22,36 @@
 #define _YAMLBINARY_H_
 
 #include "datastream.h"
+#include "drscalibration.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
 #include <sstream>
+#include <vector>
 
 using namespace std;
 
 class YAMLBinaryStream : public DataStream {
 protected:
     FILE* file;
+    /// the file after the header
+    OutputFile data_file;
+    /// frame data and summary, compressed in blocks with a codec
+    CodecWriter output;
+    CodecSettings codec;
     int frame_counter;
     int first_header_length;
+    std::vector<float> cell_widths;
     virtual bool init_stream() {
         file = fopen64(filename.c_str(), "wb");
         return true;
     }
+
+    void write_timestamps(const FrameTimestamps& timestamps) {
+        int64_t frame_timestamps[4] = {timestamps.armed, timestamps.triggered,
+                                       timestamps.transferred, timestamps.written};
+        output.write(frame_timestamps, sizeof(frame_timestamps), 1);
+    }
     
     string format_header() {
         ostringstream header;
@@ -60,36 +74,101 @@ public:
     YAMLBinaryStream() : frame_counter(0), first_header_length(0) {
     }
     virtual ~YAMLBinaryStream() {
+        data_file.close();
         if(file) fclose(file);
     }
+    virtual bool set_cell_widths(const float* dt) {
+        cell_widths.assign(dt, dt + DRS_NUM_CELLS);
+        return true;
+    }
+    virtual bool set_codec(const CodecSettings& p_codec) {
+        codec = p_codec;
+        return true;
+    }
+    virtual bool set_output(const OutputSettings& settings) {
+        output_settings = settings;
+        return true;
+    }
+    virtual bool set_compression_level(int level) {
+        if(codec.codec == CODEC_NONE) return false;
+        codec.level = level;
+        output.set_level(level);
+        return true;
+    }
+    virtual void set_metrics(LaneMetrics* p_metrics) {
+        DataStream::set_metrics(p_metrics);
+        output.set_metrics(p_metrics);
+    }
     virtual bool write_header() {
+        if(!cell_widths.empty()) {
+            // frames are uint16 trigger cell and data then
+            ostringstream widths;
+            widths.precision(9);
+            widths << "[" << cell_widths[0];
+            for(size_t i=1; i<cell_widths.size(); i++) {
+                widths << "," << cell_widths[i];
+            }
+            widths << "]";
+            add_user_entry("cell_widths_ns", widths.str());
+        }
         add_user_entry("samples_per_frame", frames_per_sample);
+        add_user_entry("roi_start", roi_start);
         add_user_entry("trigger_delay_percent", trigger_delay_percent);
+        // every frame starts with int64 ns armed, triggered, transferred and written
+        add_user_entry("frame_timestamps", true);
+        if(codec.codec != CODEC_NONE) {
+            // frames and the summary document are codec blocks after the header
+            add_user_entry("codec", format_codec_spec(codec));
+        }
         string header = format_header();
         first_header_length = header.length();
         fwrite(header.c_str(), header.length(), 1, file);
+        if(!data_file.open(file, filename, output_settings)) {
+            return false;
+        }
+        output.open(&data_file, codec, sizeof(float));
         return true;
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, float* data) {
+    virtual bool write(const Frame& frame) {
+        if(cell_widths.empty() || ch_config[1] != -1) {
+            return DataStream::write(frame);
+        }
         if(frame_counter > 999999999)
             return false;
         frame_counter++;
-        fwrite(time, sizeof(float), frames_per_sample, file);
-        fwrite(data, sizeof(float), frames_per_sample, file);
-        return true;
+        write_timestamps(frame.timestamps);
+        uint16_t trigger_cell = frame.trigger_cell;
+        output.write(&trigger_cell, sizeof(trigger_cell), 1);
+        return output.write(frame.data[ch_config[0]], sizeof(float), frames_per_sample);
+    }
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, float* data) {
+        if(frame_counter > 999999999)
+            return false;
+        frame_counter++;
+        write_timestamps(timestamps);
+        output.write(time, sizeof(float), frames_per_sample);
+        return output.write(data, sizeof(float), frames_per_sample);
     }
-    virtual bool write_frame(const nanoseconds& record_time, float* time, const std::array<float*, 4>& data)
+    virtual bool write_frame(const FrameTimestamps& timestamps, float* time, const std::array<float*, 4>& data)
     {
         throw not_suppported_write("YAML binary with multi channel recording.");
         return true;
     }
     virtual bool finalize() {
-        return true;
+        if(!summary.empty()) {
+            string summary_doc = "\n---\n" + format_summary(" - ", ": ") + "...";
+            output.write(summary_doc.c_str(), summary_doc.length(), 1);
+        }
+        bool ok = output.finish();
+        return data_file.close() && ok;
     }
 
     virtual std::string get_file_extension() const {
         return std::string(".ybin");
     }
+    virtual uint64_t bytes_written() const {
+        return output.bytes_written();
+    }
 };
 
 #endif